@@ -1,7 +1,8 @@
+#include <algorithm>
+#include <cmath>
 #include <future>
-#include <queue>
+#include <random>
 #include <spdlog/spdlog.h>
-#include <stack>
 
 #include "batch_quasistatic_simulator.h"
 #include "quasistatic_simulator.h"
@@ -15,15 +16,15 @@ BatchQuasistaticSimulator::BatchQuasistaticSimulator(
     const std::string &model_directive_path,
     const std::unordered_map<std::string, Eigen::VectorXd> &robot_stiffness_str,
     const std::unordered_map<std::string, std::string> &object_sdf_paths,
-    const QuasistaticSimParameters &sim_params)
-    : num_max_parallel_executions(std::thread::hardware_concurrency()),
-      solver_(std::make_unique<drake::solvers::GurobiSolver>()) {
+    const QuasistaticSimParameters &sim_params,
+    const CollisionFilterParameters &collision_filter)
+    : num_max_parallel_executions(std::thread::hardware_concurrency()) {
   std::random_device rd;
-  gen_.seed(rd());
+  seed_ = (static_cast<uint64_t>(rd()) << 32) | rd();
 
   for (int i = 0; i < num_max_parallel_executions; i++) {
     q_sims_.emplace_back(model_directive_path, robot_stiffness_str,
-                         object_sdf_paths, sim_params);
+                         object_sdf_paths, sim_params, collision_filter);
   }
 }
 
@@ -55,39 +56,51 @@ Eigen::MatrixXd BatchQuasistaticSimulator::CalcBundledB(
 }
 
 std::tuple<bool, bool> IsABNeeded(GradientMode gm) {
-  bool calc_A = gm == GradientMode::kAB;
+  bool calc_A = gm == GradientMode::kAB or gm == GradientMode::kABBroyden;
   bool calc_B = calc_A or gm == GradientMode::kBOnly;
   return {calc_A, calc_B};
 }
 
+/*
+ * sim_params, with GradientMode::kABBroyden replaced by GradientMode::kAB.
+ * The secant updates of kABBroyden need consecutive steps of a trajectory,
+ * which unrelated tasks, or samples, are not.
+ */
+QuasistaticSimParameters
+WithoutBroyden(const QuasistaticSimParameters &sim_params) {
+  auto params = sim_params;
+  if (params.gradient_mode == GradientMode::kABBroyden) {
+    params.gradient_mode = GradientMode::kAB;
+  }
+  return params;
+}
+
 std::tuple<Eigen::MatrixXd, std::vector<Eigen::MatrixXd>,
            std::vector<Eigen::MatrixXd>, std::vector<bool>>
 BatchQuasistaticSimulator::CalcDynamicsSerial(
     const Eigen::Ref<const Eigen::MatrixXd> &x_batch,
     const Eigen::Ref<const Eigen::MatrixXd> &u_batch,
-    const QuasistaticSimParameters &sim_params) const {
+    const QuasistaticSimParameters &sim_params_in) const {
+  const auto sim_params = WithoutBroyden(sim_params_in);
   const auto &[calc_A, calc_B] = IsABNeeded(sim_params.gradient_mode);
 
   auto &q_sim = get_q_sim();
   const size_t n_tasks = x_batch.rows();
   DRAKE_THROW_UNLESS(n_tasks == u_batch.rows());
-  MatrixXd x_next_batch(x_batch);
-  std::vector<MatrixXd> A_batch;
-  std::vector<MatrixXd> B_batch;
-  std::vector<bool> is_valid_batch(n_tasks);
   const auto n_q = x_batch.cols();
   const auto n_u = u_batch.cols();
+  MatrixXd x_next_batch(x_batch);
+  std::vector<MatrixXd> A_batch(calc_A ? n_tasks : 0, MatrixXd(n_q, n_q));
+  std::vector<MatrixXd> B_batch(calc_B ? n_tasks : 0, MatrixXd(n_q, n_u));
+  std::vector<bool> is_valid_batch(n_tasks);
 
+  MatrixXd no_gradient;
   for (int i = 0; i < n_tasks; i++) {
     try {
-      x_next_batch.row(i) = QuasistaticSimulator::CalcDynamics(
-          &q_sim, x_batch.row(i), u_batch.row(i), sim_params);
-      if (calc_B) {
-        B_batch.emplace_back(q_sim.get_Dq_nextDqa_cmd());
-      }
-      if (calc_A) {
-        A_batch.emplace_back(q_sim.get_Dq_nextDq());
-      }
+      CalcDynamicsCached(&q_sim, x_batch.row(i), u_batch.row(i), sim_params,
+                         x_next_batch.row(i).transpose(),
+                         calc_A ? A_batch[i] : no_gradient,
+                         calc_B ? B_batch[i] : no_gradient);
       is_valid_batch[i] = true;
     } catch (std::runtime_error &err) {
       is_valid_batch[i] = false;
@@ -97,6 +110,37 @@ BatchQuasistaticSimulator::CalcDynamicsSerial(
   return {x_next_batch, A_batch, B_batch, is_valid_batch};
 }
 
+void BatchQuasistaticSimulator::CalcDynamicsCached(
+    QuasistaticSimulator *q_sim, const Eigen::Ref<const Eigen::VectorXd> &q,
+    const Eigen::Ref<const Eigen::VectorXd> &u,
+    const QuasistaticSimParameters &sim_params,
+    Eigen::Ref<Eigen::VectorXd, 0, Eigen::InnerStride<>> x_next,
+    Eigen::Ref<Eigen::MatrixXd> A, Eigen::Ref<Eigen::MatrixXd> B) const {
+  const auto [calc_A, calc_B] = IsABNeeded(sim_params.gradient_mode);
+  // Sleeping objects depend on the previous calls of q_sim.
+  DRAKE_ASSERT(sim_params.gradient_mode != GradientMode::kABBroyden);
+  const bool use_cache =
+      dynamics_cache_ and not(sim_params.use_contact_islands and
+                              sim_params.sleep_velocity_threshold > 0);
+  if (use_cache and dynamics_cache_->Find(q, u, sim_params, x_next, A, B)) {
+    return;
+  }
+
+  x_next = QuasistaticSimulator::CalcDynamics(q_sim, q, u, sim_params);
+  if (calc_B) {
+    B = q_sim->get_Dq_nextDqa_cmd();
+  }
+  if (calc_A) {
+    A = q_sim->get_Dq_nextDq();
+  }
+
+  if (use_cache) {
+    dynamics_cache_->Insert(q, u, sim_params, x_next,
+                            A.leftCols(calc_A ? A.cols() : 0),
+                            B.leftCols(calc_B ? B.cols() : 0));
+  }
+}
+
 std::vector<size_t>
 BatchQuasistaticSimulator::CalcBatchSizes(size_t n_tasks, size_t n_threads) {
   const auto batch_size = n_tasks / n_threads;
@@ -110,14 +154,59 @@ BatchQuasistaticSimulator::CalcBatchSizes(size_t n_tasks, size_t n_threads) {
   return batch_sizes;
 }
 
-template <typename T>
-std::vector<T> AssembleListsOfVectors(std::list<std::vector<T>> &list_of_vec) {
-  std::vector<T> batch;
-  for (auto iter = list_of_vec.begin(); iter != list_of_vec.end(); iter++) {
-    batch.insert(batch.end(), std::make_move_iterator(iter->begin()),
-                 std::make_move_iterator(iter->end()));
+std::vector<BatchQuasistaticSimulator::SampleBlock>
+BatchQuasistaticSimulator::SplitIntoBlocks(const std::vector<int> &j_start,
+                                           const std::vector<int> &n_units) {
+  DRAKE_THROW_UNLESS(j_start.size() == n_units.size());
+  const int T = n_units.size();
+  if (T == 0) {
+    return {};
+  }
+  const int n_blocks_per_step = (kMinBlocks + T - 1) / T;
+  std::vector<SampleBlock> blocks;
+  for (int t = 0; t < T; t++) {
+    if (n_units[t] == 0) {
+      continue;
+    }
+    int j = j_start[t];
+    const auto n_blocks = std::min(n_blocks_per_step, n_units[t]);
+    for (const auto n : CalcBatchSizes(n_units[t], n_blocks)) {
+      blocks.push_back({t, j, static_cast<int>(n)});
+      j += n;
+    }
+  }
+  return blocks;
+}
+
+void BatchQuasistaticSimulator::DispatchTasksParallel(
+    const size_t n_tasks,
+    const std::function<void(QuasistaticSimulator *, size_t)> &task) const {
+  if (n_tasks == 0) {
+    return;
+  }
+
+  const auto n_threads =
+      std::min({num_max_parallel_executions, q_sims_.size(), n_tasks});
+
+  // Launch threads.
+  std::atomic<size_t> next_task{0};
+  std::vector<std::future<void>> operations;
+  operations.reserve(n_threads);
+  for (size_t i_thread = 0; i_thread < n_threads; i_thread++) {
+    // subscript _t indicates a quantity for a thread.
+    auto run_tasks = [&q_sim_t = q_sims_[i_thread], &task, &next_task,
+                      n_tasks] {
+      for (size_t i = next_task++; i < n_tasks; i = next_task++) {
+        task(&q_sim_t, i);
+      }
+    };
+    operations.emplace_back(
+        std::async(std::launch::async, std::move(run_tasks)));
+  }
+
+  for (auto &op : operations) {
+    op.get(); // catch exceptions.
   }
-  return batch;
 }
 
 std::tuple<Eigen::MatrixXd, std::vector<Eigen::MatrixXd>,
@@ -125,121 +214,288 @@ std::tuple<Eigen::MatrixXd, std::vector<Eigen::MatrixXd>,
 BatchQuasistaticSimulator::CalcDynamicsParallel(
     const Eigen::Ref<const Eigen::MatrixXd> &x_batch,
     const Eigen::Ref<const Eigen::MatrixXd> &u_batch,
-    const QuasistaticSimParameters &sim_params) const {
+    const QuasistaticSimParameters &sim_params_in) const {
+  const auto sim_params = WithoutBroyden(sim_params_in);
   const auto [calc_A, calc_B] = IsABNeeded(sim_params.gradient_mode);
-  auto &q_sim = get_q_sim();
 
-  // Compute number of threads and batch size for each thread.
   const size_t n_tasks = x_batch.rows();
   DRAKE_THROW_UNLESS(n_tasks == u_batch.rows());
-  const auto n_threads = std::min(num_max_parallel_executions, n_tasks);
-  const auto batch_sizes = CalcBatchSizes(n_tasks, n_threads);
 
-  // Allocate storage for results.
+  // Allocate storage for results. Every task writes into its own slot.
   const auto n_q = x_batch.cols();
   const auto n_u = u_batch.cols();
+  MatrixXd x_next_batch(n_tasks, n_q);
+  std::vector<MatrixXd> A_batch(calc_A ? n_tasks : 0, MatrixXd(n_q, n_q));
+  std::vector<MatrixXd> B_batch(calc_B ? n_tasks : 0, MatrixXd(n_q, n_u));
+  // std::vector<bool> is bit-packed, and cannot be written concurrently.
+  VectorXb is_valid_batch(n_tasks);
+
+  DispatchTasksParallel(
+      n_tasks, [&, calc_A = calc_A, calc_B = calc_B](
+                   QuasistaticSimulator *q_sim, const size_t i) {
+        try {
+          MatrixXd no_gradient;
+          CalcDynamicsCached(q_sim, x_batch.row(i), u_batch.row(i),
+                             sim_params, x_next_batch.row(i).transpose(),
+                             calc_A ? A_batch[i] : no_gradient,
+                             calc_B ? B_batch[i] : no_gradient);
+          is_valid_batch[i] = true;
+        } catch (std::runtime_error &err) {
+          is_valid_batch[i] = false;
+          spdlog::warn(err.what());
+        }
+      });
 
-  std::list<MatrixXd> x_next_list;
-  std::list<std::vector<MatrixXd>> A_list;
-  std::list<std::vector<MatrixXd>> B_list;
-  std::list<std::vector<bool>> is_valid_list;
-  for (int i = 0; i < n_threads; i++) {
-    x_next_list.emplace_back(batch_sizes[i], n_q);
-
-    if (calc_B) {
-      B_list.emplace_back(batch_sizes[i]);
-    }
+  return {std::move(x_next_batch), std::move(A_batch), std::move(B_batch),
+          std::vector<bool>(is_valid_batch.begin(), is_valid_batch.end())};
+}
 
-    if (calc_A) {
-      A_list.emplace_back(batch_sizes[i]);
-    }
+void BatchQuasistaticSimulator::CalcDynamicsParallel(
+    const Eigen::Ref<const Eigen::MatrixXd> &x_batch,
+    const Eigen::Ref<const Eigen::MatrixXd> &u_batch,
+    const QuasistaticSimParameters &sim_params_in,
+    Eigen::Ref<Eigen::MatrixXd> x_next_batch,
+    Eigen::Ref<Eigen::MatrixXd> A_batch, Eigen::Ref<Eigen::MatrixXd> B_batch,
+    Eigen::Ref<VectorXb> is_valid_batch) const {
+  const auto sim_params = WithoutBroyden(sim_params_in);
+  const auto [calc_A, calc_B] = IsABNeeded(sim_params.gradient_mode);
 
-    is_valid_list.emplace_back(batch_sizes[i]);
+  const size_t n_tasks = x_batch.rows();
+  const auto n_q = x_batch.cols();
+  const auto n_u = u_batch.cols();
+  DRAKE_THROW_UNLESS(n_tasks == u_batch.rows());
+  DRAKE_THROW_UNLESS(x_next_batch.rows() == n_tasks);
+  DRAKE_THROW_UNLESS(x_next_batch.cols() == n_q);
+  DRAKE_THROW_UNLESS(is_valid_batch.size() == n_tasks);
+  if (calc_A) {
+    DRAKE_THROW_UNLESS(A_batch.rows() == n_q);
+    DRAKE_THROW_UNLESS(A_batch.cols() == n_tasks * n_q);
+  }
+  if (calc_B) {
+    DRAKE_THROW_UNLESS(B_batch.rows() == n_q);
+    DRAKE_THROW_UNLESS(B_batch.cols() == n_tasks * n_u);
   }
 
-  // Launch threads.
-  std::list<std::future<void>> operations;
-  auto q_sim_iter = q_sims_.begin();
-  auto x_next_iter = x_next_list.begin();
-  auto A_iter = A_list.begin();
-  auto B_iter = B_list.begin();
-  auto is_valid_iter = is_valid_list.begin();
-
-  for (int i_thread = 0; i_thread < n_threads; i_thread++) {
-    // subscript _t indicates a quantity for a thread.
-    auto calc_dynamics_batch = [&q_sim = *q_sim_iter, &x_batch, &u_batch,
-                                &x_next_t = *x_next_iter, &A_t = *A_iter,
-                                &B_t = *B_iter, &is_valid_t = *is_valid_iter,
-                                &batch_sizes, i_thread, &sim_params,
-                                calc_A = calc_A, calc_B = calc_B] {
-      const auto offset = std::accumulate(batch_sizes.begin(),
-                                          batch_sizes.begin() + i_thread, 0);
-      for (int i = 0; i < batch_sizes[i_thread]; i++) {
+  DispatchTasksParallel(
+      n_tasks, [&, calc_A = calc_A, calc_B = calc_B](
+                   QuasistaticSimulator *q_sim, const size_t i) {
         try {
-          x_next_t.row(i) = QuasistaticSimulator::CalcDynamics(
-              &q_sim, x_batch.row(i + offset), u_batch.row(i + offset),
-              sim_params);
+          CalcDynamicsCached(
+              q_sim, x_batch.row(i), u_batch.row(i), sim_params,
+              x_next_batch.row(i).transpose(),
+              calc_A ? A_batch.middleCols(i * n_q, n_q) : A_batch.leftCols(0),
+              calc_B ? B_batch.middleCols(i * n_u, n_u) : B_batch.leftCols(0));
+          is_valid_batch[i] = true;
+        } catch (std::runtime_error &err) {
+          is_valid_batch[i] = false;
+          spdlog::warn(err.what());
+        }
+      });
+}
 
-          if (calc_B) {
-            B_t[i] = q_sim.get_Dq_nextDqa_cmd();
+BatchRollouts BatchQuasistaticSimulator::RolloutParallel(
+    const Eigen::Ref<const Eigen::MatrixXd> &x0_batch,
+    const std::vector<Eigen::MatrixXd> &u_trj_batch,
+    const QuasistaticSimParameters &sim_params) const {
+  return RolloutParallel(x0_batch, u_trj_batch, {}, MatrixXd(0, 0),
+                         sim_params);
+}
+
+BatchRollouts BatchQuasistaticSimulator::RolloutParallel(
+    const Eigen::Ref<const Eigen::MatrixXd> &x0_batch,
+    const std::vector<Eigen::MatrixXd> &u_trj_batch,
+    const std::vector<Eigen::MatrixXd> &K_list,
+    const Eigen::Ref<const Eigen::MatrixXd> &x_trj_nominal,
+    const QuasistaticSimParameters &sim_params) const {
+  const auto [calc_A, calc_B] = IsABNeeded(sim_params.gradient_mode);
+  const size_t K = x0_batch.rows();
+  DRAKE_THROW_UNLESS(u_trj_batch.size() == K);
+  const int n_q = x0_batch.cols();
+  const int T = K > 0 ? u_trj_batch[0].rows() : 0;
+  for (const auto &u_trj : u_trj_batch) {
+    DRAKE_THROW_UNLESS(u_trj.rows() == T);
+  }
+  const bool has_feedback = not K_list.empty();
+  if (has_feedback) {
+    DRAKE_THROW_UNLESS(K_list.size() == T);
+    DRAKE_THROW_UNLESS(x_trj_nominal.rows() >= T);
+    DRAKE_THROW_UNLESS(x_trj_nominal.cols() == n_q);
+  }
+
+  BatchRollouts rollouts;
+  rollouts.x_trj_list.resize(
+      K, MatrixXd::Constant(T + 1, n_q,
+                            std::numeric_limits<double>::quiet_NaN()));
+  rollouts.u_trj_list = u_trj_batch;
+  rollouts.A_trj_list.resize(calc_A ? K : 0, std::vector<MatrixXd>(T));
+  rollouts.B_trj_list.resize(calc_B ? K : 0, std::vector<MatrixXd>(T));
+  rollouts.is_valid = MatrixXb::Zero(K, T);
+  const bool is_broyden = sim_params.gradient_mode == GradientMode::kABBroyden;
+  rollouts.gradient_staleness = Eigen::MatrixXi::Zero(is_broyden ? K : 0, T);
+
+  DispatchTasksParallel(
+      K, [&, calc_A = calc_A, calc_B = calc_B](QuasistaticSimulator *q_sim,
+                                               const size_t k) {
+        auto &x_trj = rollouts.x_trj_list[k];
+        auto &u_trj = rollouts.u_trj_list[k];
+        x_trj.row(0) = x0_batch.row(k);
+        // Every rollout starts with exact gradients.
+        q_sim->ResetBroyden();
+        for (int t = 0; t < T; t++) {
+          if (has_feedback) {
+            u_trj.row(t) += (K_list[t] * (x_trj.row(t) - x_trj_nominal.row(t))
+                                             .transpose())
+                                .transpose();
+          }
+          try {
+            x_trj.row(t + 1) = QuasistaticSimulator::CalcDynamics(
+                q_sim, x_trj.row(t), u_trj.row(t), sim_params);
+          } catch (std::runtime_error &err) {
+            spdlog::warn(err.what());
+            break;
           }
 
+          if (calc_B) {
+            rollouts.B_trj_list[k][t] = q_sim->get_Dq_nextDqa_cmd();
+          }
           if (calc_A) {
-            A_t[i] = q_sim.get_Dq_nextDq();
+            rollouts.A_trj_list[k][t] = q_sim->get_Dq_nextDq();
           }
-
-          is_valid_t[i] = true;
-        } catch (std::runtime_error &err) {
-          is_valid_t[i] = false;
-          spdlog::warn(err.what());
+          if (is_broyden) {
+            rollouts.gradient_staleness(k, t) = q_sim->get_gradient_staleness();
+          }
+          rollouts.is_valid(k, t) = true;
         }
-      }
-    };
+      });
 
-    operations.emplace_back(
-        std::async(std::launch::async, std::move(calc_dynamics_batch)));
+  return rollouts;
+}
 
-    q_sim_iter++;
-    x_next_iter++;
-    is_valid_iter++;
-    if (calc_A) {
-      A_iter++;
+TrajectoryGradient BatchQuasistaticSimulator::CalcTrajectoryGradient(
+    QuasistaticSimulator *q_sim, const Eigen::Ref<const Eigen::VectorXd> &x0,
+    const Eigen::Ref<const Eigen::MatrixXd> &u_trj,
+    const QuadraticTrajectoryCost &cost, QuasistaticSimParameters sim_params,
+    int checkpoint_interval) {
+  const int T = u_trj.rows();
+  const int n_q = x0.size();
+  const int n_u = u_trj.cols();
+  DRAKE_THROW_UNLESS(checkpoint_interval >= 0);
+  if (checkpoint_interval == 0) {
+    checkpoint_interval = std::max(1, int(std::ceil(std::sqrt(T))));
+  }
+  const int n_segments = (T + checkpoint_interval - 1) / checkpoint_interval;
+  // Objects only sleep under GradientMode::kNone, so the forward pass would
+  // freeze objects which the backward pass simulates.
+  sim_params.sleep_velocity_threshold = 0;
+
+  // Forward pass, which only keeps the first state of every segment.
+  TrajectoryGradient result;
+  result.cost = 0;
+  MatrixXd x_checkpoints(n_segments, n_q);
+  sim_params.gradient_mode = GradientMode::kNone;
+  VectorXd x = x0;
+  for (int t = 0; t < T; t++) {
+    if (t % checkpoint_interval == 0) {
+      x_checkpoints.row(t / checkpoint_interval) = x;
     }
-    if (calc_B) {
-      B_iter++;
+    result.cost +=
+        cost.CalcStateCost(t, x) + cost.CalcInputCost(t, u_trj.row(t));
+    x = QuasistaticSimulator::CalcDynamics(q_sim, x, u_trj.row(t), sim_params);
+  }
+  result.cost += cost.CalcStateCost(T, x);
+
+  // Backward pass, one segment at a time.
+  VectorXd lambda = cost.CalcStateGradient(T, x);
+  result.Dcost_Du_trj.resize(T, n_u);
+  sim_params.gradient_mode = GradientMode::kAB;
+  MatrixXd x_segment(checkpoint_interval, n_q);
+  std::vector<MatrixXd> A_segment(checkpoint_interval);
+  std::vector<MatrixXd> B_segment(checkpoint_interval);
+  for (int i_segment = n_segments - 1; i_segment >= 0; i_segment--) {
+    const int t_start = i_segment * checkpoint_interval;
+    const int n_steps = std::min(checkpoint_interval, T - t_start);
+    x = x_checkpoints.row(i_segment);
+    for (int i = 0; i < n_steps; i++) {
+      x_segment.row(i) = x;
+      x = QuasistaticSimulator::CalcDynamics(q_sim, x, u_trj.row(t_start + i),
+                                             sim_params);
+      A_segment[i] = q_sim->get_Dq_nextDq();
+      B_segment[i] = q_sim->get_Dq_nextDqa_cmd();
+    }
+
+    for (int i = n_steps - 1; i >= 0; i--) {
+      const int t = t_start + i;
+      result.Dcost_Du_trj.row(t) =
+          (cost.CalcInputGradient(t, u_trj.row(t)) +
+           B_segment[i].transpose() * lambda)
+              .transpose();
+      lambda = cost.CalcStateGradient(t, x_segment.row(i)) +
+               A_segment[i].transpose() * lambda;
     }
   }
 
-  // Collect results from threads, and assemble x_next_batch.
-  // x_next;
-  int i_thread = 0;
-  int i_start = 0;
-  MatrixXd x_next_batch(n_tasks, n_q);
-  x_next_iter = x_next_list.begin();
-  for (auto &op : operations) {
-    op.get(); // catch exceptions.
-    auto batch_size = batch_sizes[i_thread];
-    x_next_batch.block(i_start, 0, batch_size, n_q) = *x_next_iter;
+  result.Dcost_Dx0 = std::move(lambda);
+  result.is_valid = true;
+  return result;
+}
 
-    i_start += batch_size;
-    i_thread++;
-    x_next_iter++;
+std::vector<TrajectoryGradient>
+BatchQuasistaticSimulator::CalcTrajectoryGradientParallel(
+    const Eigen::Ref<const Eigen::MatrixXd> &x0_batch,
+    const std::vector<Eigen::MatrixXd> &u_trj_batch,
+    const QuadraticTrajectoryCost &cost,
+    const QuasistaticSimParameters &sim_params,
+    const int checkpoint_interval) const {
+  const size_t K = x0_batch.rows();
+  DRAKE_THROW_UNLESS(u_trj_batch.size() == K);
+  std::vector<TrajectoryGradient> results(K);
+  DispatchTasksParallel(
+      K, [&](QuasistaticSimulator *q_sim, const size_t k) {
+        try {
+          results[k] = CalcTrajectoryGradient(q_sim, x0_batch.row(k),
+                                              u_trj_batch[k], cost, sim_params,
+                                              checkpoint_interval);
+        } catch (std::runtime_error &err) {
+          spdlog::warn(err.what());
+        }
+      });
+  return results;
+}
+
+uint64_t
+BatchQuasistaticSimulator::ResolveSeed(std::optional<int> seed) const {
+  if (seed.has_value()) {
+    return static_cast<uint64_t>(seed.value());
   }
+  // Weyl sequence, so that keys of different calls are far apart.
+  return seed_ + 0x9E3779B97F4A7C15 * (++n_unseeded_calls_);
+}
 
-  auto A_batch = AssembleListsOfVectors(A_list);
-  auto B_batch = AssembleListsOfVectors(B_list);
-  auto is_valid_batch = AssembleListsOfVectors(is_valid_list);
-  return {x_next_batch, A_batch, B_batch, is_valid_batch};
+std::unique_ptr<GaussianSampler>
+BatchQuasistaticSimulator::MakeGaussianSampler(
+    const BundledGradientParameters &bundle_params, const int n_samples,
+    const int dim) const {
+  const auto seed = ResolveSeed(bundle_params.seed);
+  switch (bundle_params.sample_sequence) {
+  case SampleSequence::kPseudoRandom:
+    return std::make_unique<CounterBasedGaussianSampler>(seed);
+  case SampleSequence::kRandomizedLattice:
+    return std::make_unique<RandomizedLatticeGaussianSampler>(n_samples, dim,
+                                                              seed);
+  }
+  throw std::logic_error("Unknown SampleSequence.");
 }
 
 Eigen::MatrixXd BatchQuasistaticSimulator::SampleGaussianMatrix(
     int n_rows, const Eigen::Ref<const Eigen::VectorXd> &mu,
     const Eigen::Ref<const Eigen::VectorXd> &std) const {
   DRAKE_THROW_UNLESS(mu.size() == std.size());
+  const CounterBasedGaussianSampler sampler(ResolveSeed(std::nullopt));
   Eigen::MatrixXd A(n_rows, std.size());
-  for (int i = 0; i < std.size(); i++) {
-    std::normal_distribution<> d{mu[i], std[i]};
-    A.col(i) = MatrixXd::NullaryExpr(n_rows, 1, [&]() { return d(gen_); });
+  VectorXd z(std.size());
+  for (int i = 0; i < n_rows; i++) {
+    sampler.Sample(0, i, &z);
+    A.row(i) = (mu + std.cwiseProduct(z)).transpose();
   }
 
   return A;
@@ -258,37 +514,96 @@ BatchQuasistaticSimulator::CalcBundledABcTrjScalarStd(
 }
 
 /*
- * The input variable "samples" consists of (T * n_samples) samples of type
- *  M, which can be Eigen::MatrixXd or Eigen::VectorXd.
- *
- * Returns a list of length T, where each element is the average of n_samples
- *  elements in the input variable samples.
+ * Running mean and sum of squared deviations from the mean of samples of
+ *  type M, which can be Eigen::MatrixXd or Eigen::VectorXd, using Welford's
+ *  algorithm. If kWithStdError is false, only the mean is tracked.
  */
-template <typename M>
-std::vector<M> CalcBundledFromSamples(const std::vector<M> &samples,
-                                      const std::vector<bool> &is_sample_valid,
-                                      const int T, const int n_samples) {
-  DRAKE_THROW_UNLESS(samples.size() == T * n_samples);
-  std::vector<M> bundled;
-  for (int t = 0; t < T; t++) {
-    int i_start = t * n_samples;
-    int n_valid_samples = 0;
+template <typename M, bool kWithStdError = true> class RunningMoments {
+public:
+  RunningMoments(const int rows, const int cols)
+      : mean_(M::Zero(rows, cols)) {
+    if constexpr (kWithStdError) {
+      m2_ = M::Zero(rows, cols);
+    }
+  }
 
-    bundled.emplace_back(samples[0]);
-    bundled.back().setZero();
+  void Add(const M &x) {
+    n_++;
+    if constexpr (kWithStdError) {
+      const M delta = x - mean_;
+      mean_ += delta / n_;
+      m2_.array() += delta.array() * (x - mean_).array();
+    } else {
+      mean_ += (x - mean_) / n_;
+    }
+  }
 
-    for (int i = 0; i < n_samples; i++) {
-      if (is_sample_valid[i_start + i]) {
-        n_valid_samples++;
-        bundled.back() += samples[i_start + i];
-      }
+  /*
+   * Combines the moments of two sets of samples, as in
+   *  T. F. Chan et al., "Algorithms for computing the sample variance:
+   *  analysis and recommendations", The American Statistician, 1983.
+   */
+  void Merge(const RunningMoments<M, kWithStdError> &other) {
+    if (other.n_ == 0) {
+      return;
+    }
+    const int n = n_ + other.n_;
+    const M delta = other.mean_ - mean_;
+    mean_ += delta * (static_cast<double>(other.n_) / n);
+    if constexpr (kWithStdError) {
+      m2_.array() += other.m2_.array() + delta.array().square() *
+                                             (static_cast<double>(n_) *
+                                              other.n_ / n);
     }
+    n_ = n;
+  }
 
-    bundled.back() /= n_valid_samples;
+  int get_n() const { return n_; }
+
+  /*
+   * nan if there are no samples.
+   */
+  M CalcMean() const {
+    if (n_ == 0) {
+      return M::Constant(mean_.rows(), mean_.cols(),
+                         std::numeric_limits<double>::quiet_NaN());
+    }
+    return mean_;
   }
 
-  return bundled;
-}
+  /*
+   * Entry-wise standard error of the mean, nan if there are fewer than two
+   * samples.
+   */
+  M CalcStdError() const {
+    static_assert(kWithStdError);
+    return (m2_.array() / (n_ * (n_ - 1.))).sqrt();
+  }
+
+private:
+  int n_{0};
+  M mean_;
+  M m2_;
+};
+
+/*
+ * Moments of the samples of c, B and A at a time step.
+ */
+struct BundledMoments {
+  BundledMoments(const int n_x, const int n_u)
+      : c(n_x, 1), B(n_x, n_u), A(n_x, n_x) {}
+
+  void Merge(const BundledMoments &other) {
+    c.Merge(other.c);
+    B.Merge(other.B);
+    A.Merge(other.A);
+  }
+
+  RunningMoments<Eigen::VectorXd> c;
+  RunningMoments<Eigen::MatrixXd> B;
+  // BundledABcTrj has no standard error of A.
+  RunningMoments<Eigen::MatrixXd, false> A;
+};
 
 std::tuple<std::vector<Eigen::MatrixXd>, std::vector<Eigen::MatrixXd>,
            std::vector<Eigen::VectorXd>>
@@ -298,71 +613,209 @@ BatchQuasistaticSimulator::CalcBundledABcTrj(
     const Eigen::Ref<const Eigen::VectorXd> &std_u,
     const QuasistaticSimParameters &sim_params, int n_samples,
     std::optional<int> seed) const {
-  if (seed.has_value()) {
-    gen_.seed(seed.value());
-  }
+  BundledGradientParameters bundle_params;
+  bundle_params.n_samples = n_samples;
+  bundle_params.seed = seed;
+  auto bundled = CalcBundledABcTrj(x_trj, u_trj, std_u, sim_params,
+                                   bundle_params);
+  return {std::move(bundled.A_list), std::move(bundled.B_list),
+          std::move(bundled.c_list)};
+}
 
+BundledABcTrj BatchQuasistaticSimulator::CalcBundledABcTrj(
+    const Eigen::Ref<const Eigen::MatrixXd> &x_trj,
+    const Eigen::Ref<const Eigen::MatrixXd> &u_trj,
+    const Eigen::Ref<const Eigen::VectorXd> &std_u,
+    const QuasistaticSimParameters &sim_params,
+    const BundledGradientParameters &bundle_params) const {
+  const auto [calc_A, calc_B] = IsABNeeded(sim_params.gradient_mode);
   const int T = u_trj.rows();
-  DRAKE_ASSERT(x_trj.rows() == T);
+  DRAKE_THROW_UNLESS(x_trj.rows() == T);
+
+  // A unit is a sample, or an antithetic pair of samples.
+  const int unit_size = bundle_params.use_antithetic_samples ? 2 : 1;
+  DRAKE_THROW_UNLESS(bundle_params.n_samples > 0);
+  DRAKE_THROW_UNLESS(bundle_params.n_samples % unit_size == 0);
+  const int n_units_per_round = bundle_params.n_samples / unit_size;
+  const bool use_cv = bundle_params.use_control_variate;
+  const bool is_adaptive = bundle_params.use_adaptive_sampling;
+  if (is_adaptive) {
+    if (bundle_params.sample_sequence != SampleSequence::kPseudoRandom) {
+      throw std::logic_error(
+          "Adaptive sampling needs i.i.d. samples from kPseudoRandom.");
+    }
+    DRAKE_THROW_UNLESS(bundle_params.n_samples_budget >=
+                       T * bundle_params.n_samples);
+  }
 
   const int n_x = x_trj.cols();
   const int n_u = u_trj.cols();
+  const auto sampler = MakeGaussianSampler(bundle_params, n_units_per_round,
+                                           n_u);
+  const auto sim_params_sample = WithoutBroyden(sim_params);
+
+  // B at the nominal inputs, used by the control variate.
+  std::vector<MatrixXd> B_nominal(use_cv ? T : 0);
+  VectorXb is_nominal_valid = VectorXb::Zero(use_cv ? T : 0);
+  if (use_cv) {
+    auto sim_params_nominal = sim_params;
+    sim_params_nominal.gradient_mode = GradientMode::kBOnly;
+    DispatchTasksParallel(
+        T, [&](QuasistaticSimulator *q_sim, const size_t t) {
+          try {
+            QuasistaticSimulator::CalcDynamics(q_sim, x_trj.row(t),
+                                               u_trj.row(t),
+                                               sim_params_nominal);
+            B_nominal[t] = q_sim->get_Dq_nextDqa_cmd();
+            is_nominal_valid[t] = true;
+          } catch (std::runtime_error &err) {
+            spdlog::warn(err.what());
+          }
+        });
+  }
 
-  MatrixXd x_batch(T * n_samples, n_x);
-  MatrixXd u_batch(T * n_samples, n_u);
+  std::vector<BundledMoments> step_moments(T, {n_x, n_u});
+
+  // The samples are drawn in rounds. In a round, time step t evaluates units
+  // [n_units_drawn[t], n_units_drawn[t] + n_units_round[t]).
+  std::vector<int> n_units_drawn(T, 0);
+  std::vector<int> n_units_round(T, n_units_per_round);
+  int n_units_budget_left = bundle_params.n_samples_budget / unit_size;
+  while (true) {
+    // A block accumulates the moments of its units, instead of storing every
+    // sample, and the blocks are merged in a fixed order. As the blocks do
+    // not depend on the number of threads, neither do the results. The
+    // memory does not grow with n_samples.
+    const auto blocks = SplitIntoBlocks(n_units_drawn, n_units_round);
+    std::vector<BundledMoments> block_moments(blocks.size(), {n_x, n_u});
+    DispatchTasksParallel(
+        blocks.size(), [&, calc_A = calc_A, calc_B = calc_B](
+                           QuasistaticSimulator *q_sim, const size_t i) {
+          const auto &block = blocks[i];
+          const int t = block.t;
+          const bool use_cv_t = use_cv and is_nominal_valid[t];
+          auto &moments = block_moments[i];
+          VectorXd du(n_u);
+          VectorXd c_unit(n_x);
+          MatrixXd B_unit(n_x, n_u);
+          MatrixXd A_unit(n_x, n_x);
+          for (int j = block.j_start; j < block.j_start + block.n_units; j++) {
+            sampler->Sample(t + bundle_params.time_step_offset, j, &du);
+            du = std_u.cwiseProduct(du);
+            c_unit.setZero();
+            B_unit.setZero();
+            A_unit.setZero();
+            bool is_unit_valid = true;
+            // The samples of an antithetic pair are u + du and u - du.
+            for (int k = 0; k < unit_size and is_unit_valid; k++) {
+              if (k == 1) {
+                du *= -1;
+              }
+              const VectorXd u = u_trj.row(t).transpose() + du;
+              try {
+                c_unit += QuasistaticSimulator::CalcDynamics(
+                    q_sim, x_trj.row(t), u, sim_params_sample);
+                if (use_cv_t) {
+                  c_unit -= B_nominal[t] * du;
+                }
+                if (calc_B) {
+                  B_unit += q_sim->get_Dq_nextDqa_cmd();
+                }
+                if (calc_A) {
+                  A_unit += q_sim->get_Dq_nextDq();
+                }
+              } catch (std::runtime_error &err) {
+                is_unit_valid = false;
+                spdlog::warn(err.what());
+              }
+            }
+
+            if (not is_unit_valid) {
+              continue;
+            }
+            moments.c.Add(c_unit / unit_size);
+            if (calc_B) {
+              moments.B.Add(B_unit / unit_size);
+            }
+            if (calc_A) {
+              moments.A.Add(A_unit / unit_size);
+            }
+          }
+        });
 
-  for (int t = 0; t < T; t++) {
-    int i_start = t * n_samples;
-    auto u_batch_t = SampleGaussianMatrix(n_samples, u_trj.row(t), std_u);
-    x_batch(Eigen::seqN(i_start, n_samples), Eigen::all).rowwise() = x_trj.row(t);
-    u_batch(Eigen::seqN(i_start, n_samples), Eigen::all) = u_batch_t;
-  }
+    for (size_t i = 0; i < blocks.size(); i++) {
+      step_moments[blocks[i].t].Merge(block_moments[i]);
+    }
+    for (int t = 0; t < T; t++) {
+      n_units_drawn[t] += n_units_round[t];
+      n_units_budget_left -= n_units_round[t];
+    }
 
-  auto [x_next_batch, A_batch, B_batch, is_valid_batch] =
-      CalcDynamicsParallel(x_batch, u_batch, sim_params);
+    if (not is_adaptive) {
+      break;
+    }
 
-  std::vector<VectorXd> c_bundled;
-  for (int t = 0; t < T; t++) {
-    int i_start = t * n_samples;
-    int n_valid_samples = 0;
-    c_bundled.emplace_back(n_x);
-    c_bundled.back().setZero();
-
-    for (int i = 0; i < n_samples; i++) {
-      if (is_valid_batch[i_start + i]) {
-        n_valid_samples++;
-        c_bundled.back() += x_next_batch.row(i_start + i);
+    // Time steps whose standard error exceeds the tolerance, noisiest first.
+    // The standard error of time steps with fewer than two valid units is
+    // unknown, and treated as infinite.
+    std::vector<std::pair<double, int>> noisy_steps;
+    for (int t = 0; t < T; t++) {
+      double std_error = std::numeric_limits<double>::infinity();
+      const auto &moments = step_moments[t];
+      if (moments.c.get_n() >= 2) {
+        std_error = moments.c.CalcStdError().maxCoeff();
+        if (calc_B) {
+          std_error = std::max(std_error, moments.B.CalcStdError().maxCoeff());
+        }
+      }
+      if (std_error > bundle_params.std_error_tolerance) {
+        noisy_steps.emplace_back(std_error, t);
       }
     }
-
-    c_bundled.back() /= n_valid_samples;
+    std::stable_sort(
+        noisy_steps.begin(), noisy_steps.end(),
+        [](const auto &a, const auto &b) { return a.first > b.first; });
+
+    // The standard error decreases as 1 / sqrt(n), which gives an estimate of
+    // the number of units still needed by a time step. A time step gets at
+    // most n_units_per_round more units per round.
+    std::fill(n_units_round.begin(), n_units_round.end(), 0);
+    int n_units_next_round = 0;
+    for (const auto &[std_error, t] : noisy_steps) {
+      const int n = step_moments[t].c.get_n();
+      const double ratio = std_error / bundle_params.std_error_tolerance;
+      int n_needed = n_units_per_round;
+      if (std::isfinite(ratio)) {
+        n_needed = std::clamp(
+            static_cast<int>(std::ceil(n * (ratio * ratio - 1))), 1,
+            n_units_per_round);
+      }
+      n_units_round[t] =
+          std::min(n_needed, n_units_budget_left - n_units_next_round);
+      n_units_next_round += n_units_round[t];
+    }
+    if (n_units_next_round == 0) {
+      break;
+    }
   }
 
-  std::vector<MatrixXd> A_bundled, B_bundled;
-  if (not A_batch.empty()) {
-    A_bundled = CalcBundledFromSamples(A_batch, is_valid_batch, T, n_samples);
-  }
-  if (not B_batch.empty()) {
-    B_bundled = CalcBundledFromSamples(B_batch, is_valid_batch, T, n_samples);
+  BundledABcTrj bundled;
+  for (int t = 0; t < T; t++) {
+    const auto &moments = step_moments[t];
+    bundled.c_list.emplace_back(moments.c.CalcMean());
+    bundled.c_std_error_list.emplace_back(moments.c.CalcStdError());
+    if (calc_B) {
+      bundled.B_list.emplace_back(moments.B.CalcMean());
+      bundled.B_std_error_list.emplace_back(moments.B.CalcStdError());
+    }
+    if (calc_A) {
+      bundled.A_list.emplace_back(moments.A.CalcMean());
+    }
+    bundled.n_valid_samples.push_back(moments.c.get_n() * unit_size);
+    bundled.n_samples_drawn.push_back(n_units_drawn[t] * unit_size);
   }
 
-  return {A_bundled, B_bundled, c_bundled};
-}
-
-template <typename T> bool IsFutureReady(const std::future<T> &future) {
-  // future.wait_for() is the only method to check the status of a future
-  // without waiting for it to complete.
-  const std::future_status status =
-      future.wait_for(std::chrono::milliseconds(1));
-  return (status == std::future_status::ready);
-}
-
-std::stack<int> BatchQuasistaticSimulator::InitializeSimulatorStack() const {
-  std::stack<int> sims;
-  for (int i = 0; i < num_max_parallel_executions; i++) {
-    sims.push(i);
-  }
-  return sims;
+  return bundled;
 }
 
 std::vector<Eigen::MatrixXd> BatchQuasistaticSimulator::CalcBundledBTrjDirect(
@@ -370,75 +823,93 @@ std::vector<Eigen::MatrixXd> BatchQuasistaticSimulator::CalcBundledBTrjDirect(
     const Eigen::Ref<const Eigen::MatrixXd> &u_trj, double std_u,
     QuasistaticSimParameters sim_params, int n_samples,
     std::optional<int> seed) const {
-  sim_params.gradient_mode = GradientMode::kBOnly;
-  if (seed.has_value()) {
-    gen_.seed(seed.value());
+  BundledGradientParameters bundle_params;
+  bundle_params.n_samples = n_samples;
+  bundle_params.seed = seed;
+  return CalcBundledBTrjDirect(x_trj, u_trj,
+                               VectorXd::Constant(u_trj.cols(), std_u),
+                               sim_params, bundle_params);
+}
+
+std::vector<Eigen::MatrixXd> BatchQuasistaticSimulator::CalcBundledBTrjDirect(
+    const Eigen::Ref<const Eigen::MatrixXd> &x_trj,
+    const Eigen::Ref<const Eigen::MatrixXd> &u_trj,
+    const Eigen::Ref<const Eigen::VectorXd> &std_u,
+    QuasistaticSimParameters sim_params,
+    const BundledGradientParameters &bundle_params) const {
+  if (bundle_params.use_control_variate or
+      bundle_params.use_adaptive_sampling) {
+    throw std::logic_error("CalcBundledBTrjDirect does not support control "
+                           "variates or adaptive sampling.");
   }
+  sim_params.gradient_mode = GradientMode::kBOnly;
 
-  // Determine the number of threads.
   const size_t T = u_trj.rows();
   DRAKE_THROW_UNLESS(x_trj.rows() == T);
-  const auto n_threads = std::min(num_max_parallel_executions, T);
-
-  // Allocate storage for results.
-  const auto n_q = x_trj.cols();
   const auto n_u = u_trj.cols();
-  std::vector<MatrixXd> B_batch(T, MatrixXd::Zero(n_q, n_u));
-
-  // Generate samples.
-  std::vector<MatrixXd> du_trj(T);
-  std::normal_distribution<> d{0, std_u};
-  for (int t = 0; t < T; t++) {
-    du_trj[t] =
-        MatrixXd::NullaryExpr(n_samples, n_u, [&]() { return d(gen_); });
-  }
-
-  // Storage for active parallel simulation operations.
-  std::list<std::future<int>> active_operations;
-  int n_bundled_B_dispatched = 0;
-  auto available_sims = InitializeSimulatorStack();
-
-  while (!active_operations.empty() || n_bundled_B_dispatched < T) {
-    // Check for completed operations.
-    for (auto op = active_operations.begin(); op != active_operations.end();) {
-      if (IsFutureReady(*op)) {
-        auto sim_idx = op->get();
-        op = active_operations.erase(op);
-        available_sims.push(sim_idx);
-      } else {
-        ++op;
+  DRAKE_THROW_UNLESS(std_u.size() == n_u);
+  const int unit_size = bundle_params.use_antithetic_samples ? 2 : 1;
+  DRAKE_THROW_UNLESS(bundle_params.n_samples > 0);
+  DRAKE_THROW_UNLESS(bundle_params.n_samples % unit_size == 0);
+  const int n_units = bundle_params.n_samples / unit_size;
+  std::vector<MatrixXd> B_batch(T);
+
+  // Samples are generated by the workers, using the same random numbers as
+  // CalcBundledABcTrj.
+  const auto sampler = MakeGaussianSampler(bundle_params, n_units, n_u);
+  DispatchTasksParallel(T, [&](QuasistaticSimulator *q_sim, const size_t t) {
+    MatrixXd du(bundle_params.n_samples, n_u);
+    VectorXd z(n_u);
+    for (int j = 0; j < n_units; j++) {
+      sampler->Sample(t + bundle_params.time_step_offset, j, &z);
+      z = std_u.cwiseProduct(z);
+      du.row(j * unit_size) = z.transpose();
+      if (unit_size == 2) {
+        du.row(j * unit_size + 1) = -z.transpose();
       }
     }
+    B_batch[t] =
+        CalcBundledB(q_sim, x_trj.row(t), u_trj.row(t), du, sim_params);
+  });
 
-    // Dispatch new operations.
-    while (static_cast<int>(active_operations.size()) < n_threads &&
-           n_bundled_B_dispatched < T) {
-      DRAKE_THROW_UNLESS(!available_sims.empty());
-      auto idx_sim = available_sims.top();
-      available_sims.pop();
-
-      auto calc_B_bundled =
-          [&q_sim = q_sims_[idx_sim], &x_trj = std::as_const(x_trj),
-           &u_trj = std::as_const(u_trj), &du_trj = std::as_const(du_trj),
-           &B_batch, t = n_bundled_B_dispatched, sim_params, idx_sim] {
-            B_batch[t] = CalcBundledB(&q_sim, x_trj.row(t), u_trj.row(t),
-                                      du_trj[t], sim_params);
-            return idx_sim;
-          };
-
-      active_operations.emplace_back(
-          std::async(std::launch::async, std::move(calc_B_bundled)));
-      ++n_bundled_B_dispatched;
-    }
+  return B_batch;
+}
+
+/*
+ * Sums over the samples (x_next, du) of a time step, from which the least
+ * squares fit of x_next - mean(x_next) = B * (du - mean(du)) has a
+ * closed-form solution.
+ * y = x_next - x is accumulated instead of x_next, which reduces
+ * cancellation when x_next is centered, and does not change B.
+ */
+struct LstsqSums {
+  LstsqSums(const int n_x, const int n_u)
+      : y_sum(VectorXd::Zero(n_x)), du_sum(VectorXd::Zero(n_u)),
+        du_du(MatrixXd::Zero(n_u, n_u)), y_du(MatrixXd::Zero(n_x, n_u)) {}
+
+  void Add(const VectorXd &y, const VectorXd &du) {
+    n++;
+    y_sum += y;
+    du_sum += du;
+    du_du.selfadjointView<Eigen::Lower>().rankUpdate(du);
+    y_du.noalias() += y * du.transpose();
+  }
 
-    // Wait a bit before checking for completion.
-    // For the planar hand and ball system, computing forward dynamics and
-    // its gradient takes a bit more than 1ms on average.
-    std::this_thread::sleep_for(std::chrono::milliseconds(n_samples));
+  void Merge(const LstsqSums &other) {
+    n += other.n;
+    y_sum += other.y_sum;
+    du_sum += other.du_sum;
+    du_du += other.du_du;
+    y_du += other.y_du;
   }
 
-  return B_batch;
-}
+  int n{0};
+  VectorXd y_sum;
+  VectorXd du_sum;
+  // Only the lower triangular part is used.
+  MatrixXd du_du;
+  MatrixXd y_du;
+};
 
 std::tuple<Eigen::MatrixXd, Eigen::VectorXd>
 BatchQuasistaticSimulator::CalcBcLstsq(
@@ -446,53 +917,97 @@ BatchQuasistaticSimulator::CalcBcLstsq(
     const Eigen::Ref<const Eigen::VectorXd> &u_nominal,
     QuasistaticSimParameters sim_params,
     const Eigen::Ref<const Eigen::VectorXd> &u_std, int n_samples) const {
-  const auto n_x = x_nominal.size();
-  const auto n_u = u_nominal.size();
-  MatrixXd x_batch(n_samples, n_x);
-  x_batch.rowwise() = x_nominal.transpose();
-  const auto u_batch = SampleGaussianMatrix(n_samples, u_nominal, u_std);
-  sim_params.gradient_mode = GradientMode::kNone;
-  auto [x_next_batch, A_Batch, B_batch, is_valid_batch] =
-      CalcDynamicsParallel(x_batch, u_batch, sim_params);
-
-  // Extract valid samples.
-  const auto n_valid =
-      std::accumulate(is_valid_batch.begin(), is_valid_batch.end(), 0);
-  if (n_valid == 0) {
-    throw std::runtime_error("No valid dynamics samples.");
-  }
+  BundledGradientParameters bundle_params;
+  bundle_params.n_samples = n_samples;
+  auto [B_list, c_list] =
+      CalcBcLstsqTrj(x_nominal.transpose(), u_nominal.transpose(), u_std,
+                     sim_params, bundle_params, 0);
+  return {std::move(B_list[0]), std::move(c_list[0])};
+}
 
-  VectorXd x_next_mean(n_x);
-  x_next_mean.setZero();
-  std::vector<int> idx_valid;
-  for (int i = 0; i < n_samples; i++) {
-    if (not is_valid_batch[i]) {
-      continue;
-    }
-    x_next_mean += x_next_batch.row(i) / n_valid;
-    idx_valid.push_back(i);
+std::tuple<std::vector<Eigen::MatrixXd>, std::vector<Eigen::VectorXd>>
+BatchQuasistaticSimulator::CalcBcLstsqTrj(
+    const Eigen::Ref<const Eigen::MatrixXd> &x_trj,
+    const Eigen::Ref<const Eigen::MatrixXd> &u_trj,
+    const Eigen::Ref<const Eigen::VectorXd> &std_u,
+    QuasistaticSimParameters sim_params,
+    const BundledGradientParameters &bundle_params, const double ridge) const {
+  if (bundle_params.use_control_variate or
+      bundle_params.use_adaptive_sampling) {
+    throw std::logic_error("CalcBcLstsqTrj does not support control variates "
+                           "or adaptive sampling.");
   }
+  const int T = u_trj.rows();
+  DRAKE_THROW_UNLESS(x_trj.rows() == T);
+  DRAKE_THROW_UNLESS(ridge >= 0);
+  const int unit_size = bundle_params.use_antithetic_samples ? 2 : 1;
+  DRAKE_THROW_UNLESS(bundle_params.n_samples > 0);
+  DRAKE_THROW_UNLESS(bundle_params.n_samples % unit_size == 0);
+  const int n_units = bundle_params.n_samples / unit_size;
 
-  // Data centering.
-  MatrixXd dx = x_next_batch(idx_valid, Eigen::all).rowwise() - x_next_mean
-      .transpose();
-  MatrixXd du = u_batch(idx_valid, Eigen::all).rowwise() - u_nominal
-      .transpose();
-
-  auto prog = drake::solvers::MathematicalProgram();
-  auto B = prog.NewContinuousVariables(n_x, n_u, "B");
+  const int n_x = x_trj.cols();
+  const int n_u = u_trj.cols();
+  sim_params.gradient_mode = GradientMode::kNone;
+  const auto sampler = MakeGaussianSampler(bundle_params, n_units, n_u);
+
+  const auto blocks = SplitIntoBlocks(std::vector<int>(T, 0),
+                                      std::vector<int>(T, n_units));
+  std::vector<LstsqSums> block_sums(blocks.size(), {n_x, n_u});
+  DispatchTasksParallel(
+      blocks.size(), [&](QuasistaticSimulator *q_sim, const size_t i) {
+        const auto &block = blocks[i];
+        const int t = block.t;
+        auto &sums = block_sums[i];
+        VectorXd du(n_u);
+        for (int j = block.j_start; j < block.j_start + block.n_units; j++) {
+          sampler->Sample(t + bundle_params.time_step_offset, j, &du);
+          du = std_u.cwiseProduct(du);
+          // The samples of an antithetic pair are u + du and u - du.
+          for (int k = 0; k < unit_size; k++) {
+            if (k == 1) {
+              du *= -1;
+            }
+            const VectorXd u = u_trj.row(t).transpose() + du;
+            try {
+              const VectorXd x_next = QuasistaticSimulator::CalcDynamics(
+                  q_sim, x_trj.row(t), u, sim_params);
+              sums.Add(x_next - x_trj.row(t).transpose(), du);
+            } catch (std::runtime_error &err) {
+              spdlog::warn(err.what());
+            }
+          }
+        }
+      });
 
-  // Column-wise costs.
-  for (int j = 0; j < n_u; j++) {
-    prog.Add2NormSquaredCost(du, dx.col(j), B.transpose().col(j));
+  std::vector<LstsqSums> step_sums(T, {n_x, n_u});
+  for (size_t i = 0; i < blocks.size(); i++) {
+    step_sums[blocks[i].t].Merge(block_sums[i]);
   }
 
-  auto result = drake::solvers::MathematicalProgramResult();
-  solver_->Solve(prog, {}, {}, &result);
+  std::vector<MatrixXd> B_list;
+  std::vector<VectorXd> c_list;
+  for (int t = 0; t < T; t++) {
+    const auto &sums = step_sums[t];
+    if (sums.n == 0) {
+      throw std::runtime_error("No valid dynamics samples.");
+    }
 
-  if (not result.is_success()) {
-    throw std::runtime_error("Failed to solve for B using Least squares.");
+    // Normal equations of the centered problem:
+    //  B * (du_c^T du_c + ridge * I) = y_c^T du_c,
+    // where du_c = du - mean(du) and y_c = y - mean(y).
+    const VectorXd y_mean = sums.y_sum / sums.n;
+    const VectorXd du_mean = sums.du_sum / sums.n;
+    MatrixXd G = sums.du_du;
+    G.selfadjointView<Eigen::Lower>().rankUpdate(du_mean, -sums.n);
+    G.diagonal().array() += ridge;
+    const MatrixXd R = sums.y_du - sums.n * y_mean * du_mean.transpose();
+    const Eigen::LLT<MatrixXd, Eigen::Lower> llt(G);
+    if (llt.info() != Eigen::Success) {
+      throw std::runtime_error("Failed to solve for B using least squares.");
+    }
+    B_list.emplace_back(llt.solve(R.transpose()).transpose());
+    c_list.emplace_back(x_trj.row(t).transpose() + y_mean);
   }
 
-  return {result.GetSolution(B), x_next_mean};
-}
\ No newline at end of file
+  return {B_list, c_list};
+}
@@ -1,7 +1,118 @@
+#pragma once
+#include "counter_based_random.h"
+#include "dynamics_cache.h"
 #include "quasistatic_simulator.h"
-#include <list>
+#include "randomized_lattice_rule.h"
+#include "trajectory_cost.h"
+#include <atomic>
+#include <functional>
 #include <tuple>
 
+using VectorXb = Eigen::Matrix<bool, Eigen::Dynamic, 1>;
+using MatrixXb = Eigen::Matrix<bool, Eigen::Dynamic, Eigen::Dynamic>;
+
+enum class SampleSequence {
+  // I.i.d. Gaussian samples from CounterBasedGaussianSampler.
+  kPseudoRandom,
+  // Randomized quasi-Monte Carlo samples from
+  // RandomizedLatticeGaussianSampler, with an independent random shift for
+  // every time step.
+  kRandomizedLattice,
+};
+
+struct BundledGradientParameters {
+  // Number of dynamics evaluations per time step, excluding the evaluation
+  // at the nominal input required by use_control_variate.
+  int n_samples{100};
+  std::optional<int> seed;
+  // If true, samples come in pairs u + du and u - du, and n_samples must be
+  // even. This cancels the odd-order terms of the Taylor expansion of the
+  // dynamics around u.
+  bool use_antithetic_samples{false};
+  // If true, c is estimated from the samples of f(x, u + du) - B0 * du,
+  // where B0 is the exact B at the nominal (x, u). As E[B0 * du] = 0, the
+  // estimate is unbiased, but most of the variance due to the linear part of
+  // the dynamics is removed. A and B do not have a control variate.
+  bool use_control_variate{false};
+  // With kRandomizedLattice, the samples of a time step are not independent,
+  // and the reported standard errors, which are computed as if they were,
+  // typically overestimate the actual errors.
+  SampleSequence sample_sequence{SampleSequence::kPseudoRandom};
+
+  // If true, every time step first gets n_samples samples. Then, in rounds,
+  // time steps whose standard error (the largest entry over B and c) exceeds
+  // std_error_tolerance get up to n_samples more samples each, noisiest
+  // first, until all time steps are within the tolerance or
+  // n_samples_budget samples have been drawn over all time steps.
+  // n_samples_budget needs to be at least T * n_samples, and
+  // sample_sequence needs to be kPseudoRandom.
+  bool use_adaptive_sampling{false};
+  double std_error_tolerance{1e-3};
+  int n_samples_budget{0};
+
+  // Time step t draws the samples of time step t + time_step_offset. A
+  // sub-trajectory starting at time step t0 of a longer trajectory, with
+  // time_step_offset = t0, gets the same samples as the longer trajectory,
+  // and hence the same results unless use_adaptive_sampling is true.
+  int time_step_offset{0};
+};
+
+/*
+ * Bundled dynamics along a trajectory of length T.
+ * A_list and B_list can be empty, depending on the gradient_mode.
+ * B_std_error_list[t] and c_std_error_list[t] are the standard errors of
+ *  B_list[t] and c_list[t], estimated entry-wise from the i.i.d. samples
+ *  (pairs of samples if antithetic) at time step t. They are nan if there
+ *  are fewer than two valid samples (pairs).
+ * n_valid_samples[t] is the number of samples used at time step t, and
+ *  n_samples_drawn[t] also includes the samples whose dynamics failed to
+ *  solve. They differ between time steps with adaptive sampling.
+ */
+struct BundledABcTrj {
+  std::vector<Eigen::MatrixXd> A_list;
+  std::vector<Eigen::MatrixXd> B_list;
+  std::vector<Eigen::VectorXd> c_list;
+  std::vector<Eigen::MatrixXd> B_std_error_list;
+  std::vector<Eigen::VectorXd> c_std_error_list;
+  std::vector<int> n_valid_samples;
+  std::vector<int> n_samples_drawn;
+};
+
+/*
+ * K rollouts of length T.
+ * x_trj_list[k] is a (T + 1, n_q) matrix, whose first row is the initial
+ *  state of rollout k.
+ * A_trj_list[k][t] and B_trj_list[k][t] are the A and B of step t of rollout
+ *  k. A_trj_list and B_trj_list are empty unless required by gradient_mode.
+ * u_trj_list[k] is a (T, n_u) matrix of the inputs applied in rollout k,
+ *  which differ from the given inputs if there is feedback.
+ * is_valid(k, t) is false if step t of rollout k, or any step before it,
+ *  fails. The states after a failed step are nan.
+ * gradient_staleness(k, t) is QuasistaticSimulator::get_gradient_staleness
+ *  after step t of rollout k under GradientMode::kABBroyden, and empty
+ *  under other gradient modes.
+ */
+struct BatchRollouts {
+  std::vector<Eigen::MatrixXd> x_trj_list;
+  std::vector<Eigen::MatrixXd> u_trj_list;
+  std::vector<std::vector<Eigen::MatrixXd>> A_trj_list;
+  std::vector<std::vector<Eigen::MatrixXd>> B_trj_list;
+  MatrixXb is_valid;
+  Eigen::MatrixXi gradient_staleness;
+};
+
+/*
+ * Cost of a rollout and its gradients with respect to the (T, n_u) inputs
+ * u_trj and the initial state x0. is_valid is false if a time step of the
+ * rollout fails, in which case the other fields are not set.
+ */
+struct TrajectoryGradient {
+  double cost{NAN};
+  Eigen::MatrixXd Dcost_Du_trj;
+  Eigen::VectorXd Dcost_Dx0;
+  bool is_valid{false};
+};
+
 class BatchQuasistaticSimulator {
 public:
   BatchQuasistaticSimulator(
@@ -9,7 +120,8 @@ public:
       const std::unordered_map<std::string, Eigen::VectorXd>
           &robot_stiffness_str,
       const std::unordered_map<std::string, std::string> &object_sdf_paths,
-      const QuasistaticSimParameters &sim_params);
+      const QuasistaticSimParameters &sim_params,
+      const CollisionFilterParameters &collision_filter = {});
 
   /*
    * Each row in x_batch and u_batch represent a pair of current states and
@@ -28,6 +140,8 @@ public:
    *    kAB: A_batch[i] is a (n_q, n_q) matrix,
    *         B_batch[i] is a (n_q, n_a) matrix.
    *    kBOnly: A_Batch has 0 length, B_batch[i] is a (n_q, n_a) matrix.
+   *    kABBroyden: same as kAB, as the tasks are not consecutive steps of a
+   *      trajectory.
    */
   std::tuple<Eigen::MatrixXd, std::vector<Eigen::MatrixXd>,
              std::vector<Eigen::MatrixXd>, std::vector<bool>>
@@ -35,6 +149,56 @@ public:
                        const Eigen::Ref<const Eigen::MatrixXd> &u_batch,
                        const QuasistaticSimParameters &sim_params) const;
 
+  /*
+   * Same as the CalcDynamicsParallel above, but the results are written into
+   * caller-owned storage, so that repeated calls (e.g. from an iterative
+   * optimizer) do not allocate any storage for the results. With
+   * n_tasks := x_batch.rows(),
+   *  - x_next_batch has shape (n_tasks, n_q).
+   *  - A_batch has shape (n_q, n_tasks * n_q), and
+   *    A_batch.middleCols(i * n_q, n_q) is the A of the i-th task. A_batch is
+   *    not touched (and can have 0 columns) unless gradient_mode is kAB or
+   *    kABBroyden, which is the same as kAB.
+   *  - B_batch has shape (n_q, n_tasks * n_u), and
+   *    B_batch.middleCols(i * n_u, n_u) is the B of the i-th task. B_batch is
+   *    not touched (and can have 0 columns) if gradient_mode is kNone.
+   *  - is_valid_batch has length n_tasks.
+   * Every task writes into its own disjoint slice of the buffers.
+   */
+  void CalcDynamicsParallel(const Eigen::Ref<const Eigen::MatrixXd> &x_batch,
+                            const Eigen::Ref<const Eigen::MatrixXd> &u_batch,
+                            const QuasistaticSimParameters &sim_params,
+                            Eigen::Ref<Eigen::MatrixXd> x_next_batch,
+                            Eigen::Ref<Eigen::MatrixXd> A_batch,
+                            Eigen::Ref<Eigen::MatrixXd> B_batch,
+                            Eigen::Ref<VectorXb> is_valid_batch) const;
+
+  /*
+   * Simulates K trajectories, where x0_batch.row(k) is the initial state and
+   * u_trj_batch[k], a (T, n_u) matrix, the inputs of rollout k. A rollout is
+   * a task of DispatchTasksParallel, so all its steps run on the same
+   * thread, without going back to the caller in between.
+   */
+  BatchRollouts
+  RolloutParallel(const Eigen::Ref<const Eigen::MatrixXd> &x0_batch,
+                  const std::vector<Eigen::MatrixXd> &u_trj_batch,
+                  const QuasistaticSimParameters &sim_params) const;
+
+  /*
+   * Same as the RolloutParallel above, but with the time-varying linear
+   * feedback policy
+   *  u_t = u_trj_batch[k].row(t) + K_list[t] * (x_t - x_trj_nominal.row(t)),
+   * where K_list[t] is a (n_u, n_q) matrix and x_trj_nominal has at least T
+   * rows. This is the forward pass of iLQR, where the rollouts of different
+   * line search step sizes are evaluated in parallel.
+   */
+  BatchRollouts
+  RolloutParallel(const Eigen::Ref<const Eigen::MatrixXd> &x0_batch,
+                  const std::vector<Eigen::MatrixXd> &u_trj_batch,
+                  const std::vector<Eigen::MatrixXd> &K_list,
+                  const Eigen::Ref<const Eigen::MatrixXd> &x_trj_nominal,
+                  const QuasistaticSimParameters &sim_params) const;
+
   std::tuple<Eigen::MatrixXd, std::vector<Eigen::MatrixXd>,
              std::vector<Eigen::MatrixXd>, std::vector<bool>>
   CalcDynamicsSerial(const Eigen::Ref<const Eigen::MatrixXd> &x_batch,
@@ -43,7 +207,9 @@ public:
 
   /*
    * Minimizes the least square error of
-   * x_next_batch - x_next_batch_mean = (u_batch - u_nominal) * B.transpose().
+   *  x_next_batch - x_next_batch_mean
+   *    = (u_batch - u_batch_mean) * B.transpose().
+   * Returns (B, x_next_batch_mean).
    */
   std::tuple<Eigen::MatrixXd, Eigen::VectorXd>
   CalcBcLstsq(
@@ -53,10 +219,40 @@ public:
       const Eigen::Ref<const Eigen::VectorXd> &u_std,
       int n_samples) const;
 
+  /*
+   * CalcBcLstsq at every time step of a trajectory, where
+   *  x_trj: (T, dim_x)
+   *  u_trj: (T, dim_u).
+   * At time step t, B_list[t] minimizes
+   *  sum_i |x_next_i - c_list[t] - B * (du_i - du_mean)|^2 + ridge * |B|_F^2,
+   * where du_i is the i-th perturbation of u_trj.row(t), x_next_i the
+   * corresponding next state, and c_list[t] and du_mean the means of x_next_i
+   * and du_i.
+   *
+   * The samples are reduced into sums of du du^T and x_next du^T inside
+   * the workers, and B is computed from the normal equations with a
+   * Cholesky factorization of a (dim_u, dim_u) matrix.
+   *
+   * bundle_params.use_control_variate and use_adaptive_sampling are not
+   * supported.
+   */
+  std::tuple<std::vector<Eigen::MatrixXd>, std::vector<Eigen::VectorXd>>
+  CalcBcLstsqTrj(const Eigen::Ref<const Eigen::MatrixXd> &x_trj,
+                 const Eigen::Ref<const Eigen::MatrixXd> &u_trj,
+                 const Eigen::Ref<const Eigen::VectorXd> &std_u,
+                 QuasistaticSimParameters sim_params,
+                 const BundledGradientParameters &bundle_params,
+                 double ridge) const;
+
   /*
    * x_trj: (T, dim_x)
    * u_trj: (T, dim_u)
    *
+   * The i-th sample of u at time step t is drawn by the worker that
+   * evaluates it, from a counter-based random number generator keyed by
+   * (seed, t, i). Given a seed, the results do not depend on the number of
+   * threads, and concurrent calls on the same object are safe.
+   *
    * In the tuple: (A_list of length T or 0,
    *                B_list of length T or 0,
    *                c_list of length T)
@@ -70,6 +266,17 @@ public:
                     const QuasistaticSimParameters &sim_params, int n_samples,
                     std::optional<int> seed) const;
 
+  /*
+   * Same as the CalcBundledABcTrj above, with optional variance reduction
+   * and standard errors of the estimates.
+   */
+  BundledABcTrj
+  CalcBundledABcTrj(const Eigen::Ref<const Eigen::MatrixXd> &x_trj,
+                    const Eigen::Ref<const Eigen::MatrixXd> &u_trj,
+                    const Eigen::Ref<const Eigen::VectorXd> &std_u,
+                    const QuasistaticSimParameters &sim_params,
+                    const BundledGradientParameters &bundle_params) const;
+
   std::tuple<std::vector<Eigen::MatrixXd>, std::vector<Eigen::MatrixXd>,
              std::vector<Eigen::VectorXd>>
   CalcBundledABcTrjScalarStd(const Eigen::Ref<const Eigen::MatrixXd> &x_trj,
@@ -79,16 +286,16 @@ public:
                              int n_samples, std::optional<int> seed) const;
 
   /*
-   * Implements multi-threaded computation of bundled gradient based on drake's
-   * Monte-Carlo simulation:
-   * https://github.com/RobotLocomotion/drake/blob/5316536420413b51871ceb4b9c1f77aedd559f71/systems/analysis/monte_carlo.cc#L42
-   * But this implementation does not seem to be faster than
-   * CalcBundledBTrjScalarStd, which is again  slower than the original
-   * ZMQ-based PUSH-PULL scheme.
+   * Bundled B along a trajectory, where every time step is a task of
+   * DispatchTasksParallel, and its n_samples samples are evaluated by one
+   * thread. The samples are the same as those of CalcBundledABcTrj with the
+   * same seed, or the same bundle_params. Control variates and adaptive
+   * sampling are not supported.
    *
-   * It is a sad conclusion after almost two weeks of effort ¯\_(ツ)_/¯.
-   * Well, at least I learned more about C++ and saw quite a bit of San
-   * Francisco :)
+   * This used to be a port of drake's Monte-Carlo simulation:
+   * https://github.com/RobotLocomotion/drake/blob/5316536420413b51871ceb4b9c1f77aedd559f71/systems/analysis/monte_carlo.cc#L42
+   * whose dispatcher polled the futures and slept for n_samples ms between
+   * polls, leaving threads idle.
    */
   std::vector<Eigen::MatrixXd>
   CalcBundledBTrjDirect(const Eigen::Ref<const Eigen::MatrixXd> &x_trj,
@@ -96,6 +303,13 @@ public:
                         double std_u, QuasistaticSimParameters sim_params,
                         int n_samples, std::optional<int> seed) const;
 
+  std::vector<Eigen::MatrixXd>
+  CalcBundledBTrjDirect(const Eigen::Ref<const Eigen::MatrixXd> &x_trj,
+                        const Eigen::Ref<const Eigen::MatrixXd> &u_trj,
+                        const Eigen::Ref<const Eigen::VectorXd> &std_u,
+                        QuasistaticSimParameters sim_params,
+                        const BundledGradientParameters &bundle_params) const;
+
   static Eigen::MatrixXd
   CalcBundledB(QuasistaticSimulator *q_sim,
                const Eigen::Ref<const Eigen::VectorXd> &q,
@@ -103,6 +317,45 @@ public:
                const Eigen::Ref<const Eigen::MatrixXd> &du,
                const QuasistaticSimParameters &sim_params);
 
+  /*
+   * Gradient of cost.Eval(x_trj, u_trj), where x_trj is the rollout of
+   * u_trj from x0, by the adjoint method with checkpointing:
+   *  - the forward pass stores x_t only at every checkpoint_interval-th time
+   *    step (ceil(sqrt(T)) if checkpoint_interval is 0), and
+   *  - the backward pass goes over the segments between checkpoints in
+   *    reverse, re-simulates each of them with gradients, and propagates
+   *    the costate lambda_t = dcost/dx_t with
+   *      Dcost_Du_trj.row(t) = (dl/du_t + B_t^T * lambda_{t+1})^T,
+   *      lambda_t = dl/dx_t + A_t^T * lambda_{t+1}.
+   * A_t and B_t are only kept for one segment at a time, so the memory is
+   * O(sqrt(T)) instead of O(T), at the price of simulating every time step
+   * twice. sim_params.gradient_mode is ignored, and objects never sleep,
+   * so that both passes simulate the same trajectory.
+   * Throws std::runtime_error if a time step fails.
+   */
+  static TrajectoryGradient
+  CalcTrajectoryGradient(QuasistaticSimulator *q_sim,
+                         const Eigen::Ref<const Eigen::VectorXd> &x0,
+                         const Eigen::Ref<const Eigen::MatrixXd> &u_trj,
+                         const QuadraticTrajectoryCost &cost,
+                         QuasistaticSimParameters sim_params,
+                         int checkpoint_interval = 0);
+
+  /*
+   * CalcTrajectoryGradient of K rollouts, with x0_batch.row(k) and
+   * u_trj_batch[k] as the initial state and inputs of rollout k. Every
+   * rollout is a task of DispatchTasksParallel.
+   */
+  std::vector<TrajectoryGradient> CalcTrajectoryGradientParallel(
+      const Eigen::Ref<const Eigen::MatrixXd> &x0_batch,
+      const std::vector<Eigen::MatrixXd> &u_trj_batch,
+      const QuadraticTrajectoryCost &cost,
+      const QuasistaticSimParameters &sim_params,
+      int checkpoint_interval = 0) const;
+
+  /*
+   * Every call uses a different stream of random numbers.
+   */
   Eigen::MatrixXd
   SampleGaussianMatrix(int n_rows, const Eigen::Ref<const Eigen::VectorXd> &mu,
                        const Eigen::Ref<const Eigen::VectorXd> &std) const;
@@ -116,14 +369,90 @@ public:
 
   QuasistaticSimulator &get_q_sim() const { return *q_sims_.begin(); };
 
+  /*
+   * If set, CalcDynamicsParallel and CalcDynamicsSerial look up every
+   * (x, u) in the cache before solving the dynamics, and insert the results
+   * of the ones they solve. The cache can be shared between simulators of
+   * the same system. nullptr disables caching.
+   */
+  void set_dynamics_cache(std::shared_ptr<DynamicsCache> cache) {
+    dynamics_cache_ = std::move(cache);
+  }
+  const std::shared_ptr<DynamicsCache> &get_dynamics_cache() const {
+    return dynamics_cache_;
+  }
+
 private:
   static std::vector<size_t> CalcBatchSizes(size_t n_tasks, size_t n_threads);
 
-  std::stack<int> InitializeSimulatorStack() const;
-  size_t num_max_parallel_executions{0};
+  /*
+   * Units [j_start, j_start + n_units) of time step t, where a unit is a
+   * sample or an antithetic pair of samples. Blocks are the work items of
+   * the threads in CalcBundledABcTrj and CalcBcLstsqTrj.
+   */
+  struct SampleBlock {
+    int t;
+    int j_start;
+    int n_units;
+  };
 
-  std::unique_ptr<drake::solvers::GurobiSolver> solver_;
+  /*
+   * Splits units [j_start[t], j_start[t] + n_units[t]) of every time step t
+   * into contiguous blocks, such that there are at least kMinBlocks blocks
+   * in total if there are enough units. The blocks are sorted by t and
+   * j_start, and only depend on the arguments (and not on the number of
+   * threads).
+   */
+  static std::vector<SampleBlock>
+  SplitIntoBlocks(const std::vector<int> &j_start,
+                  const std::vector<int> &n_units);
+  static constexpr int kMinBlocks{64};
+
+  /*
+   * Calls task(q_sim, i_task) for every task in [0, n_tasks), where q_sim is
+   * the QuasistaticSimulator owned by the calling thread. A thread takes the
+   * next task from a shared atomic counter as soon as it finishes the
+   * previous one, so threads do not wait on each other when tasks take
+   * different amounts of time. Tasks must not depend on which thread runs
+   * them.
+   */
+  void DispatchTasksParallel(
+      size_t n_tasks,
+      const std::function<void(QuasistaticSimulator *, size_t)> &task) const;
+
+  /*
+   * Returns the key of the counter-based random number generator used by
+   * a call. If seed is not provided, every call gets a different key derived
+   * from the seed drawn when this object is constructed.
+   */
+  uint64_t ResolveSeed(std::optional<int> seed) const;
+
+  /*
+   * Sampler of the perturbations of a call, which draws up to n_samples
+   * samples of dimension dim per time step.
+   */
+  std::unique_ptr<GaussianSampler>
+  MakeGaussianSampler(const BundledGradientParameters &bundle_params,
+                      int n_samples, int dim) const;
+
+  /*
+   * QuasistaticSimulator::CalcDynamics, served from dynamics_cache_ when
+   * possible. The results are written in place into x_next, A and B, which
+   * need to have the right sizes; A and B are only written if required by
+   * sim_params.gradient_mode, and can be empty otherwise. Throws
+   * std::runtime_error if the dynamics fails to solve.
+   */
+  void CalcDynamicsCached(
+      QuasistaticSimulator *q_sim, const Eigen::Ref<const Eigen::VectorXd> &q,
+      const Eigen::Ref<const Eigen::VectorXd> &u,
+      const QuasistaticSimParameters &sim_params,
+      Eigen::Ref<Eigen::VectorXd, 0, Eigen::InnerStride<>> x_next,
+      Eigen::Ref<Eigen::MatrixXd> A, Eigen::Ref<Eigen::MatrixXd> B) const;
+
+  size_t num_max_parallel_executions{0};
 
+  std::shared_ptr<DynamicsCache> dynamics_cache_;
   mutable std::vector<QuasistaticSimulator> q_sims_;
-  mutable std::mt19937 gen_;
+  uint64_t seed_{0};
+  mutable std::atomic<uint64_t> n_unseeded_calls_{0};
 };
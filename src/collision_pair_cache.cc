@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <string>
+
+#include "drake/geometry/shape_specification.h"
+
+#include "collision_pair_cache.h"
+
+using drake::geometry::GeometryId;
+using drake::geometry::QueryObject;
+using drake::geometry::SignedDistancePair;
+
+namespace {
+/*
+ * Radius of the smallest ball centered at the origin of the geometry frame
+ * which contains the shape. Infinite for unbounded shapes, and for shapes
+ * whose extent is not known without loading them, e.g. meshes.
+ */
+class BoundingRadiusReifier : public drake::geometry::ShapeReifier {
+public:
+  double Calc(const drake::geometry::Shape &shape) {
+    double r{std::numeric_limits<double>::infinity()};
+    shape.Reify(this, &r);
+    return r;
+  }
+
+private:
+  using ShapeReifier::ImplementGeometry;
+
+  void ImplementGeometry(const drake::geometry::Sphere &sphere,
+                         void *data) override {
+    *static_cast<double *>(data) = sphere.radius();
+  }
+  void ImplementGeometry(const drake::geometry::Box &box, void *data) override {
+    *static_cast<double *>(data) = box.size().norm() / 2;
+  }
+  void ImplementGeometry(const drake::geometry::Cylinder &cylinder,
+                         void *data) override {
+    *static_cast<double *>(data) =
+        std::hypot(cylinder.radius(), cylinder.length() / 2);
+  }
+  void ImplementGeometry(const drake::geometry::Capsule &capsule,
+                         void *data) override {
+    *static_cast<double *>(data) = capsule.radius() + capsule.length() / 2;
+  }
+  void ImplementGeometry(const drake::geometry::Ellipsoid &ellipsoid,
+                         void *data) override {
+    *static_cast<double *>(data) =
+        std::max({ellipsoid.a(), ellipsoid.b(), ellipsoid.c()});
+  }
+  void ThrowUnsupportedGeometry(const std::string &) override {
+    // The radius stays infinite.
+  }
+};
+} // namespace
+
+std::vector<SignedDistancePair<double>>
+CollisionPairCache::ComputeSignedDistancePairs(
+    const QueryObject<double> &query_object,
+    const double contact_detection_tolerance, const double margin) {
+  if (margin <= 0) {
+    return query_object.ComputeSignedDistancePairwiseClosestPoints(
+        contact_detection_tolerance);
+  }
+
+  std::vector<SignedDistancePair<double>> sdps;
+  if (AreCandidatesValid(query_object, contact_detection_tolerance, margin)) {
+    for (const auto &[id_A, id_B] : candidates_) {
+      auto sdp =
+          query_object.ComputeSignedDistancePairClosestPoints(id_A, id_B);
+      if (sdp.distance > contact_detection_tolerance) {
+        continue;
+      }
+      // Keeps the order of the full query.
+      if (sdp.id_A != id_A) {
+        sdp.SwapAAndB();
+      }
+      sdps.emplace_back(std::move(sdp));
+    }
+    n_cached_queries_++;
+    return sdps;
+  }
+
+  auto sdps_candidates =
+      query_object.ComputeSignedDistancePairwiseClosestPoints(
+          contact_detection_tolerance + margin);
+  candidates_.clear();
+  for (auto &sdp : sdps_candidates) {
+    candidates_.emplace_back(sdp.id_A, sdp.id_B);
+    if (sdp.distance <= contact_detection_tolerance) {
+      sdps.emplace_back(std::move(sdp));
+    }
+  }
+
+  const auto &inspector = query_object.inspector();
+  X_WG_saved_.clear();
+  for (const auto &id : inspector.GetAllGeometryIds()) {
+    if (inspector.GetProximityProperties(id) == nullptr) {
+      continue;
+    }
+    X_WG_saved_[id] = query_object.GetPoseInWorld(id);
+    if (radii_.find(id) == radii_.end()) {
+      radii_[id] = BoundingRadiusReifier().Calc(inspector.GetShape(id));
+    }
+  }
+  tolerance_ = contact_detection_tolerance;
+  margin_ = margin;
+  has_candidates_ = true;
+  n_full_queries_++;
+  return sdps;
+}
+
+bool CollisionPairCache::AreCandidatesValid(
+    const QueryObject<double> &query_object,
+    const double contact_detection_tolerance, const double margin) const {
+  if (not has_candidates_ or contact_detection_tolerance != tolerance_ or
+      margin != margin_) {
+    return false;
+  }
+
+  // The two largest motion bounds.
+  double d_max_1 = 0;
+  double d_max_2 = 0;
+  for (const auto &[id, X_WG_saved] : X_WG_saved_) {
+    const auto X_WG = query_object.GetPoseInWorld(id);
+    double d = (X_WG.translation() - X_WG_saved.translation()).norm();
+    // Geometries without a bounding radius only need to keep their
+    // orientation.
+    if (not X_WG.rotation().IsExactlyEqualTo(X_WG_saved.rotation())) {
+      const double angle = (X_WG_saved.rotation().inverse() * X_WG.rotation())
+                               .ToAngleAxis()
+                               .angle();
+      // Avoids 0 * inf for rotations which differ by rounding only.
+      if (angle > 0) {
+        d += angle * radii_.at(id);
+      }
+    }
+    // Also rejects NaN bounds.
+    if (not(d <= margin)) {
+      return false;
+    }
+    if (d > d_max_1) {
+      d_max_2 = d_max_1;
+      d_max_1 = d;
+    } else if (d > d_max_2) {
+      d_max_2 = d;
+    }
+    if (d_max_1 + d_max_2 > margin) {
+      return false;
+    }
+  }
+  return true;
+}
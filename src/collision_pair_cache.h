@@ -0,0 +1,64 @@
+#pragma once
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "drake/geometry/query_object.h"
+#include "drake/geometry/scene_graph_inspector.h"
+
+/*
+ * Reuses the candidate pairs of a signed distance query across time steps.
+ *
+ * A full query, ComputeSignedDistancePairwiseClosestPoints, is made with
+ * the tolerance inflated by margin, and the pairs it returns become the
+ * candidates. The pose of every proximity geometry at the full query is
+ * saved. A later query bounds how far any point of a geometry G has moved
+ * since then by
+ *   |p_WG - p_WG_saved| + angle(R_WG_saved^T R_WG) * r_G,
+ * where r_G is the radius of the smallest ball centered at the origin of G
+ * that contains G. Signed distances change by at most the sum of the motion
+ * bounds of the two geometries, so if the two largest bounds add up to at
+ * most margin, no pair outside the candidates can be within the tolerance.
+ * In that case only the candidates are queried, with
+ * ComputeSignedDistancePairClosestPoints. Otherwise a full query is made.
+ *
+ * The result contains the same pairs as a full query with the tolerance,
+ * in the order of the last full query.
+ */
+class CollisionPairCache {
+public:
+  /*
+   * Signed distance pairs within contact_detection_tolerance. If margin is
+   * 0, every call is a full query with the tolerance, and the cache is not
+   * used.
+   */
+  std::vector<drake::geometry::SignedDistancePair<double>>
+  ComputeSignedDistancePairs(
+      const drake::geometry::QueryObject<double> &query_object,
+      double contact_detection_tolerance, double margin);
+
+  // Discards the candidates, so that the next query is a full one.
+  void Clear() { has_candidates_ = false; }
+
+  int get_n_full_queries() const { return n_full_queries_; }
+  int get_n_cached_queries() const { return n_cached_queries_; }
+
+private:
+  bool AreCandidatesValid(
+      const drake::geometry::QueryObject<double> &query_object,
+      double contact_detection_tolerance, double margin) const;
+
+  bool has_candidates_{false};
+  std::vector<std::pair<drake::geometry::GeometryId,
+                        drake::geometry::GeometryId>> candidates_;
+  // Tolerance and margin of the last full query.
+  double tolerance_{0};
+  double margin_{0};
+  std::unordered_map<drake::geometry::GeometryId,
+                     drake::math::RigidTransformd> X_WG_saved_;
+  // Bounding radii r_G, infinite for shapes without a simple bound.
+  std::unordered_map<drake::geometry::GeometryId, double> radii_;
+
+  int n_full_queries_{0};
+  int n_cached_queries_{0};
+};
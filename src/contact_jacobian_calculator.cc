@@ -1,4 +1,11 @@
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <iterator>
+#include <limits>
+
+#include "drake/common/extract_double.h"
+#include "drake/math/cross_product.h"
 
 #include "contact_jacobian_calculator.h"
 
@@ -51,13 +58,95 @@ ContactJacobianCalculator<T>::ContactJacobianCalculator(
   DRAKE_THROW_UNLESS(plant_ != nullptr);
   DRAKE_THROW_UNLESS(sg_ != nullptr);
 
-  // friction coefficients.
+  body_jacobians_.resize(plant_->num_bodies());
+  body_jacobian_stamps_.resize(plant_->num_bodies(), -1);
+
+  // Velocities of the joints between the world and each body.
+  const int n_b = plant_->num_bodies();
+  const int world_idx = plant_->world_body().index();
+  std::vector<int> parents(n_b, world_idx);
+  std::vector<std::vector<int>> inboard_v_indices(n_b);
+  std::vector<bool> has_inboard_joint(n_b, false);
+  for (int i = 0; i < plant_->num_model_instances(); i++) {
+    for (const auto &joint_idx :
+         plant_->GetJointIndices(ModelInstanceIndex(i))) {
+      const auto &joint = plant_->get_joint(joint_idx);
+      const int child = joint.child_body().index();
+      parents[child] = joint.parent_body().index();
+      has_inboard_joint[child] = true;
+      for (int k = 0; k < joint.num_velocities(); k++) {
+        inboard_v_indices[child].push_back(joint.velocity_start() + k);
+      }
+    }
+  }
+  // Floating bodies without a joint to the world are the only body of
+  //  their model instances, which therefore own their velocities.
+  const int n_v = plant_->num_velocities();
+  VectorX<T> selector(n_v);
+  for (int i = 0; i < n_v; i++) {
+    selector[i] = i;
+  }
+  for (int b = 0; b < n_b; b++) {
+    const auto &body = plant_->get_body(drake::multibody::BodyIndex(b));
+    if (b == world_idx or has_inboard_joint[b]) {
+      continue;
+    }
+    DRAKE_THROW_UNLESS(body.is_floating());
+    const auto v_model =
+        plant_->GetVelocitiesFromArray(body.model_instance(), selector);
+    for (int k = 0; k < v_model.size(); k++) {
+      inboard_v_indices[b].push_back(
+          std::lround(drake::ExtractDoubleOrThrow(v_model[k])));
+    }
+  }
+  body_v_indices_.resize(n_b);
+  for (int b = 0; b < n_b; b++) {
+    auto &v_indices = body_v_indices_[b];
+    for (int a = b; a != world_idx; a = parents[a]) {
+      v_indices.insert(v_indices.end(), inboard_v_indices[a].begin(),
+                       inboard_v_indices[a].end());
+    }
+    std::sort(v_indices.begin(), v_indices.end());
+  }
+
+  // Geometries with the proximity role.
   const auto &inspector = sg_->model_inspector();
+  std::vector<drake::geometry::GeometryId> g_ids;
+  for (const auto &g_id : inspector.GetAllGeometryIds()) {
+    if (inspector.GetProximityProperties(g_id) != nullptr) {
+      g_ids.push_back(g_id);
+    }
+  }
+  if (not g_ids.empty()) {
+    const auto [min_it, max_it] =
+        std::minmax_element(g_ids.begin(), g_ids.end());
+    min_geometry_id_ = min_it->get_value();
+    geometry_ordinals_.resize(max_it->get_value() - min_geometry_id_ + 1, -1);
+  }
+  for (const auto &g_id : g_ids) {
+    geometry_ordinals_[g_id.get_value() - min_geometry_id_] =
+        geometry_info_.size();
+    GeometryInfo info;
+    info.body_idx = GetMbpBodyFromGeometry(g_id);
+    const auto &model = plant_->get_body(info.body_idx).model_instance();
+    info.is_in_models_all = models_all_.find(model) != models_all_.end();
+    info.X_BG = inspector.GetPoseInFrame(g_id).template cast<T>();
+    geometry_info_.emplace_back(std::move(info));
+  }
+
+  // friction coefficients.
+  const int n_g = geometry_info_.size();
+  friction_coefficients_ = Eigen::MatrixXd::Constant(
+      n_g, n_g, std::numeric_limits<double>::quiet_NaN());
   const auto cc = inspector.GetCollisionCandidates();
   for (const auto &[g_idA, g_idB] : cc) {
     const double mu = GetFrictionCoefficientForSignedDistancePair(g_idA, g_idB);
-    friction_coefficients_[g_idA][g_idB] = mu;
-    friction_coefficients_[g_idB][g_idA] = mu;
+    // nan marks the pairs which are not collision candidates.
+    DRAKE_THROW_UNLESS(not std::isnan(mu));
+    const int i_A = GetGeometryOrdinal(g_idA);
+    const int i_B = GetGeometryOrdinal(g_idB);
+    friction_coefficients_(i_A, i_B) = mu;
+    friction_coefficients_(i_B, i_A) = mu;
   }
 }
 
@@ -65,69 +154,105 @@ template <class T>
 Matrix3X<T> ContactJacobianCalculator<T>::CalcContactJaocibanFromPoint(
     const drake::systems::Context<T> *context_plant,
     const drake::multibody::BodyIndex &body_idx,
-    const drake::VectorX<T> &pC_Body) const {
-  const auto &frameB = plant_->get_body(body_idx).body_frame();
-  drake::Matrix3X<T> J_body(3, plant_->num_velocities());
-  plant_->CalcJacobianTranslationalVelocity(
-      *context_plant, drake::multibody::JacobianWrtVariable::kV, frameB,
-      pC_Body, plant_->world_frame(), plant_->world_frame(), &J_body);
-
-  return J_body;
+    const drake::Vector3<T> &p_BoC_W) const {
+  auto &J_body = body_jacobians_[body_idx];
+  if (body_jacobian_stamps_[body_idx] != body_jacobian_stamp_) {
+    const auto &frameB = plant_->get_body(body_idx).body_frame();
+    J_body.resize(6, plant_->num_velocities());
+    plant_->CalcJacobianSpatialVelocity(
+        *context_plant, drake::multibody::JacobianWrtVariable::kV, frameB,
+        Vector3<T>::Zero(), plant_->world_frame(), plant_->world_frame(),
+        &J_body);
+    body_jacobian_stamps_[body_idx] = body_jacobian_stamp_;
+  }
+
+  // The translational velocity of C is v_WBo + w_WB x p_BoC_W.
+  const auto &v_indices = body_v_indices_[body_idx];
+  return J_body(Eigen::seqN(3, 3), v_indices) -
+         drake::math::VectorToSkewSymmetric(p_BoC_W) *
+             J_body(Eigen::seqN(0, 3), v_indices);
+}
+
+template <class T>
+void ContactJacobianCalculator<T>::AddBodyContactJacobian(
+    const drake::systems::Context<T> *context_plant,
+    const drake::multibody::BodyIndex &body_idx,
+    const drake::Vector3<T> &p_BoC_W, const double sign,
+    ContactPairInfo<T> *cpi) const {
+  const Matrix3X<T> J_body =
+      CalcContactJaocibanFromPoint(context_plant, body_idx, p_BoC_W);
+  // body_v_indices_[body_idx] is a sorted subset of the sorted
+  //  cpi->v_indices.
+  const auto &v_indices_body = body_v_indices_[body_idx];
+  size_t j = 0;
+  for (size_t i = 0; i < v_indices_body.size(); i++) {
+    while (cpi->v_indices[j] != v_indices_body[i]) {
+      j++;
+    }
+    cpi->Jc.col(j) += sign * J_body.col(i);
+  }
 }
 
 template <class T>
 void ContactJacobianCalculator<T>::UpdateContactPairInfo(
     const drake::systems::Context<T> *context_plant,
     const std::vector<drake::geometry::SignedDistancePair<T>> &sdps) const {
-  // Clear stored contact info.
-  contact_pairs_.clear();
-
   const auto n_c = sdps.size();
-  const int n_v = plant_->num_velocities();
-  const auto &inspector = sg_->model_inspector();
-
+  // Existing entries are overwritten, which keeps the capacity of their
+  //  v_indices and Jc.
   contact_pairs_.resize(n_c);
+  // Invalidates the body Jacobians of the previous call.
+  body_jacobian_stamp_++;
 
   for (int i_c = 0; i_c < n_c; i_c++) {
     const auto &sdp = sdps[i_c];
     auto &cpi = contact_pairs_[i_c]; // ContactPairInfo.
+    const int i_A = GetGeometryOrdinal(sdp.id_A);
+    const int i_B = GetGeometryOrdinal(sdp.id_B);
+    const auto &info_A = geometry_info_[i_A];
+    const auto &info_B = geometry_info_[i_B];
     cpi.nhat_BA_W = sdp.nhat_BA_W;
-    cpi.mu = friction_coefficients_.at(sdp.id_A).at(sdp.id_B);
-
-    // Compute contact Jacobian.
-    cpi.Jc.resize(3, n_v);
-    cpi.Jc.setZero();
-    const auto bodyA_idx = GetMbpBodyFromGeometry(sdp.id_A);
-    const auto bodyB_idx = GetMbpBodyFromGeometry(sdp.id_B);
-    const auto &X_AGa = inspector.GetPoseInFrame(sdp.id_A).template cast<T>();
-    const auto &X_AGb = inspector.GetPoseInFrame(sdp.id_B).template cast<T>();
-    const auto p_ACa_A = X_AGa * sdp.p_ACa;
-    const auto p_BCb_B = X_AGb * sdp.p_BCb;
-    const auto model_A_ptr = FindModelForBody(bodyA_idx);
-    const auto model_B_ptr = FindModelForBody(bodyB_idx);
-
-    if (model_A_ptr == nullptr and model_B_ptr == nullptr) {
+    cpi.mu = friction_coefficients_(i_A, i_B);
+    // The pair is not a collision candidate.
+    DRAKE_THROW_UNLESS(not std::isnan(cpi.mu));
+
+    const auto bodyA_idx = info_A.body_idx;
+    const auto bodyB_idx = info_B.body_idx;
+    const auto &X_WA = plant_->EvalBodyPoseInWorld(
+        *context_plant, plant_->get_body(bodyA_idx));
+    const auto &X_WB = plant_->EvalBodyPoseInWorld(
+        *context_plant, plant_->get_body(bodyB_idx));
+    // Contact points relative to the body origins, expressed in world frame.
+    const Vector3<T> p_AoCa_W = X_WA.rotation() * (info_A.X_BG * sdp.p_ACa);
+    const Vector3<T> p_BoCb_W = X_WB.rotation() * (info_B.X_BG * sdp.p_BCb);
+
+    if (not info_A.is_in_models_all and not info_B.is_in_models_all) {
       throw std::logic_error(
           "One body in a contact pair is not in body_indices_");
-    } else {
-      if (model_A_ptr) {
-        cpi.Jc +=
-            CalcContactJaocibanFromPoint(context_plant, bodyA_idx, p_ACa_A);
-      }
-      if (model_B_ptr) {
-        cpi.Jc -=
-            CalcContactJaocibanFromPoint(context_plant, bodyB_idx, p_BCb_B);
-      }
     }
 
-    // This is needed only for computing the contact point, which is now only
-    // used for visualization.
-    auto X_WA = plant_->EvalBodyPoseInWorld(*context_plant,
-                                            plant_->get_body(bodyA_idx));
-    auto X_WB = plant_->EvalBodyPoseInWorld(*context_plant,
-                                            plant_->get_body(bodyB_idx));
-    cpi.p_WCa = X_WA * p_ACa_A;
-    cpi.p_WCb = X_WB * p_BCb_B;
+    // Compute contact Jacobian, on the union of the columns of the two
+    //  bodies.
+    static const std::vector<int> kNoColumns;
+    const auto &v_indices_A =
+        info_A.is_in_models_all ? body_v_indices_[bodyA_idx] : kNoColumns;
+    const auto &v_indices_B =
+        info_B.is_in_models_all ? body_v_indices_[bodyB_idx] : kNoColumns;
+    cpi.v_indices.clear();
+    std::set_union(v_indices_A.begin(), v_indices_A.end(),
+                   v_indices_B.begin(), v_indices_B.end(),
+                   std::back_inserter(cpi.v_indices));
+    cpi.Jc.setZero(3, cpi.v_indices.size());
+    if (info_A.is_in_models_all) {
+      AddBodyContactJacobian(context_plant, bodyA_idx, p_AoCa_W, 1, &cpi);
+    }
+    if (info_B.is_in_models_all) {
+      AddBodyContactJacobian(context_plant, bodyB_idx, p_BoCb_W, -1, &cpi);
+    }
+
+    // The contact points are only used for visualization.
+    cpi.p_WCa = X_WA.translation() + p_AoCa_W;
+    cpi.p_WCb = X_WB.translation() + p_BoCb_W;
     cpi.body_A_idx = bodyA_idx;
     cpi.body_B_idx = bodyB_idx;
     cpi.id_A = sdp.id_A;
@@ -135,21 +260,6 @@ void ContactJacobianCalculator<T>::UpdateContactPairInfo(
   }
 }
 
-/*
- * Returns nullptr if body_idx is not in any of the values of bodies_indices_;
- * Otherwise returns the model instance to which body_idx belongs.
- */
-template <class T>
-std::unique_ptr<ModelInstanceIndex>
-ContactJacobianCalculator<T>::FindModelForBody(
-    drake::multibody::BodyIndex body_idx) const {
-  const auto &model = plant_->get_body(body_idx).model_instance();
-  if (models_all_.find(model) != models_all_.end()) {
-    return std::make_unique<ModelInstanceIndex>(model);
-  }
-  return nullptr;
-}
-
 template <class T>
 double
 ContactJacobianCalculator<T>::GetFrictionCoefficientForSignedDistancePair(
@@ -191,7 +301,7 @@ void ContactJacobianCalculator<T>::CalcJacobianAndPhiQp(
   VectorX<T> &phi = *phi_ptr;
   MatrixX<T> &Jn = *Jn_ptr;
   phi.resize(n_c);
-  Jn.resize(n_c, n_v);
+  Jn.setZero(n_c, n_v);
   J_list_ptr->clear();
 
   for (int i_c = 0; i_c < n_c; i_c++) {
@@ -200,15 +310,16 @@ void ContactJacobianCalculator<T>::CalcJacobianAndPhiQp(
     const auto mu = get_friction_coefficient(i_c);
 
     phi[i_c] = sdp.distance;
-    Jn.row(i_c) = sdp.nhat_BA_W.transpose() * cpi.Jc;
+    // Products with the compact Jc are scattered into columns v_indices.
+    const drake::RowVectorX<T> Jn_i_c = sdp.nhat_BA_W.transpose() * cpi.Jc;
+    Jn(i_c, cpi.v_indices) = Jn_i_c;
 
     contact_pairs_[i_c].t_W = CalcTangentVectors<T>(sdp.nhat_BA_W, n_d);
     const auto &d_W = contact_pairs_[i_c].t_W;
-    J_list_ptr->template emplace_back(n_d, n_v);
+    J_list_ptr->template emplace_back(MatrixX<T>::Zero(n_d, n_v));
     MatrixX<T> &J_i_c = J_list_ptr->back();
-    for (int j = 0; j < n_d; j++) {
-      J_i_c.row(j) = Jn.row(i_c) + mu * d_W.col(j).transpose() * cpi.Jc;
-    }
+    J_i_c(Eigen::all, cpi.v_indices) =
+        (mu * d_W.transpose() * cpi.Jc).rowwise() + Jn_i_c;
   }
 }
 
@@ -234,7 +345,7 @@ void ContactJacobianCalculator<T>::CalcJacobianAndPhiSocp(
     const auto mu = get_friction_coefficient(i_c);
 
     phi[i_c] = sdp.distance;
-    J_list.template emplace_back(3, n_v);
+    J_list.template emplace_back(Matrix3X<T>::Zero(3, n_v));
     Matrix3X<T> &J_i = J_list.back();
     const drake::Matrix3<T> R =
         drake::math::RotationMatrix<T>::MakeFromOneUnitVector(sdp.nhat_BA_W, 2)
@@ -245,9 +356,9 @@ void ContactJacobianCalculator<T>::CalcJacobianAndPhiSocp(
     contact_pairs_[i_c].t_W.col(0) = t1;
     contact_pairs_[i_c].t_W.col(1) = t2;
 
-    J_i.row(0) = sdp.nhat_BA_W.transpose() * cpi.Jc / mu;
-    J_i.row(1) = t1.transpose() * cpi.Jc;
-    J_i.row(2) = t2.transpose() * cpi.Jc;
+    J_i(0, cpi.v_indices) = sdp.nhat_BA_W.transpose() * cpi.Jc / mu;
+    J_i(1, cpi.v_indices) = t1.transpose() * cpi.Jc;
+    J_i(2, cpi.v_indices) = t2.transpose() * cpi.Jc;
   }
 }
 
@@ -2,6 +2,7 @@
 #include <Eigen/Dense>
 
 #include "drake/common/default_scalars.h"
+#include "drake/common/drake_throw.h"
 #include "drake/multibody/plant/multibody_plant.h"
 
 #include "quasistatic_sim_params.h"
@@ -15,7 +16,12 @@ template <typename T> struct ContactPairInfo {
   // SOCP, there are two.
   drake::Matrix3X<T> t_W;
 
-  // The (3, n_v) contact Jacobian defined in the docs.
+  // Indices, in increasing order, of the columns of the (3, n_v) contact
+  // Jacobian defined in the docs which can be non-zero. These are the
+  // velocities of the joints between the world and the bodies of the
+  // contact pair which belong to models_all.
+  std::vector<int> v_indices;
+  // The (3, v_indices.size()) columns v_indices of the contact Jacobian.
   drake::Matrix3X<T> Jc;
   double mu{0}; // coefficient of friction.
 
@@ -54,6 +60,12 @@ public:
     return contact_pairs_;
   }
 
+  /*
+   * Only ContactPairInfo::Jc is stored on its non-zero columns. phi, Jn and
+   * the entries of J_list are dense, with n_v columns, because the solvers
+   * and the derivatives downstream take dense matrices. The compact Jc is
+   * scattered into zero-initialized rows.
+   */
   void CalcJacobianAndPhiQp(
       const drake::systems::Context<T> *context_plant,
       const std::vector<drake::geometry::SignedDistancePair<T>> &sdps,
@@ -61,6 +73,10 @@ public:
       drake::MatrixX<T> *Jn_ptr,
       std::vector<drake::MatrixX<T>> *J_list_ptr) const;
 
+  /*
+   * As CalcJacobianAndPhiQp, the entries of J_list are dense (3, n_v)
+   * matrices.
+   */
   void CalcJacobianAndPhiSocp(
       const drake::systems::Context<T> *context_plant,
       const std::vector<drake::geometry::SignedDistancePair<T>> &sdps,
@@ -71,23 +87,44 @@ private:
   double GetFrictionCoefficientForSignedDistancePair(
       drake::geometry::GeometryId id_A, drake::geometry::GeometryId id_B) const;
 
-  std::unique_ptr<drake::multibody::ModelInstanceIndex>
-  FindModelForBody(drake::multibody::BodyIndex body_idx) const;
-
   drake::multibody::BodyIndex
   GetMbpBodyFromGeometry(drake::geometry::GeometryId g_id) const;
 
+  /*
+   * Ordinal of a geometry with the proximity role into geometry_info_.
+   * Throws if the geometry does not have the proximity role.
+   */
+  int GetGeometryOrdinal(drake::geometry::GeometryId g_id) const {
+    const int64_t i = g_id.get_value() - min_geometry_id_;
+    DRAKE_THROW_UNLESS(i >= 0 and i < geometry_ordinals_.size());
+    const int ordinal = geometry_ordinals_[i];
+    DRAKE_THROW_UNLESS(ordinal >= 0);
+    return ordinal;
+  }
+
   /*
    * Each contact Jacobian is the subtraction of the Jacobians of two points
    * on the two bodies in the contact pair. This function computes the
-   * contribution from one of the two bodies.
+   * contribution from one of the two bodies, whose origin is Bo, for the
+   * point C with position p_BoC_W relative to Bo, expressed in world frame.
    *
-   * Jc_ptr must have shape (3, n_v).
+   * The (6, n_v) spatial Jacobian of each body is computed once per call to
+   * UpdateContactPairInfo, and shifted to all contact points on the body.
+   * Only the columns body_v_indices_[body_idx] are returned.
    */
   drake::Matrix3X<T>
   CalcContactJaocibanFromPoint(const drake::systems::Context<T> *context_plant,
                                const drake::multibody::BodyIndex &body_idx,
-                               const drake::VectorX<T> &pC_Body) const;
+                               const drake::Vector3<T> &p_BoC_W) const;
+
+  /*
+   * Adds sign times the contribution of the body body_idx to the contact
+   * Jacobian of cpi, whose v_indices contain the columns of the body.
+   */
+  void AddBodyContactJacobian(const drake::systems::Context<T> *context_plant,
+                              const drake::multibody::BodyIndex &body_idx,
+                              const drake::Vector3<T> &p_BoC_W, double sign,
+                              ContactPairInfo<T> *cpi) const;
 
   const drake::multibody::MultibodyPlant<T> *plant_{nullptr};
   const drake::geometry::SceneGraph<T> *sg_{nullptr};
@@ -95,15 +132,43 @@ private:
   // MBP.
   const std::set<drake::multibody::ModelInstanceIndex> models_all_;
 
-  // friction_coefficients[g_idA][g_idB] and friction_coefficients[g_idB][g_idA]
-  //  gives the coefficient of friction between contact geometries g_idA
-  //  and g_idB.
-  std::unordered_map<drake::geometry::GeometryId,
-                     std::unordered_map<drake::geometry::GeometryId, double>>
-      friction_coefficients_;
+  // Static facts about the geometries with the proximity role, computed at
+  // construction.
+  struct GeometryInfo {
+    drake::multibody::BodyIndex body_idx;
+    // Whether the body belongs to a model instance in models_all_.
+    bool is_in_models_all{false};
+    // Pose of the geometry in the frame of its body.
+    drake::math::RigidTransform<T> X_BG;
+  };
+  std::vector<GeometryInfo> geometry_info_;
+
+  // body_v_indices_[body_idx] are the indices, in increasing order, of the
+  //  velocities of the joints between the world and the body, i.e. the
+  //  columns of the Jacobians of the body which can be non-zero.
+  std::vector<std::vector<int>> body_v_indices_;
+
+  // geometry_ordinals_[id.get_value() - min_geometry_id_] is the index of
+  //  geometry id into geometry_info_, or -1 if the geometry does not have
+  //  the proximity role. The GeometryIds of a diagram are drawn from an
+  //  increasing counter, so the table has few holes.
+  int64_t min_geometry_id_{0};
+  std::vector<int> geometry_ordinals_;
+
+  // friction_coefficients_(i, j) is the coefficient of friction between the
+  //  geometries of ordinals i and j, if they are a collision candidate, and
+  //  nan otherwise.
+  Eigen::MatrixXd friction_coefficients_;
 
   // Mutable storage for the current contact.
   mutable std::vector<ContactPairInfo<T>> contact_pairs_;
+
+  // Spatial Jacobians of the bodies, indexed by BodyIndex. A Jacobian is
+  // up to date if its stamp equals body_jacobian_stamp_, which is
+  // incremented by every call to UpdateContactPairInfo.
+  mutable std::vector<drake::MatrixX<T>> body_jacobians_;
+  mutable std::vector<int64_t> body_jacobian_stamps_;
+  mutable int64_t body_jacobian_stamp_{0};
 };
 
 extern template class ContactJacobianCalculator<double>;
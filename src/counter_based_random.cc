@@ -0,0 +1,56 @@
+#include <cmath>
+
+#include "counter_based_random.h"
+
+namespace {
+constexpr uint32_t kPhiloxM0{0xD2511F53};
+constexpr uint32_t kPhiloxM1{0xCD9E8D57};
+constexpr uint32_t kPhiloxW0{0x9E3779B9};
+constexpr uint32_t kPhiloxW1{0xBB67AE85};
+constexpr int kPhiloxRounds{10};
+
+inline void MulHiLo(uint32_t a, uint32_t b, uint32_t *hi, uint32_t *lo) {
+  const uint64_t product = static_cast<uint64_t>(a) * b;
+  *hi = static_cast<uint32_t>(product >> 32);
+  *lo = static_cast<uint32_t>(product);
+}
+} // namespace
+
+Philox4x32::Counter Philox4x32::Generate(Counter counter, Key key) {
+  for (int i = 0; i < kPhiloxRounds; i++) {
+    if (i > 0) {
+      key[0] += kPhiloxW0;
+      key[1] += kPhiloxW1;
+    }
+    uint32_t hi0, lo0, hi1, lo1;
+    MulHiLo(kPhiloxM0, counter[0], &hi0, &lo0);
+    MulHiLo(kPhiloxM1, counter[2], &hi1, &lo1);
+    counter = {hi1 ^ counter[1] ^ key[0], lo1, hi0 ^ counter[3] ^ key[1], lo0};
+  }
+  return counter;
+}
+
+void CounterBasedGaussianSampler::Sample(const uint32_t i_step,
+                                         const uint32_t i_sample,
+                                         Eigen::VectorXd *z_ptr) const {
+  auto &z = *z_ptr;
+  const auto n = z.size();
+  // Every Philox block has 4 uniform samples, which become 4 Gaussian
+  // samples after the Box-Muller transform.
+  for (Eigen::Index i = 0; i < n; i += 4) {
+    const auto r = Philox4x32::Generate(
+        {static_cast<uint32_t>(i / 4), i_sample, i_step, 0}, key_);
+    for (int j = 0; j < 2; j++) {
+      const double u1 = Philox4x32::ToUniform(r[2 * j]);
+      const double u2 = Philox4x32::ToUniform(r[2 * j + 1]);
+      const double rho = std::sqrt(-2 * std::log(u1));
+      const double theta = 2 * M_PI * u2;
+      if (i + 2 * j < n) {
+        z[i + 2 * j] = rho * std::cos(theta);
+      }
+      if (i + 2 * j + 1 < n) {
+        z[i + 2 * j + 1] = rho * std::sin(theta);
+      }
+    }
+  }
+}
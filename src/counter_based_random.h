@@ -0,0 +1,71 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+#include <Eigen/Dense>
+
+/*
+ * Philox4x32-10, the counter-based pseudo-random number generator in
+ *  J. K. Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC'11.
+ *
+ * Every output block is a pure function of a 128-bit counter and a 64-bit
+ * key. This makes it possible to generate random numbers in any order, on
+ * any thread, without shared state, and still get reproducible results.
+ */
+class Philox4x32 {
+public:
+  using Counter = std::array<uint32_t, 4>;
+  using Key = std::array<uint32_t, 2>;
+
+  static Counter Generate(Counter counter, Key key);
+
+  static Key MakeKey(uint64_t seed) {
+    return {static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)};
+  }
+
+  /*
+   * Maps a 32-bit integer to a double in the open interval (0, 1).
+   */
+  static double ToUniform(uint32_t x) { return (x + 0.5) * kTwoPowMinus32; }
+
+private:
+  static constexpr double kTwoPowMinus32{2.3283064365386963e-10};
+};
+
+/*
+ * Interface of generators of standard Gaussian vectors indexed by
+ * (i_step, i_sample), where i_step is typically the index of the time step
+ * along a trajectory and i_sample the index of the sample at that time step.
+ * Implementations are stateless after construction, so that Sample can be
+ * called concurrently from multiple threads.
+ */
+class GaussianSampler {
+public:
+  virtual ~GaussianSampler() = default;
+  virtual void Sample(uint32_t i_step, uint32_t i_sample,
+                      Eigen::VectorXd *z_ptr) const = 0;
+};
+
+/*
+ * Generates standard Gaussian vectors indexed by (i_step, i_sample), where
+ * i_step is typically the index of the time step along a trajectory and
+ * i_sample the index of the sample at that time step. A sample does not
+ * depend on how many other samples are drawn, or on the order in which
+ * they are drawn.
+ */
+class CounterBasedGaussianSampler : public GaussianSampler {
+public:
+  explicit CounterBasedGaussianSampler(uint64_t seed)
+      : key_(Philox4x32::MakeKey(seed)){};
+
+  /*
+   * Fills the vector pointed to by z_ptr with i.i.d. standard Gaussian
+   * samples, using the Box-Muller transform on the uniform samples generated
+   * by Philox4x32 from the counter (i_block, i_sample, i_step, 0).
+   */
+  void Sample(uint32_t i_step, uint32_t i_sample,
+              Eigen::VectorXd *z_ptr) const override;
+
+private:
+  const Philox4x32::Key key_;
+};
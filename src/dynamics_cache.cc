@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "drake/common/drake_throw.h"
+
+#include "dynamics_cache.h"
+
+namespace {
+int64_t BitCast(const double x) {
+  int64_t y;
+  std::memcpy(&y, &x, sizeof(x));
+  return y;
+}
+
+// The 64-bit finalizer of MurmurHash3.
+uint64_t Mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCD;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53;
+  h ^= h >> 33;
+  return h;
+}
+} // namespace
+
+DynamicsCache::DynamicsCache(const DynamicsCacheParameters &params)
+    : params_(params),
+      max_bytes_per_shard_(params.max_bytes / std::max(params.n_shards, 1)) {
+  DRAKE_THROW_UNLESS(params_.n_shards > 0);
+  DRAKE_THROW_UNLESS(params_.quantization >= 0);
+  for (int i = 0; i < params_.n_shards; i++) {
+    shards_.emplace_back(std::make_unique<Shard>());
+  }
+}
+
+DynamicsCache::Key
+DynamicsCache::MakeKey(const Eigen::Ref<const Eigen::VectorXd> &q,
+                       const Eigen::Ref<const Eigen::VectorXd> &u,
+                       const QuasistaticSimParameters &sim_params) const {
+  Key key;
+  auto &data = key.data;
+  data.reserve(q.size() + u.size() + 16);
+  // The sizes separate q from u.
+  data.push_back(q.size());
+  data.push_back(u.size());
+  const double s = params_.quantization;
+  for (const auto &v : {q, u}) {
+    for (Eigen::Index i = 0; i < v.size(); i++) {
+      data.push_back(s > 0 ? std::llround(v[i] / s) : BitCast(v[i]));
+    }
+  }
+
+  // gradient_mode and calc_contact_forces do not change x_next.
+  data.push_back(BitCast(sim_params.h));
+  for (int i = 0; i < 3; i++) {
+    data.push_back(BitCast(sim_params.gravity[i]));
+  }
+  data.push_back(BitCast(sim_params.contact_detection_tolerance));
+  data.push_back(sim_params.is_quasi_dynamic);
+  data.push_back(BitCast(sim_params.log_barrier_weight));
+  data.push_back(BitCast(sim_params.unactuated_mass_scale));
+  data.push_back(BitCast(sim_params.gradient_lstsq_tolerance));
+  data.push_back(static_cast<int64_t>(sim_params.forward_mode));
+  data.push_back(sim_params.nd_per_contact);
+  data.push_back(sim_params.use_free_solvers);
+  data.push_back(sim_params.use_contact_islands);
+  data.push_back(sim_params.contact_reduction_max_points);
+  data.push_back(BitCast(sim_params.contact_reduction_max_angle));
+
+  uint64_t h = 0;
+  for (const auto x : data) {
+    h = Mix(h ^ static_cast<uint64_t>(x));
+  }
+  key.hash = h;
+  return key;
+}
+
+bool DynamicsCache::Find(const Eigen::Ref<const Eigen::VectorXd> &q,
+                         const Eigen::Ref<const Eigen::VectorXd> &u,
+                         const QuasistaticSimParameters &sim_params,
+                         Eigen::Ref<Eigen::VectorXd, 0, Eigen::InnerStride<>>
+                             x_next,
+                         Eigen::Ref<Eigen::MatrixXd> A,
+                         Eigen::Ref<Eigen::MatrixXd> B) {
+  const bool needs_A = sim_params.gradient_mode == GradientMode::kAB or
+                       sim_params.gradient_mode == GradientMode::kABBroyden;
+  const bool needs_B = sim_params.gradient_mode != GradientMode::kNone;
+  const auto key = MakeKey(q, u, sim_params);
+  auto &shard = GetShard(key);
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    const auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      const auto &entry = *it->second;
+      if ((not needs_A or entry.A.size() > 0) and
+          (not needs_B or entry.B.size() > 0)) {
+        shard.entries.splice(shard.entries.begin(), shard.entries,
+                             it->second);
+        x_next = entry.x_next;
+        if (needs_A) {
+          A = entry.A;
+        }
+        if (needs_B) {
+          B = entry.B;
+        }
+        n_hits_++;
+        return true;
+      }
+    }
+  }
+  n_misses_++;
+  return false;
+}
+
+void DynamicsCache::Insert(const Eigen::Ref<const Eigen::VectorXd> &q,
+                           const Eigen::Ref<const Eigen::VectorXd> &u,
+                           const QuasistaticSimParameters &sim_params,
+                           const Eigen::Ref<const Eigen::VectorXd> &x_next,
+                           const Eigen::Ref<const Eigen::MatrixXd> &A,
+                           const Eigen::Ref<const Eigen::MatrixXd> &B) {
+  Entry entry{MakeKey(q, u, sim_params), x_next, A, B};
+  // The key is stored both in the entry and in the index.
+  entry.n_bytes = sizeof(Entry) + 2 * sizeof(int64_t) * entry.key.data.size() +
+                  sizeof(double) * (x_next.size() + A.size() + B.size());
+  if (entry.n_bytes > max_bytes_per_shard_) {
+    return;
+  }
+
+  auto &shard = GetShard(entry.key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  const auto it = shard.index.find(entry.key);
+  if (it != shard.index.end()) {
+    shard.n_bytes -= it->second->n_bytes;
+    shard.entries.erase(it->second);
+    shard.index.erase(it);
+  }
+  while (shard.n_bytes + entry.n_bytes > max_bytes_per_shard_) {
+    const auto &lru = shard.entries.back();
+    shard.n_bytes -= lru.n_bytes;
+    shard.index.erase(lru.key);
+    shard.entries.pop_back();
+  }
+  shard.n_bytes += entry.n_bytes;
+  shard.entries.push_front(std::move(entry));
+  shard.index.emplace(shard.entries.front().key, shard.entries.begin());
+}
+
+void DynamicsCache::Clear() {
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    shard->index.clear();
+    shard->entries.clear();
+    shard->n_bytes = 0;
+  }
+  n_hits_ = 0;
+  n_misses_ = 0;
+}
+
+size_t DynamicsCache::get_n_entries() const {
+  size_t n = 0;
+  for (const auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    n += shard->entries.size();
+  }
+  return n;
+}
+
+size_t DynamicsCache::get_n_bytes() const {
+  size_t n = 0;
+  for (const auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    n += shard->n_bytes;
+  }
+  return n;
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "quasistatic_sim_params.h"
+
+struct DynamicsCacheParameters {
+  // Upper bound on the memory used by the cached entries, in bytes.
+  size_t max_bytes{size_t{64} << 20};
+  // If positive, q and u are rounded to integer multiples of quantization
+  // before they are compared, so that queries which round to the same
+  // values share an entry. If 0, q and u need to match exactly.
+  double quantization{0};
+  // Every shard has its own lock and its own least-recently-used list, and
+  // a share of max_bytes.
+  int n_shards{16};
+};
+
+/*
+ * A thread-safe least-recently-used cache of the results of
+ * QuasistaticSimulator::CalcDynamics, keyed by (q, u) and the fields of
+ * QuasistaticSimParameters that affect the dynamics.
+ *
+ * An entry stores x_next, and A and B if they were computed. A query that
+ * needs A or B only hits entries which have them.
+ */
+class DynamicsCache {
+public:
+  explicit DynamicsCache(const DynamicsCacheParameters &params);
+
+  /*
+   * Returns true and copies the cached results into the outputs if
+   * (q, u, sim_params) is in the cache, with the gradients required by
+   * sim_params.gradient_mode. The outputs are written in place and need to
+   * have the right sizes; A and B are only written if they are needed.
+   */
+  bool Find(const Eigen::Ref<const Eigen::VectorXd> &q,
+            const Eigen::Ref<const Eigen::VectorXd> &u,
+            const QuasistaticSimParameters &sim_params,
+            Eigen::Ref<Eigen::VectorXd, 0, Eigen::InnerStride<>> x_next,
+            Eigen::Ref<Eigen::MatrixXd> A, Eigen::Ref<Eigen::MatrixXd> B);
+
+  /*
+   * Inserts or replaces the entry of (q, u, sim_params). A and B can have
+   * zero size. Least recently used entries are evicted to stay within
+   * max_bytes.
+   */
+  void Insert(const Eigen::Ref<const Eigen::VectorXd> &q,
+              const Eigen::Ref<const Eigen::VectorXd> &u,
+              const QuasistaticSimParameters &sim_params,
+              const Eigen::Ref<const Eigen::VectorXd> &x_next,
+              const Eigen::Ref<const Eigen::MatrixXd> &A,
+              const Eigen::Ref<const Eigen::MatrixXd> &B);
+
+  void Clear();
+
+  size_t get_n_hits() const { return n_hits_; }
+  size_t get_n_misses() const { return n_misses_; }
+  size_t get_n_entries() const;
+  size_t get_n_bytes() const;
+  const DynamicsCacheParameters &get_params() const { return params_; }
+
+private:
+  struct Key {
+    std::vector<int64_t> data;
+    size_t hash{0};
+    bool operator==(const Key &other) const { return data == other.data; }
+  };
+  struct KeyHasher {
+    size_t operator()(const Key &key) const { return key.hash; }
+  };
+  struct Entry {
+    Key key;
+    Eigen::VectorXd x_next;
+    Eigen::MatrixXd A;
+    Eigen::MatrixXd B;
+    size_t n_bytes{0};
+  };
+  struct Shard {
+    mutable std::mutex mutex;
+    // Most recently used first.
+    std::list<Entry> entries;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHasher> index;
+    size_t n_bytes{0};
+  };
+
+  Key MakeKey(const Eigen::Ref<const Eigen::VectorXd> &q,
+              const Eigen::Ref<const Eigen::VectorXd> &u,
+              const QuasistaticSimParameters &sim_params) const;
+  Shard &GetShard(const Key &key) const {
+    return *shards_[key.hash % shards_.size()];
+  }
+
+  const DynamicsCacheParameters params_;
+  const size_t max_bytes_per_shard_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::atomic<size_t> n_hits_{0};
+  std::atomic<size_t> n_misses_{0};
+};
@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <cmath>
+
+#include "ilqr_solver.h"
+
+using Eigen::MatrixXd;
+using Eigen::VectorXd;
+
+namespace {
+/*
+ * Objects only sleep under GradientMode::kNone, so sleeping in the rollouts
+ * would freeze objects which the linearization simulates.
+ */
+QuasistaticSimParameters
+WithoutSleeping(const QuasistaticSimParameters &sim_params) {
+  auto sim_params_awake = sim_params;
+  sim_params_awake.sleep_velocity_threshold = 0;
+  return sim_params_awake;
+}
+
+/*
+ * Without std_u, the rollouts also compute A and B, so that the accepted
+ * rollout linearizes the dynamics without being simulated again.
+ */
+QuasistaticSimParameters
+MakeRolloutParams(const QuasistaticSimParameters &sim_params,
+                  const IlqrParameters &ilqr_params) {
+  auto rollout_params = sim_params;
+  if (ilqr_params.std_u.size() > 0) {
+    rollout_params.gradient_mode = GradientMode::kNone;
+  } else if (sim_params.gradient_mode != GradientMode::kABBroyden) {
+    rollout_params.gradient_mode = GradientMode::kAB;
+  }
+  return rollout_params;
+}
+} // namespace
+
+IlqrSolver::IlqrSolver(const BatchQuasistaticSimulator &q_sim_batch,
+                       const QuasistaticSimParameters &sim_params,
+                       const IlqrParameters &ilqr_params,
+                       const QuadraticTrajectoryCost &cost)
+    : q_sim_batch_(&q_sim_batch), sim_params_(WithoutSleeping(sim_params)),
+      ilqr_params_(ilqr_params),
+      rollout_params_(MakeRolloutParams(sim_params_, ilqr_params_)),
+      cost_(cost) {
+  DRAKE_THROW_UNLESS(ilqr_params_.n_line_search_steps > 0);
+  DRAKE_THROW_UNLESS(ilqr_params_.regularization_init > 0);
+  DRAKE_THROW_UNLESS(ilqr_params_.regularization_factor > 1);
+}
+
+const Eigen::MatrixXd &
+IlqrSolver::Solve(const Eigen::Ref<const Eigen::VectorXd> &x0,
+                  const Eigen::Ref<const Eigen::MatrixXd> &u_trj_init) {
+  const int T = u_trj_init.rows();
+  const int n_q = x0.size();
+  const int n_u = u_trj_init.cols();
+  DRAKE_THROW_UNLESS(T > 0);
+  DRAKE_THROW_UNLESS(cost_.get_Q().rows() == n_q);
+  DRAKE_THROW_UNLESS(cost_.get_R().rows() == n_u);
+
+  A_list_.resize(T);
+  B_list_.resize(T);
+  K_list_.assign(T, MatrixXd(n_u, n_q));
+  k_trj_.resize(T, n_u);
+  V_x_.resize(n_q);
+  Q_x_.resize(n_q);
+  Q_u_.resize(n_u);
+  V_xx_.resize(n_q, n_q);
+  Q_xx_.resize(n_q, n_q);
+  Q_uu_.resize(n_u, n_u);
+  Q_ux_.resize(n_u, n_q);
+  V_xx_A_.resize(n_q, n_q);
+  V_xx_B_.resize(n_q, n_u);
+
+  auto rollouts = q_sim_batch_->RolloutParallel(x0.transpose(), {u_trj_init},
+                                                rollout_params_);
+  if (not rollouts.is_valid.all()) {
+    throw std::runtime_error("The rollout of u_trj_init failed.");
+  }
+  x_trj_ = std::move(rollouts.x_trj_list[0]);
+  u_trj_ = u_trj_init;
+  if (ilqr_params_.std_u.size() == 0) {
+    A_list_ = std::move(rollouts.A_trj_list[0]);
+    B_list_ = std::move(rollouts.B_trj_list[0]);
+  }
+  costs_ = {cost_.Eval(x_trj_, u_trj_)};
+
+  double regularization = ilqr_params_.regularization_init;
+  bool is_linearized = false;
+  for (int i = 0; i < ilqr_params_.max_iterations; i++) {
+    if (not is_linearized) {
+      Linearize();
+      is_linearized = true;
+    }
+
+    bool is_step_found = false;
+    if (BackwardPass(regularization)) {
+      is_step_found = ForwardPass();
+    }
+
+    if (not is_step_found) {
+      regularization *= ilqr_params_.regularization_factor;
+      if (regularization > ilqr_params_.regularization_max) {
+        break;
+      }
+      continue;
+    }
+
+    is_linearized = false;
+    regularization =
+        std::max(regularization / ilqr_params_.regularization_factor,
+                 ilqr_params_.regularization_init);
+    const auto n = costs_.size();
+    if (costs_[n - 2] - costs_[n - 1] <
+        ilqr_params_.convergence_tolerance * std::abs(costs_[n - 2])) {
+      break;
+    }
+  }
+
+  return u_trj_;
+}
+
+void IlqrSolver::Linearize() {
+  // Without std_u, A_list_ and B_list_ come from the rollout of x_trj_.
+  if (ilqr_params_.std_u.size() == 0) {
+    return;
+  }
+
+  const int T = u_trj_.rows();
+  auto sim_params = sim_params_;
+  if (sim_params.gradient_mode != GradientMode::kABBroyden) {
+    sim_params.gradient_mode = GradientMode::kAB;
+  }
+  auto ABc = q_sim_batch_->CalcBundledABcTrj(
+      x_trj_.topRows(T), u_trj_, ilqr_params_.std_u, sim_params,
+      ilqr_params_.bundle_params);
+  for (int t = 0; t < T; t++) {
+    if (ABc.n_valid_samples[t] == 0) {
+      throw std::runtime_error("No valid dynamics samples.");
+    }
+  }
+  A_list_ = std::move(ABc.A_list);
+  B_list_ = std::move(ABc.B_list);
+}
+
+bool IlqrSolver::BackwardPass(const double regularization) {
+  const int T = u_trj_.rows();
+  const auto &Q = cost_.get_Q();
+  const auto &R = cost_.get_R();
+  const auto &x_ref_trj = cost_.get_x_ref_trj();
+  const auto &u_ref_trj = cost_.get_u_ref_trj();
+
+  V_x_.noalias() =
+      2 * cost_.get_Qf() * (x_trj_.row(T) - x_ref_trj.row(T)).transpose();
+  V_xx_ = 2 * cost_.get_Qf();
+
+  for (int t = T - 1; t >= 0; t--) {
+    const auto &A = A_list_[t];
+    const auto &B = B_list_[t];
+    auto &K = K_list_[t];
+    auto k = k_trj_.row(t).transpose();
+
+    V_xx_A_.noalias() = V_xx_ * A;
+    V_xx_B_.noalias() = V_xx_ * B;
+    Q_x_.noalias() = 2 * Q * (x_trj_.row(t) - x_ref_trj.row(t)).transpose();
+    Q_x_.noalias() += A.transpose() * V_x_;
+    Q_u_.noalias() = 2 * R * (u_trj_.row(t) - u_ref_trj.row(t)).transpose();
+    Q_u_.noalias() += B.transpose() * V_x_;
+    Q_xx_ = 2 * Q;
+    Q_xx_.noalias() += A.transpose() * V_xx_A_;
+    Q_uu_ = 2 * R;
+    Q_uu_.noalias() += B.transpose() * V_xx_B_;
+    Q_ux_.noalias() = B.transpose() * V_xx_A_;
+
+    Q_uu_.diagonal().array() += regularization;
+    Q_uu_llt_.compute(Q_uu_);
+    Q_uu_.diagonal().array() -= regularization;
+    if (Q_uu_llt_.info() != Eigen::Success) {
+      return false;
+    }
+    k = -Q_uu_llt_.solve(Q_u_);
+    K = -Q_uu_llt_.solve(Q_ux_);
+
+    // The gains are computed with the regularized Q_uu, so the value
+    // function is updated without assuming Q_uu * k = -Q_u.
+    V_x_ = Q_x_;
+    V_x_.noalias() += K.transpose() * (Q_uu_ * k + Q_u_);
+    V_x_.noalias() += Q_ux_.transpose() * k;
+    V_xx_ = Q_xx_;
+    V_xx_.noalias() += K.transpose() * (Q_uu_ * K + Q_ux_);
+    V_xx_.noalias() += Q_ux_.transpose() * K;
+    V_xx_ = 0.5 * (V_xx_ + V_xx_.transpose()).eval();
+  }
+  return true;
+}
+
+bool IlqrSolver::ForwardPass() {
+  const int n_steps = ilqr_params_.n_line_search_steps;
+  std::vector<MatrixXd> u_trj_batch(n_steps);
+  double step_size = 1;
+  for (int i = 0; i < n_steps; i++) {
+    u_trj_batch[i] = u_trj_ + step_size * k_trj_;
+    step_size /= 2;
+  }
+
+  const MatrixXd x0_batch = x_trj_.row(0).replicate(n_steps, 1);
+  auto rollouts = q_sim_batch_->RolloutParallel(
+      x0_batch, u_trj_batch, K_list_, x_trj_, rollout_params_);
+
+  int i_best = -1;
+  double cost_best = costs_.back();
+  for (int i = 0; i < n_steps; i++) {
+    if (not rollouts.is_valid.row(i).all()) {
+      continue;
+    }
+    const double cost =
+        cost_.Eval(rollouts.x_trj_list[i], rollouts.u_trj_list[i]);
+    if (cost < cost_best) {
+      cost_best = cost;
+      i_best = i;
+    }
+  }
+  if (i_best < 0) {
+    return false;
+  }
+
+  x_trj_ = std::move(rollouts.x_trj_list[i_best]);
+  u_trj_ = std::move(rollouts.u_trj_list[i_best]);
+  if (ilqr_params_.std_u.size() == 0) {
+    A_list_ = std::move(rollouts.A_trj_list[i_best]);
+    B_list_ = std::move(rollouts.B_trj_list[i_best]);
+  }
+  costs_.push_back(cost_best);
+  return true;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <vector>
+
+#include "batch_quasistatic_simulator.h"
+#include "trajectory_cost.h"
+
+struct IlqrParameters {
+  int max_iterations{50};
+  // The solver stops when the relative decrease of the cost in an iteration
+  // is smaller than this.
+  double convergence_tolerance{1e-6};
+  // Step sizes 1, 1/2, ..., 1/2^(n_line_search_steps - 1) are tried in
+  // parallel in every forward pass.
+  int n_line_search_steps{8};
+  // Levenberg-Marquardt regularization added to Q_uu in the backward pass.
+  // It is increased by regularization_factor when Q_uu is not positive
+  // definite or the line search fails, and decreased after a successful
+  // iteration. The solver stops if it exceeds regularization_max.
+  double regularization_init{1e-6};
+  double regularization_factor{10};
+  double regularization_max{1e6};
+  // If std_u is empty, the dynamics is linearized with the exact A and B of
+  // the nominal rollout, or their Broyden approximation if the gradient_mode
+  // of the sim_params is GradientMode::kABBroyden. Otherwise the bundled A
+  // and B from CalcBundledABcTrj with std_u and bundle_params are used.
+  Eigen::VectorXd std_u;
+  BundledGradientParameters bundle_params;
+};
+
+/*
+ * iLQR with a QuadraticTrajectoryCost, where
+ *  - the backward pass is the Riccati recursion on preallocated
+ *    workspace matrices, and
+ *  - the forward pass rolls out all line search step sizes at once with
+ *    the feedback overload of BatchQuasistaticSimulator::RolloutParallel,
+ *    one rollout per worker. Without std_u, the rollouts also compute A
+ *    and B, and those of the accepted rollout are the next linearization.
+ * The step size with the lowest cost is taken if it decreases the cost.
+ * Objects never sleep, so that the rollouts and the linearization follow
+ * the same trajectory.
+ */
+class IlqrSolver {
+public:
+  IlqrSolver(const BatchQuasistaticSimulator &q_sim_batch,
+             const QuasistaticSimParameters &sim_params,
+             const IlqrParameters &ilqr_params,
+             const QuadraticTrajectoryCost &cost);
+
+  /*
+   * Optimizes the (T, n_u) input trajectory starting from u_trj_init, with
+   * the initial state x0. Throws if the rollout of u_trj_init fails.
+   * Returns the optimized input trajectory.
+   */
+  const Eigen::MatrixXd &
+  Solve(const Eigen::Ref<const Eigen::VectorXd> &x0,
+        const Eigen::Ref<const Eigen::MatrixXd> &u_trj_init);
+
+  const Eigen::MatrixXd &get_x_trj() const { return x_trj_; }
+  const Eigen::MatrixXd &get_u_trj() const { return u_trj_; }
+  // Feedback gains of the last backward pass, (n_u, n_q) each.
+  const std::vector<Eigen::MatrixXd> &get_K_list() const { return K_list_; }
+  // Cost before the first iteration, and after every successful one.
+  const std::vector<double> &get_cost_history() const { return costs_; }
+  QuadraticTrajectoryCost &get_mutable_cost() { return cost_; }
+
+private:
+  void Linearize();
+  /*
+   * Returns false if Q_uu is not positive definite at some time step.
+   */
+  bool BackwardPass(double regularization);
+  /*
+   * Returns true if a step size decreases the cost, in which case x_trj_,
+   * u_trj_ and costs_ are updated.
+   */
+  bool ForwardPass();
+
+  const BatchQuasistaticSimulator *q_sim_batch_;
+  const QuasistaticSimParameters sim_params_;
+  const IlqrParameters ilqr_params_;
+  // sim_params_ with the gradient mode of the rollouts.
+  const QuasistaticSimParameters rollout_params_;
+  QuadraticTrajectoryCost cost_;
+
+  Eigen::MatrixXd x_trj_;
+  Eigen::MatrixXd u_trj_;
+  std::vector<double> costs_;
+
+  // Linearization and gains along the nominal trajectory.
+  std::vector<Eigen::MatrixXd> A_list_;
+  std::vector<Eigen::MatrixXd> B_list_;
+  std::vector<Eigen::MatrixXd> K_list_;
+  Eigen::MatrixXd k_trj_;
+
+  // Workspace of the backward pass, sized once per Solve.
+  Eigen::VectorXd V_x_, Q_x_, Q_u_;
+  Eigen::MatrixXd V_xx_, Q_xx_, Q_uu_, Q_ux_, V_xx_A_, V_xx_B_;
+  Eigen::LLT<Eigen::MatrixXd> Q_uu_llt_;
+};
@@ -0,0 +1,96 @@
+#include <cmath>
+#include <limits>
+#include <random>
+
+#include "mppi_controller.h"
+
+using Eigen::MatrixXd;
+using Eigen::VectorXd;
+
+MppiController::MppiController(const BatchQuasistaticSimulator &q_sim_batch,
+                               const QuasistaticSimParameters &sim_params,
+                               const MppiParameters &mppi_params,
+                               TrajectoryCostFunction cost)
+    : q_sim_batch_(&q_sim_batch), sim_params_(sim_params),
+      mppi_params_(mppi_params), cost_(std::move(cost)) {
+  DRAKE_THROW_UNLESS(mppi_params_.n_samples > 0);
+  DRAKE_THROW_UNLESS(mppi_params_.temperature > 0);
+  if (mppi_params_.seed.has_value()) {
+    seed_ = static_cast<uint64_t>(mppi_params_.seed.value());
+  } else {
+    std::random_device rd;
+    seed_ = (static_cast<uint64_t>(rd()) << 32) | rd();
+  }
+}
+
+MppiController::MppiController(const BatchQuasistaticSimulator &q_sim_batch,
+                               const QuasistaticSimParameters &sim_params,
+                               const MppiParameters &mppi_params,
+                               const QuadraticTrajectoryCost &cost)
+    : MppiController(q_sim_batch, sim_params, mppi_params, nullptr) {
+  quadratic_cost_ = std::make_shared<QuadraticTrajectoryCost>(cost);
+  cost_ = [quadratic_cost = quadratic_cost_](const MatrixXd &x_trj,
+                                             const MatrixXd &u_trj) {
+    return quadratic_cost->Eval(x_trj, u_trj);
+  };
+}
+
+void MppiController::set_u_trj(
+    const Eigen::Ref<const Eigen::MatrixXd> &u_trj) {
+  DRAKE_THROW_UNLESS(u_trj.cols() == mppi_params_.std_u.size());
+  u_trj_ = u_trj;
+}
+
+const Eigen::MatrixXd &
+MppiController::Iterate(const Eigen::Ref<const Eigen::VectorXd> &x0) {
+  const int K = mppi_params_.n_samples;
+  const int T = u_trj_.rows();
+  const int n_u = u_trj_.cols();
+  DRAKE_THROW_UNLESS(T > 0);
+
+  // Noise trajectories. Every iteration uses a different key.
+  const CounterBasedGaussianSampler sampler(seed_ + 0x9E3779B97F4A7C15 *
+                                                        n_iterations_++);
+  std::vector<MatrixXd> du_trj_batch(K, MatrixXd(T, n_u));
+  std::vector<MatrixXd> u_trj_batch(K);
+  VectorXd z(n_u);
+  for (int k = 0; k < K; k++) {
+    for (int t = 0; t < T; t++) {
+      sampler.Sample(t, k, &z);
+      du_trj_batch[k].row(t) = mppi_params_.std_u.cwiseProduct(z).transpose();
+    }
+    u_trj_batch[k] = u_trj_ + du_trj_batch[k];
+  }
+
+  auto sim_params = sim_params_;
+  sim_params.gradient_mode = GradientMode::kNone;
+  const MatrixXd x0_batch = x0.transpose().replicate(K, 1);
+  const auto rollouts =
+      q_sim_batch_->RolloutParallel(x0_batch, u_trj_batch, sim_params);
+
+  costs_.resize(K);
+  for (int k = 0; k < K; k++) {
+    costs_[k] = rollouts.is_valid.row(k).all()
+                    ? cost_(rollouts.x_trj_list[k], u_trj_batch[k])
+                    : std::numeric_limits<double>::infinity();
+  }
+  const double cost_min = costs_.minCoeff();
+  if (not std::isfinite(cost_min)) {
+    throw std::runtime_error("All MPPI rollouts failed.");
+  }
+
+  weights_ = (-(costs_.array() - cost_min) / mppi_params_.temperature).exp();
+  weights_ /= weights_.sum();
+  for (int k = 0; k < K; k++) {
+    u_trj_ += weights_[k] * du_trj_batch[k];
+  }
+
+  return u_trj_;
+}
+
+void MppiController::ShiftWarmStart() {
+  ShiftTrajectory(&u_trj_);
+  if (quadratic_cost_) {
+    quadratic_cost_->ShiftReferences();
+  }
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <optional>
+
+#include "batch_quasistatic_simulator.h"
+#include "trajectory_cost.h"
+
+struct MppiParameters {
+  // Number of sampled input trajectories per iteration.
+  int n_samples{100};
+  // Standard deviation of the input perturbations, of length n_u.
+  Eigen::VectorXd std_u;
+  // lambda in the weights exp(-(J_k - min_k J_k) / lambda).
+  double temperature{1.0};
+  std::optional<int> seed;
+};
+
+/*
+ * Model predictive path integral control, as in
+ *  G. Williams et al., "Information theoretic MPC for model-based
+ *  reinforcement learning", ICRA 2017,
+ * with the rollouts computed by BatchQuasistaticSimulator::RolloutParallel.
+ *
+ * Every iteration perturbs the current input trajectory u_trj with n_samples
+ * Gaussian noise trajectories du_k, rolls them out from x0, and updates
+ *  u_trj += sum_k w_k * du_k, w_k ∝ exp(-(J_k - min_k J_k) / temperature),
+ * where J_k is the cost of rollout k. Rollouts that fail get zero weight.
+ *
+ * The noise of sample k at time step t is drawn from a
+ * CounterBasedGaussianSampler keyed by the seed and the iteration count, so
+ * that the noise, and hence the controller, is reproducible given a seed.
+ *
+ * The cost is evaluated on the calling thread, so that it can be a Python
+ * function. QuadraticTrajectoryCost is evaluated without calling back into
+ * Python.
+ */
+class MppiController {
+public:
+  MppiController(const BatchQuasistaticSimulator &q_sim_batch,
+                 const QuasistaticSimParameters &sim_params,
+                 const MppiParameters &mppi_params,
+                 TrajectoryCostFunction cost);
+
+  MppiController(const BatchQuasistaticSimulator &q_sim_batch,
+                 const QuasistaticSimParameters &sim_params,
+                 const MppiParameters &mppi_params,
+                 const QuadraticTrajectoryCost &cost);
+
+  /*
+   * Runs one MPPI iteration from x0, and returns the updated u_trj.
+   */
+  const Eigen::MatrixXd &Iterate(const Eigen::Ref<const Eigen::VectorXd> &x0);
+
+  /*
+   * Warm start for the next control step: drops the first input of u_trj,
+   * and repeats the last one. If the cost is a QuadraticTrajectoryCost, its
+   * references are shifted too.
+   */
+  void ShiftWarmStart();
+
+  void set_u_trj(const Eigen::Ref<const Eigen::MatrixXd> &u_trj);
+  const Eigen::MatrixXd &get_u_trj() const { return u_trj_; }
+
+  /*
+   * Costs and weights of the samples in the last iteration. The cost of a
+   * failed rollout is infinity.
+   */
+  const Eigen::VectorXd &get_costs() const { return costs_; }
+  const Eigen::VectorXd &get_weights() const { return weights_; }
+
+private:
+  const BatchQuasistaticSimulator *q_sim_batch_;
+  const QuasistaticSimParameters sim_params_;
+  const MppiParameters mppi_params_;
+  TrajectoryCostFunction cost_;
+  // Only set if the cost is a QuadraticTrajectoryCost.
+  std::shared_ptr<QuadraticTrajectoryCost> quadratic_cost_;
+
+  Eigen::MatrixXd u_trj_;
+  Eigen::VectorXd costs_;
+  Eigen::VectorXd weights_;
+  uint64_t seed_{0};
+  uint64_t n_iterations_{0};
+};
@@ -1,5 +1,6 @@
 #include <cmath>
 #include <iostream>
+#include <Eigen/SparseCholesky>
 #include <unsupported/Eigen/KroneckerProduct>
 
 #include "drake/common/drake_assert.h"
@@ -93,23 +94,28 @@ void QpDerivativesActive::UpdateProblem(
     B.row(i) = G.row(lambda_star_active_indices_[i]);
   }
 
-  // Form A_inv and find A using pseudo-inverse.
-  const auto n_A = n_z + n_la;
-  MatrixXd A_inv(n_A, n_A);
-  A_inv.setZero();
-  A_inv.topLeftCorner(n_z, n_z) = Q;
-  A_inv.topRightCorner(n_z, n_la) = B.transpose();
-  A_inv.bottomLeftCorner(n_la, n_z) = B;
-  const MatrixXd A = CalcInverseAndCheck(A_inv, tol_);
+  MatrixXd A_11, A_12;
+  is_kkt_sparse_ =
+      n_z >= sparse_min_n_z_ and CalcKktInverseSparse(Q, B, &A_11, &A_12);
+  if (not is_kkt_sparse_) {
+    // Form A_inv and find A using pseudo-inverse.
+    const auto n_A = n_z + n_la;
+    MatrixXd A_inv(n_A, n_A);
+    A_inv.setZero();
+    A_inv.topLeftCorner(n_z, n_z) = Q;
+    A_inv.topRightCorner(n_z, n_la) = B.transpose();
+    A_inv.bottomLeftCorner(n_la, n_z) = B;
+    const MatrixXd A = CalcInverseAndCheck(A_inv, tol_);
+    A_11 = A.topLeftCorner(n_z, n_z);
+    A_12 = A.topRightCorner(n_z, n_la);
+  }
 
   // Compute QP derivatives.
-  const MatrixXd &A_11 = A.topLeftCorner(n_z, n_z);
   DzDb_ = -A_11;
 
-  const MatrixXd DzDe_active = A.topRightCorner(n_z, n_la);
   DzDe_ = MatrixXd::Zero(n_z, n_l);
   for (int i = 0; i < n_la; i++) {
-    DzDe_.col(lambda_star_active_indices_[i]) = DzDe_active.col(i);
+    DzDe_.col(lambda_star_active_indices_[i]) = A_12.col(i);
   }
 
   if (not calc_G_grad) {
@@ -121,8 +127,58 @@ void QpDerivativesActive::UpdateProblem(
     return;
   }
 
-  const MatrixXd &A_12 = A.topRightCorner(n_z, n_la);
   DzDvecG_active_ =
       -Eigen::kroneckerProduct(A_11, lambda_star_active.transpose());
   DzDvecG_active_ -= Eigen::kroneckerProduct(z_star.transpose(), A_12);
 }
+
+bool QpDerivativesActive::CalcKktInverseSparse(
+    const Eigen::Ref<const Eigen::MatrixXd> &Q,
+    const Eigen::Ref<const Eigen::MatrixXd> &B, Eigen::MatrixXd *A_11_ptr,
+    Eigen::MatrixXd *A_12_ptr) const {
+  const auto n_z = Q.rows();
+  const auto n_la = B.rows();
+  const Eigen::SparseMatrix<double> Q_sparse = Q.sparseView();
+  const Eigen::SimplicialLLT<Eigen::SparseMatrix<double>> Q_llt(Q_sparse);
+  if (Q_llt.info() != Eigen::Success) {
+    return false;
+  }
+
+  // Y := Q^-1 * B.T.
+  const Eigen::SparseMatrix<double> B_sparse = B.sparseView();
+  const MatrixXd Y = Q_llt.solve(MatrixXd(B.transpose()));
+  MatrixXd S_inv(n_la, n_la);
+  if (n_la > 0) {
+    // The Schur complement S is singular if and only if the KKT matrix is,
+    // i.e. if the active constraints are linearly dependent. The
+    // pseudo-inverse of S does not give the pseudo-inverse of the KKT
+    // matrix, which is left to the dense path.
+    const MatrixXd S = B_sparse * Y;
+    const Eigen::CompleteOrthogonalDecomposition<MatrixXd> S_cod(S);
+    if (S_cod.rank() < n_la) {
+      return false;
+    }
+    S_inv = S_cod.solve(MatrixXd::Identity(n_la, n_la));
+  }
+  auto &A_11 = *A_11_ptr;
+  auto &A_12 = *A_12_ptr;
+  A_12 = Y * S_inv;
+  // A_11 = Q^-1 * (I - B.T * A_12.T).
+  MatrixXd R = -(B_sparse.transpose() * A_12.transpose());
+  R.diagonal().array() += 1;
+  A_11 = Q_llt.solve(R);
+
+  // The blocks of KKT * A - I, where the bottom blocks of A are A_12.T and
+  // -S^-1. The error is checked as in CalcInverseAndCheck, and the dense
+  // path is used if it is too large.
+  MatrixXd E_11 = Q_sparse * A_11 + B_sparse.transpose() * A_12.transpose();
+  E_11.diagonal().array() -= 1;
+  const MatrixXd E_12 = Q_sparse * A_12 - B_sparse.transpose() * S_inv;
+  const MatrixXd E_21 = B_sparse * A_11;
+  MatrixXd E_22 = B_sparse * A_12;
+  E_22.diagonal().array() -= 1;
+  const double error =
+      std::sqrt(E_11.squaredNorm() + E_12.squaredNorm() +
+                E_21.squaredNorm() + E_22.squaredNorm());
+  return error / (n_z + n_la) < tol_;
+}
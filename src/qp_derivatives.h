@@ -1,4 +1,5 @@
 #pragma once
+#include <limits>
 #include <vector>
 
 #include <Eigen/Dense>
@@ -37,7 +38,19 @@ public:
 
 class QpDerivativesActive : public QpDerivativesBase {
 public:
-  explicit QpDerivativesActive(double tol) : QpDerivativesBase(tol){};
+  /*
+   * For QPs with at least sparse_min_n_z variables, the KKT system is
+   * solved through the Schur complement of Q, using a sparse Cholesky
+   * factorization of Q, instead of a dense pseudo-inverse of the whole KKT
+   * matrix. Q is block-diagonal for quasistatic dynamics, and each row of G
+   * only involves the velocities of the bodies in one contact. The dense
+   * pseudo-inverse is used instead if Q is not positive definite, if the
+   * active constraints are linearly dependent, or if the Schur complement
+   * solution fails the error check of the dense path.
+   */
+  explicit QpDerivativesActive(
+      double tol, int sparse_min_n_z = std::numeric_limits<int>::max())
+      : QpDerivativesBase(tol), sparse_min_n_z_(sparse_min_n_z){};
 
   /*
    * For computing the derivatives of contact dynamics formulated as a QP,
@@ -56,8 +69,27 @@ public:
   get_DzDvecG_active() const {
     return {DzDvecG_active_, lambda_star_active_indices_};
   }
+  // True if the last UpdateProblem solved the KKT system through the
+  // Schur complement.
+  [[nodiscard]] bool is_kkt_sparse() const { return is_kkt_sparse_; }
 
 private:
+  /*
+   * Computes the top blocks A_11 and A_12 of the (pseudo-)inverse of the
+   * KKT matrix [Q, B.T; B, 0] as
+   *  A_12 = Q^-1 * B.T * S^-1, A_11 = Q^-1 * (I - B.T * A_12.T),
+   * where S = B * Q^-1 * B.T. Q is factorized, but not inverted. Returns
+   * false if Q is not positive definite, if S is rank-deficient, or if the
+   * relative error of KKT * A - I, normalized as in CalcInverseAndCheck,
+   * is not below tol_.
+   */
+  bool CalcKktInverseSparse(const Eigen::Ref<const Eigen::MatrixXd> &Q,
+                            const Eigen::Ref<const Eigen::MatrixXd> &B,
+                            Eigen::MatrixXd *A_11_ptr,
+                            Eigen::MatrixXd *A_12_ptr) const;
+
+  const int sparse_min_n_z_;
+  bool is_kkt_sparse_{false};
   Eigen::MatrixXd DzDvecG_active_;
   std::vector<int> lambda_star_active_indices_;
 };
@@ -1,13 +1,18 @@
 #include <pybind11/eigen.h>
+#include <pybind11/functional.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
 #include "batch_quasistatic_simulator.h"
 #include "contact_jacobian_calculator.h"
+#include "dynamics_cache.h"
+#include "ilqr_solver.h"
 #include "log_barrier_solver.h"
+#include "mppi_controller.h"
 #include "qp_derivatives.h"
 #include "quasistatic_simulator.h"
 #include "socp_derivatives.h"
+#include "trajectory_cache.h"
 
 namespace py = pybind11;
 
@@ -15,7 +20,8 @@ PYBIND11_MODULE(qsim_cpp, m) {
   py::enum_<GradientMode>(m, "GradientMode")
       .value("kNone", GradientMode::kNone)
       .value("kBOnly", GradientMode::kBOnly)
-      .value("kAB", GradientMode::kAB);
+      .value("kAB", GradientMode::kAB)
+      .value("kABBroyden", GradientMode::kABBroyden);
 
   py::enum_<ForwardDynamicsMode>(m, "ForwardDynamicsMode")
       .value("kQpMp", ForwardDynamicsMode::kQpMp)
@@ -42,6 +48,21 @@ PYBIND11_MODULE(qsim_cpp, m) {
         .def_readwrite("gradient_mode", &Class::gradient_mode)
         .def_readwrite("gradient_lstsq_tolerance",
                        &Class::gradient_lstsq_tolerance)
+        .def_readwrite("broyden_max_steps", &Class::broyden_max_steps)
+        .def_readwrite("collision_cache_margin",
+                       &Class::collision_cache_margin)
+        .def_readwrite("sparse_kkt_min_n_v", &Class::sparse_kkt_min_n_v)
+        .def_readwrite("use_contact_islands", &Class::use_contact_islands)
+        .def_readwrite("sleep_velocity_threshold",
+                       &Class::sleep_velocity_threshold)
+        .def_readwrite("sleep_min_steps", &Class::sleep_min_steps)
+        .def_readwrite("contact_reduction_max_points",
+                       &Class::contact_reduction_max_points)
+        .def_readwrite("contact_reduction_max_angle",
+                       &Class::contact_reduction_max_angle)
+        .def_readwrite("use_sphere_proxies", &Class::use_sphere_proxies)
+        .def_readwrite("sphere_proxy_refinement_band",
+                       &Class::sphere_proxy_refinement_band)
         .def_readwrite("nd_per_contact", &Class::nd_per_contact)
         .def_readwrite("use_free_solvers", &Class::use_free_solvers)
         .def("__copy__", [](const Class &self) { return Class(self); })
@@ -50,15 +71,41 @@ PYBIND11_MODULE(qsim_cpp, m) {
             [](const Class &self, py::dict) { return Class(self); }, "memo");
   }
 
+  {
+    using Class = CollisionFilterParameters;
+    py::class_<Class>(m, "CollisionFilterParameters")
+        .def(py::init<>())
+        .def_readwrite("auto_exclude", &Class::auto_exclude)
+        .def_readwrite("allowed_model_pairs", &Class::allowed_model_pairs)
+        .def_readwrite("excluded_model_pairs", &Class::excluded_model_pairs);
+  }
+
+  {
+    using Class = CollisionPairCache;
+    py::class_<Class>(m, "CollisionPairCache")
+        .def("get_n_full_queries", &Class::get_n_full_queries)
+        .def("get_n_cached_queries", &Class::get_n_cached_queries);
+  }
+
+  {
+    using Class = SphereProxyBroadphase;
+    py::class_<Class>(m, "SphereProxyBroadphase")
+        .def("get_n_culled_pairs", &Class::get_n_culled_pairs)
+        .def("get_n_exact_queries", &Class::get_n_exact_queries)
+        .def("get_n_approximated_pairs", &Class::get_n_approximated_pairs);
+  }
+
   {
     using Class = QuasistaticSimulator;
     py::class_<Class>(m, "QuasistaticSimulatorCpp")
         .def(py::init<std::string,
                       const std::unordered_map<std::string, Eigen::VectorXd> &,
                       const std::unordered_map<std::string, std::string> &,
-                      QuasistaticSimParameters>(),
+                      QuasistaticSimParameters,
+                      const CollisionFilterParameters &>(),
              py::arg("model_directive_path"), py::arg("robot_stiffness_str"),
-             py::arg("object_sdf_paths"), py::arg("sim_params"))
+             py::arg("object_sdf_paths"), py::arg("sim_params"),
+             py::arg("collision_filter") = CollisionFilterParameters())
         .def("update_mbp_positions",
              py::overload_cast<const ModelInstanceIndexToVecMap &>(
                  &Class::UpdateMbpPositions))
@@ -90,6 +137,11 @@ PYBIND11_MODULE(qsim_cpp, m) {
         .def("get_unactuated_models", &Class::get_unactuated_models)
         .def("get_query_object", &Class::get_query_object,
              py::return_value_policy::reference_internal)
+        .def("get_collision_pair_cache", &Class::get_collision_pair_cache,
+             py::return_value_policy::reference_internal)
+        .def("get_sphere_proxy_broadphase",
+             &Class::get_sphere_proxy_broadphase,
+             py::return_value_policy::reference_internal)
         .def("get_plant", &Class::get_plant,
              py::return_value_policy::reference_internal)
         .def("get_scene_graph", &Class::get_scene_graph,
@@ -103,6 +155,8 @@ PYBIND11_MODULE(qsim_cpp, m) {
         .def("num_unactuated_dofs", &Class::num_unactuated_dofs)
         .def("get_Dq_nextDq", &Class::get_Dq_nextDq)
         .def("get_Dq_nextDqa_cmd", &Class::get_Dq_nextDqa_cmd)
+        .def("get_gradient_staleness", &Class::get_gradient_staleness)
+        .def("reset_broyden", &Class::ResetBroyden)
         .def("get_velocity_indices", &Class::GetVelocityIndices)
         .def("get_position_indices", &Class::GetPositionIndices)
         .def("get_v_dict_from_vec", &Class::GetVdictFromVec)
@@ -117,29 +171,267 @@ PYBIND11_MODULE(qsim_cpp, m) {
              &Class::print_solver_info_for_default_params);
   }
 
+  py::enum_<SampleSequence>(m, "SampleSequence")
+      .value("kPseudoRandom", SampleSequence::kPseudoRandom)
+      .value("kRandomizedLattice", SampleSequence::kRandomizedLattice);
+
+  {
+    using Class = BundledGradientParameters;
+    py::class_<Class>(m, "BundledGradientParameters")
+        .def(py::init<>())
+        .def_readwrite("n_samples", &Class::n_samples)
+        .def_readwrite("seed", &Class::seed)
+        .def_readwrite("use_antithetic_samples", &Class::use_antithetic_samples)
+        .def_readwrite("use_control_variate", &Class::use_control_variate)
+        .def_readwrite("sample_sequence", &Class::sample_sequence)
+        .def_readwrite("use_adaptive_sampling", &Class::use_adaptive_sampling)
+        .def_readwrite("std_error_tolerance", &Class::std_error_tolerance)
+        .def_readwrite("n_samples_budget", &Class::n_samples_budget)
+        .def_readwrite("time_step_offset", &Class::time_step_offset);
+  }
+
+  {
+    using Class = BundledABcTrj;
+    py::class_<Class>(m, "BundledABcTrj")
+        .def_readonly("A_list", &Class::A_list)
+        .def_readonly("B_list", &Class::B_list)
+        .def_readonly("c_list", &Class::c_list)
+        .def_readonly("B_std_error_list", &Class::B_std_error_list)
+        .def_readonly("c_std_error_list", &Class::c_std_error_list)
+        .def_readonly("n_valid_samples", &Class::n_valid_samples)
+        .def_readonly("n_samples_drawn", &Class::n_samples_drawn);
+  }
+
+  {
+    using Class = BatchRollouts;
+    py::class_<Class>(m, "BatchRollouts")
+        .def_readonly("x_trj_list", &Class::x_trj_list)
+        .def_readonly("u_trj_list", &Class::u_trj_list)
+        .def_readonly("A_trj_list", &Class::A_trj_list)
+        .def_readonly("B_trj_list", &Class::B_trj_list)
+        .def_readonly("is_valid", &Class::is_valid)
+        .def_readonly("gradient_staleness", &Class::gradient_staleness);
+  }
+
+  {
+    using Class = DynamicsCacheParameters;
+    py::class_<Class>(m, "DynamicsCacheParameters")
+        .def(py::init<>())
+        .def_readwrite("max_bytes", &Class::max_bytes)
+        .def_readwrite("quantization", &Class::quantization)
+        .def_readwrite("n_shards", &Class::n_shards);
+  }
+
+  {
+    using Class = DynamicsCache;
+    py::class_<Class, std::shared_ptr<Class>>(m, "DynamicsCache")
+        .def(py::init<const DynamicsCacheParameters &>(), py::arg("params"))
+        .def("clear", &Class::Clear)
+        .def("get_n_hits", &Class::get_n_hits)
+        .def("get_n_misses", &Class::get_n_misses)
+        .def("get_n_entries", &Class::get_n_entries)
+        .def("get_n_bytes", &Class::get_n_bytes);
+  }
+
+  {
+    using Class = TrajectoryGradient;
+    py::class_<Class>(m, "TrajectoryGradient")
+        .def_readonly("cost", &Class::cost)
+        .def_readonly("Dcost_Du_trj", &Class::Dcost_Du_trj)
+        .def_readonly("Dcost_Dx0", &Class::Dcost_Dx0)
+        .def_readonly("is_valid", &Class::is_valid);
+  }
+
   {
     using Class = BatchQuasistaticSimulator;
     py::class_<Class>(m, "BatchQuasistaticSimulator")
         .def(py::init<std::string,
                       const std::unordered_map<std::string, Eigen::VectorXd> &,
                       const std::unordered_map<std::string, std::string> &,
-                      QuasistaticSimParameters>(),
+                      QuasistaticSimParameters,
+                      const CollisionFilterParameters &>(),
              py::arg("model_directive_path"), py::arg("robot_stiffness_str"),
-             py::arg("object_sdf_paths"), py::arg("sim_params"))
-        .def("calc_dynamics_parallel", &Class::CalcDynamicsParallel)
-        .def("calc_bundled_ABc_trj", &Class::CalcBundledABcTrj)
+             py::arg("object_sdf_paths"), py::arg("sim_params"),
+             py::arg("collision_filter") = CollisionFilterParameters())
+        .def("calc_dynamics_parallel",
+             py::overload_cast<const Eigen::Ref<const Eigen::MatrixXd> &,
+                               const Eigen::Ref<const Eigen::MatrixXd> &,
+                               const QuasistaticSimParameters &>(
+                 &Class::CalcDynamicsParallel, py::const_),
+             py::arg("x_batch"), py::arg("u_batch"), py::arg("sim_params"))
+        .def("calc_dynamics_parallel",
+             py::overload_cast<const Eigen::Ref<const Eigen::MatrixXd> &,
+                               const Eigen::Ref<const Eigen::MatrixXd> &,
+                               const QuasistaticSimParameters &,
+                               Eigen::Ref<Eigen::MatrixXd>,
+                               Eigen::Ref<Eigen::MatrixXd>,
+                               Eigen::Ref<Eigen::MatrixXd>,
+                               Eigen::Ref<VectorXb>>(
+                 &Class::CalcDynamicsParallel, py::const_),
+             py::arg("x_batch"), py::arg("u_batch"), py::arg("sim_params"),
+             py::arg("x_next_batch").noconvert(),
+             py::arg("A_batch").noconvert(), py::arg("B_batch").noconvert(),
+             py::arg("is_valid_batch").noconvert(),
+             "Writes the results in place. The output buffers are not "
+             "copied, so they need to be Fortran-ordered (column-major) "
+             "arrays of the exact dtype, e.g. "
+             "np.empty((n, n_q), order='F'), and is_valid_batch an array "
+             "of dtype bool. A C-ordered array is rejected with a type "
+             "error. A_batch and B_batch have shapes (n_q, n * n_q) and "
+             "(n_q, n * n_u), and can be empty if the gradient is not "
+             "computed.")
+        .def("rollout_parallel",
+             py::overload_cast<const Eigen::Ref<const Eigen::MatrixXd> &,
+                               const std::vector<Eigen::MatrixXd> &,
+                               const QuasistaticSimParameters &>(
+                 &Class::RolloutParallel, py::const_),
+             py::arg("x0_batch"), py::arg("u_trj_batch"), py::arg("sim_params"))
+        .def("rollout_parallel",
+             py::overload_cast<const Eigen::Ref<const Eigen::MatrixXd> &,
+                               const std::vector<Eigen::MatrixXd> &,
+                               const std::vector<Eigen::MatrixXd> &,
+                               const Eigen::Ref<const Eigen::MatrixXd> &,
+                               const QuasistaticSimParameters &>(
+                 &Class::RolloutParallel, py::const_),
+             py::arg("x0_batch"), py::arg("u_trj_batch"), py::arg("K_list"),
+             py::arg("x_trj_nominal"), py::arg("sim_params"))
+        .def("calc_bundled_ABc_trj",
+             py::overload_cast<const Eigen::Ref<const Eigen::MatrixXd> &,
+                               const Eigen::Ref<const Eigen::MatrixXd> &,
+                               const Eigen::Ref<const Eigen::VectorXd> &,
+                               const QuasistaticSimParameters &, int,
+                               std::optional<int>>(&Class::CalcBundledABcTrj,
+                                                   py::const_))
+        .def("calc_bundled_ABc_trj",
+             py::overload_cast<const Eigen::Ref<const Eigen::MatrixXd> &,
+                               const Eigen::Ref<const Eigen::MatrixXd> &,
+                               const Eigen::Ref<const Eigen::VectorXd> &,
+                               const QuasistaticSimParameters &,
+                               const BundledGradientParameters &>(
+                 &Class::CalcBundledABcTrj, py::const_),
+             py::arg("x_trj"), py::arg("u_trj"), py::arg("std_u"),
+             py::arg("sim_params"), py::arg("bundle_params"))
         .def("sample_gaussian_matrix", &Class::SampleGaussianMatrix)
         .def("calc_Bc_lstsq", &Class::CalcBcLstsq)
+        .def("calc_Bc_lstsq_trj", &Class::CalcBcLstsqTrj, py::arg("x_trj"),
+             py::arg("u_trj"), py::arg("std_u"), py::arg("sim_params"),
+             py::arg("bundle_params"), py::arg("ridge") = 0.)
         .def("get_num_max_parallel_executions",
              &Class::get_num_max_parallel_executions)
         .def("set_num_max_parallel_executions",
-             &Class::set_num_max_parallel_executions);
+             &Class::set_num_max_parallel_executions)
+        .def("calc_trajectory_gradient_parallel",
+             &Class::CalcTrajectoryGradientParallel, py::arg("x0_batch"),
+             py::arg("u_trj_batch"), py::arg("cost"), py::arg("sim_params"),
+             py::arg("checkpoint_interval") = 0)
+        .def("set_dynamics_cache", &Class::set_dynamics_cache,
+             py::arg("cache"))
+        .def("get_dynamics_cache", &Class::get_dynamics_cache);
+  }
+
+  {
+    using Class = QuadraticTrajectoryCost;
+    py::class_<Class>(m, "QuadraticTrajectoryCost")
+        .def(py::init<const Eigen::Ref<const Eigen::MatrixXd> &,
+                      const Eigen::Ref<const Eigen::MatrixXd> &,
+                      const Eigen::Ref<const Eigen::MatrixXd> &,
+                      const Eigen::Ref<const Eigen::MatrixXd> &,
+                      const Eigen::Ref<const Eigen::MatrixXd> &>(),
+             py::arg("Q"), py::arg("Qf"), py::arg("R"), py::arg("x_ref_trj"),
+             py::arg("u_ref_trj"))
+        .def("eval", &Class::Eval, py::arg("x_trj"), py::arg("u_trj"))
+        .def("shift_references", &Class::ShiftReferences)
+        .def("set_x_ref_trj", &Class::set_x_ref_trj)
+        .def("set_u_ref_trj", &Class::set_u_ref_trj)
+        .def("get_x_ref_trj", &Class::get_x_ref_trj)
+        .def("get_u_ref_trj", &Class::get_u_ref_trj);
+  }
+
+  {
+    using Class = MppiParameters;
+    py::class_<Class>(m, "MppiParameters")
+        .def(py::init<>())
+        .def_readwrite("n_samples", &Class::n_samples)
+        .def_readwrite("std_u", &Class::std_u)
+        .def_readwrite("temperature", &Class::temperature)
+        .def_readwrite("seed", &Class::seed);
+  }
+
+  {
+    using Class = MppiController;
+    py::class_<Class>(m, "MppiController")
+        .def(py::init<const BatchQuasistaticSimulator &,
+                      const QuasistaticSimParameters &, const MppiParameters &,
+                      const QuadraticTrajectoryCost &>(),
+             py::arg("q_sim_batch"), py::arg("sim_params"),
+             py::arg("mppi_params"), py::arg("cost"), py::keep_alive<1, 2>())
+        .def(py::init<const BatchQuasistaticSimulator &,
+                      const QuasistaticSimParameters &, const MppiParameters &,
+                      TrajectoryCostFunction>(),
+             py::arg("q_sim_batch"), py::arg("sim_params"),
+             py::arg("mppi_params"), py::arg("cost"), py::keep_alive<1, 2>())
+        .def("iterate", &Class::Iterate, py::arg("x0"))
+        .def("shift_warm_start", &Class::ShiftWarmStart)
+        .def("set_u_trj", &Class::set_u_trj)
+        .def("get_u_trj", &Class::get_u_trj)
+        .def("get_costs", &Class::get_costs)
+        .def("get_weights", &Class::get_weights);
+  }
+
+  {
+    using Class = IlqrParameters;
+    py::class_<Class>(m, "IlqrParameters")
+        .def(py::init<>())
+        .def_readwrite("max_iterations", &Class::max_iterations)
+        .def_readwrite("convergence_tolerance", &Class::convergence_tolerance)
+        .def_readwrite("n_line_search_steps", &Class::n_line_search_steps)
+        .def_readwrite("regularization_init", &Class::regularization_init)
+        .def_readwrite("regularization_factor", &Class::regularization_factor)
+        .def_readwrite("regularization_max", &Class::regularization_max)
+        .def_readwrite("std_u", &Class::std_u)
+        .def_readwrite("bundle_params", &Class::bundle_params);
+  }
+
+  {
+    using Class = IlqrSolver;
+    py::class_<Class>(m, "IlqrSolver")
+        .def(py::init<const BatchQuasistaticSimulator &,
+                      const QuasistaticSimParameters &, const IlqrParameters &,
+                      const QuadraticTrajectoryCost &>(),
+             py::arg("q_sim_batch"), py::arg("sim_params"),
+             py::arg("ilqr_params"), py::arg("cost"), py::keep_alive<1, 2>())
+        .def("solve", &Class::Solve, py::arg("x0"), py::arg("u_trj_init"))
+        .def("get_x_trj", &Class::get_x_trj)
+        .def("get_u_trj", &Class::get_u_trj)
+        .def("get_K_list", &Class::get_K_list)
+        .def("get_cost_history", &Class::get_cost_history)
+        .def("get_mutable_cost", &Class::get_mutable_cost,
+             py::return_value_policy::reference_internal);
+  }
+
+  {
+    using Class = TrajectoryCache;
+    py::class_<Class>(m, "TrajectoryCache")
+        .def(py::init<const BatchQuasistaticSimulator &,
+                      const QuasistaticSimParameters &>(),
+             py::arg("q_sim_batch"), py::arg("sim_params"),
+             py::keep_alive<1, 2>())
+        .def("rollout", &Class::Rollout, py::arg("x0"), py::arg("u_trj"))
+        .def("calc_bundled_ABc_trj", &Class::CalcBundledABcTrj,
+             py::arg("std_u"), py::arg("bundle_params"))
+        .def("shift_horizon", &Class::ShiftHorizon)
+        .def("get_x_trj", &Class::get_x_trj)
+        .def("get_u_trj", &Class::get_u_trj)
+        .def("get_time_step_offset", &Class::get_time_step_offset)
+        .def("get_n_steps_simulated", &Class::get_n_steps_simulated)
+        .def("get_n_steps_linearized", &Class::get_n_steps_linearized);
   }
 
   {
     using Class = QpDerivativesActive;
     py::class_<Class>(m, "QpDerivativesActive")
-        .def(py::init<double>(), py::arg("tol"))
+        .def(py::init<double, int>(), py::arg("tol"),
+             py::arg("sparse_min_n_z") = std::numeric_limits<int>::max())
         .def("UpdateProblem", &Class::UpdateProblem)
         .def("get_DzDe", &Class::get_DzDe)
         .def("get_DzDb", &Class::get_DzDb)
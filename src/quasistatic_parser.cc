@@ -46,6 +46,32 @@ QuasistaticParser::QuasistaticParser(const std::string &q_model_path) {
     }
   }
 
+  // Collision filters.
+  if (config["collision_filter"]) {
+    for (const auto &item : config["collision_filter"]) {
+      auto name = item.first.as<std::string>();
+      auto read_model_pairs =
+          [&](std::vector<std::pair<std::string, std::string>> *pairs) {
+            for (const auto &pair : item.second) {
+              DRAKE_THROW_UNLESS(pair.size() == 2);
+              pairs->emplace_back(pair[0].as<std::string>(),
+                                  pair[1].as<std::string>());
+            }
+          };
+      if (name == "auto_exclude") {
+        SetValue(collision_filter_.auto_exclude, item.second);
+      } else if (name == "allowed_model_pairs") {
+        read_model_pairs(&collision_filter_.allowed_model_pairs);
+      } else if (name == "excluded_model_pairs") {
+        read_model_pairs(&collision_filter_.excluded_model_pairs);
+      } else {
+        std::stringstream ss;
+        ss << "Unknown collision_filter entry " << name << ".";
+        throw std::logic_error(ss.str());
+      }
+    }
+  }
+
   // Simulation Parameters.
   for (const auto &item : config["quasistatic_sim_params"]) {
     auto name = item.first.as<std::string>();
@@ -76,11 +102,13 @@ QuasistaticParser::QuasistaticParser(const std::string &q_model_path) {
 
 std::unique_ptr<QuasistaticSimulator> QuasistaticParser::MakeSimulator() const {
   return std::make_unique<QuasistaticSimulator>(
-      model_directive_path_, robot_stiffness_, object_sdf_paths_, sim_params_);
+      model_directive_path_, robot_stiffness_, object_sdf_paths_, sim_params_,
+      collision_filter_);
 }
 
 [[nodiscard]] std::unique_ptr<BatchQuasistaticSimulator>
 QuasistaticParser::MakeBatchSimulator() const {
   return std::make_unique<BatchQuasistaticSimulator>(
-      model_directive_path_, robot_stiffness_, object_sdf_paths_, sim_params_);
+      model_directive_path_, robot_stiffness_, object_sdf_paths_, sim_params_,
+      collision_filter_);
 }
@@ -15,6 +15,12 @@ public:
   const QuasistaticSimParameters &get_sim_params() const {
     return sim_params_;
   };
+  void set_collision_filter(CollisionFilterParameters collision_filter) {
+    collision_filter_ = std::move(collision_filter);
+  }
+  const CollisionFilterParameters &get_collision_filter() const {
+    return collision_filter_;
+  }
   [[nodiscard]] std::unique_ptr<QuasistaticSimulator> MakeSimulator() const;
   [[nodiscard]] std::unique_ptr<BatchQuasistaticSimulator>
   MakeBatchSimulator() const;
@@ -24,4 +30,5 @@ private:
   std::unordered_map<std::string, Eigen::VectorXd> robot_stiffness_;
   std::unordered_map<std::string, std::string> object_sdf_paths_;
   QuasistaticSimParameters sim_params_;
+  CollisionFilterParameters collision_filter_;
 };
@@ -1,6 +1,10 @@
+#pragma once
+#include <limits>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include <Eigen/Dense>
 
@@ -25,8 +29,15 @@ using CollisionPair =
  * - kNone: do not compute gradient, just roll out the dynamics.
  * - kBOnly: only computes dfdu, where x_next = f(x, u).
  * - kAB: computes both dfdx and dfdu.
+ * - kABBroyden: computes both dfdx and dfdu exactly only when the contact
+ *   mode (the active set of the contact forces) differs from that of the
+ *   previous call, or when broyden_max_steps calls have passed since the
+ *   last exact computation. Otherwise, the previous dfdx and dfdu are
+ *   updated with the Broyden secant correction from the change of
+ *   (x, u, x_next) since the previous call. Only supported by kQpMp and
+ *   kSocpMp.
  */
-enum class GradientMode { kNone, kBOnly, kAB };
+enum class GradientMode { kNone, kBOnly, kAB, kABBroyden };
 
 enum class ForwardDynamicsMode {
   kQpMp,
@@ -92,6 +103,67 @@ gradient_lstsq_tolerance: float
    where A_sol is the least squares solution to (*), or the pseudo-inverse
    of A_inv.
    A warning is printed when the relative error is greater than this number.
+broyden_max_steps: int
+   Under GradientMode::kABBroyden, the maximum number of consecutive calls
+   which update the gradients with Broyden corrections, before they are
+   computed exactly again.
+collision_cache_margin: float
+   If positive, the candidate pairs of the signed distance query are reused
+   across time steps while every body has moved by less than about half of
+   this margin since the last full query, which is made with the contact
+   detection tolerance inflated by the margin. See CollisionPairCache.
+   0 disables the cache.
+sparse_kkt_min_n_v: int
+   The gradients of QP dynamics solve the KKT system of the QP through the
+   Schur complement of its block-diagonal Hessian, with a sparse Cholesky
+   factorization, when the system has at least this many velocities. Below
+   it, the dense pseudo-inverse of the KKT matrix is used. The dense path
+   is also used when the active constraints are linearly dependent, where
+   the two differ, or when the sparse solution fails the error check of
+   the dense path. The default, 24, is where the sparse solve overtakes
+   the dense one for Hessians made of 6x6 blocks, with or without the
+   gradients w.r.t. the constraints. Only the KKT solve is sparse: Q, J,
+   the inputs of the QP and SOCP solvers, and the gradients A and B are
+   still dense. Like gradient_lstsq_tolerance, this is read when the
+   simulator is constructed.
+use_contact_islands: bool
+   Under kQpMp and kSocpMp, partitions the model instances into islands
+   which are coupled by contacts, and solves one program per island. Islands
+   without contacts are solved directly, without calling a solver. v_star,
+   the contact forces and the gradients are the same as those of the
+   single program, up to solver tolerances.
+sleep_velocity_threshold: float
+   With use_contact_islands and GradientMode::kNone, an un-actuated model
+   instance whose velocities stay below this threshold in magnitude for
+   sleep_min_steps consecutive steps is put to sleep. Islands of sleeping
+   model instances keep still without being solved, and the contact forces
+   on them are reported as 0. An island wakes up when a model instance
+   which is awake, e.g. a robot, comes into contact with it. 0 disables
+   sleeping.
+sleep_min_steps: int
+   See sleep_velocity_threshold.
+contact_reduction_max_points: int
+   If positive, the signed distance pairs between every two bodies are
+   clustered by their normals, and at most this many pairs of each cluster
+   are kept: the deepest one and those farthest apart from each other. This
+   bounds the number of contacts of flat-on-flat contact, e.g. 4 keeps the
+   corners of a box face resting on a table. The gradients are those of the
+   reduced contacts. 0 disables contact reduction.
+contact_reduction_max_angle: float
+   Pairs between the same two bodies are in the same cluster if the angle
+   between their normals is less than this value, in radians.
+use_sphere_proxies: bool
+   If true, every collision geometry is covered by a few spheres, and the
+   collision candidates whose spheres are farther apart than the contact
+   detection tolerance are culled. Half spaces, and meshes which are not
+   OBJ files, have no spheres and are always queried exactly. See
+   SphereProxyBroadphase. Takes precedence over collision_cache_margin.
+sphere_proxy_refinement_band: float
+   With use_sphere_proxies, the pairs whose sphere distance is less than
+   this value are queried exactly, and the others are approximated by
+   their closest two spheres, including in the gradients. The default,
+   infinity, queries every pair which is not culled exactly, so that the
+   spheres only cull pairs. -infinity approximates every pair.
 */
 // TODO: the inputs to QuasistaticSimulator's constructor should be
 //  collected into a "QuasistaticPlantParameters" structure, which
@@ -111,6 +183,17 @@ struct QuasistaticSimParameters {
   bool calc_contact_forces{true};
   // -------------------------- CPP only --------------------------
   double gradient_lstsq_tolerance{0.3};
+  int broyden_max_steps{10};
+  double collision_cache_margin{0};
+  int sparse_kkt_min_n_v{24};
+  bool use_contact_islands{false};
+  double sleep_velocity_threshold{0};
+  int sleep_min_steps{10};
+  int contact_reduction_max_points{0};
+  double contact_reduction_max_angle{0.1};
+  bool use_sphere_proxies{false};
+  double sphere_proxy_refinement_band{
+      std::numeric_limits<double>::infinity()};
   // -------------------------- Not Set in YAML -------------------------
   ForwardDynamicsMode forward_mode{ForwardDynamicsMode::kQpMp};
   GradientMode gradient_mode{GradientMode::kNone};
@@ -120,5 +203,26 @@ struct QuasistaticSimParameters {
   bool use_free_solvers{false};
 };
 
+/*
+ * Collision filters applied to SceneGraph when a QuasistaticSimulator is
+ * constructed. Geometry pairs excluded here are never considered by the
+ * signed distance queries. Model instances are referred to by name, and
+ * static geometry belongs to "WorldModelInstance". A pair of the same name
+ * refers to the pairs within the model instance.
+ * auto_exclude: if true, the pairs which cannot give useful contact
+ *  constraints are excluded: those between bodies welded to each other,
+ *  e.g. static geometry and the links bolted to it, and those between the
+ *  links of the same robot.
+ * allowed_model_pairs: pairs of model instances left out of the
+ *  auto_exclude analysis, e.g. to keep the self-collisions of a robot.
+ * excluded_model_pairs: pairs of model instances whose geometries are not
+ *  checked against each other, in addition to those of auto_exclude.
+ */
+struct CollisionFilterParameters {
+  bool auto_exclude{true};
+  std::vector<std::pair<std::string, std::string>> allowed_model_pairs;
+  std::vector<std::pair<std::string, std::string>> excluded_model_pairs;
+};
+
 static char const *const kMultiBodyPlantName = "MultiBodyPlant";
 static char const *const kSceneGraphName = "SceneGraph";
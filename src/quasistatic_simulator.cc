@@ -1,7 +1,11 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
 #include <set>
 #include <vector>
 
 #include "drake/common/drake_path.h"
+#include "drake/geometry/collision_filter_declaration.h"
 #include "drake/multibody/parsing/parser.h"
 #include "drake/multibody/parsing/process_model_directives.h"
 #include "drake/solvers/mathematical_program.h"
@@ -27,12 +31,116 @@ using std::endl;
 using std::string;
 using std::vector;
 
+/*
+ * Excludes from SceneGraph's collision candidates the geometry pairs which
+ * cannot give useful contact constraints, found from the kinematic tree of
+ * the plant, and those of collision_filter.excluded_model_pairs. For every
+ * pair of model instances which is not in
+ * collision_filter.allowed_model_pairs, the analysis excludes the pairs
+ *  - between bodies which are welded to each other, directly or through
+ *    other bodies, e.g. static world geometry and the links bolted to it,
+ *  - between the links of the same robot, which are position-controlled.
+ */
+void ApplyCollisionFilters(
+    const drake::multibody::MultibodyPlant<double> &plant,
+    const std::set<ModelInstanceIndex> &robot_models,
+    const CollisionFilterParameters &collision_filter,
+    drake::geometry::SceneGraph<double> *scene_graph) {
+  using drake::multibody::Body;
+  using drake::multibody::BodyIndex;
+  auto get_model = [&](const std::string &model_name) {
+    return plant.GetModelInstanceByName(model_name);
+  };
+  auto get_geometries =
+      [&](const std::vector<const Body<double> *> &bodies) {
+        return plant.CollectRegisteredGeometries(bodies);
+      };
+  auto get_model_bodies = [&](const ModelInstanceIndex model) {
+    std::vector<const Body<double> *> bodies;
+    for (const auto &body_idx : plant.GetBodyIndices(model)) {
+      bodies.push_back(&plant.get_body(body_idx));
+    }
+    return bodies;
+  };
+  auto exclude = [&](const std::vector<const Body<double> *> &bodies_a,
+                     const std::vector<const Body<double> *> &bodies_b,
+                     const bool is_within) {
+    drake::geometry::CollisionFilterDeclaration declaration;
+    if (is_within) {
+      declaration.ExcludeWithin(get_geometries(bodies_a));
+    } else {
+      declaration.ExcludeBetween(get_geometries(bodies_a),
+                                 get_geometries(bodies_b));
+    }
+    scene_graph->collision_filter_manager().Apply(declaration);
+  };
+
+  if (collision_filter.auto_exclude) {
+    std::set<std::pair<ModelInstanceIndex, ModelInstanceIndex>> allowed;
+    for (const auto &[name_a, name_b] : collision_filter.allowed_model_pairs) {
+      const auto model_a = get_model(name_a);
+      const auto model_b = get_model(name_b);
+      allowed.emplace(std::min(model_a, model_b), std::max(model_a, model_b));
+    }
+
+    // The root of the welded subtree of a body: the farthest ancestor which
+    // is reached through weld joints only.
+    std::unordered_map<BodyIndex, BodyIndex> parents_by_weld;
+    for (int i = 0; i < plant.num_joints(); i++) {
+      const auto &joint = plant.get_joint(drake::multibody::JointIndex(i));
+      if (joint.num_velocities() == 0) {
+        parents_by_weld[joint.child_body().index()] =
+            joint.parent_body().index();
+      }
+    }
+    auto get_welded_root = [&](BodyIndex body_idx) {
+      for (auto it = parents_by_weld.find(body_idx);
+           it != parents_by_weld.end(); it = parents_by_weld.find(body_idx)) {
+        body_idx = it->second;
+      }
+      return body_idx;
+    };
+
+    // Bodies of every welded subtree, by model instance.
+    std::map<BodyIndex,
+             std::map<ModelInstanceIndex, std::vector<const Body<double> *>>>
+        welded_bodies;
+    for (int i = 0; i < plant.num_bodies(); i++) {
+      const auto &body = plant.get_body(BodyIndex(i));
+      welded_bodies[get_welded_root(body.index())][body.model_instance()]
+          .push_back(&body);
+    }
+    for (const auto &[root, bodies_by_model] : welded_bodies) {
+      for (auto it_a = bodies_by_model.begin(); it_a != bodies_by_model.end();
+           it_a++) {
+        for (auto it_b = it_a; it_b != bodies_by_model.end(); it_b++) {
+          if (allowed.count({it_a->first, it_b->first}) == 0) {
+            exclude(it_a->second, it_b->second, it_a == it_b);
+          }
+        }
+      }
+    }
+
+    for (const auto &model : robot_models) {
+      if (allowed.count({model, model}) == 0) {
+        exclude(get_model_bodies(model), {}, true);
+      }
+    }
+  }
+
+  for (const auto &[name_a, name_b] : collision_filter.excluded_model_pairs) {
+    exclude(get_model_bodies(get_model(name_a)),
+            get_model_bodies(get_model(name_b)), name_a == name_b);
+  }
+}
+
 void CreateMbp(
     drake::systems::DiagramBuilder<double> *builder,
     const string &model_directive_path,
     const std::unordered_map<string, VectorXd> &robot_stiffness_str,
     const std::unordered_map<string, string> &object_sdf_paths,
     const Eigen::Ref<const Vector3d> &gravity,
+    const CollisionFilterParameters &collision_filter,
     drake::multibody::MultibodyPlant<double> **plant,
     drake::geometry::SceneGraph<double> **scene_graph,
     std::set<ModelInstanceIndex> *robot_models,
@@ -77,13 +185,18 @@ void CreateMbp(
   // Gravity.
   (*plant)->mutable_gravity_field().set_gravity_vector(gravity);
   (*plant)->Finalize();
+
+  // Collision filters, which need the geometries registered by Finalize().
+  ApplyCollisionFilters(**plant, *robot_models, collision_filter,
+                        *scene_graph);
 }
 
 QuasistaticSimulator::QuasistaticSimulator(
     const std::string &model_directive_path,
     const std::unordered_map<std::string, Eigen::VectorXd> &robot_stiffness_str,
     const std::unordered_map<std::string, std::string> &object_sdf_paths,
-    QuasistaticSimParameters sim_params)
+    QuasistaticSimParameters sim_params,
+    const CollisionFilterParameters &collision_filter)
     : sim_params_(std::move(sim_params)),
       solver_scs_(std::make_unique<drake::solvers::ScsSolver>()),
       solver_osqp_(std::make_unique<drake::solvers::OsqpSolver>()),
@@ -96,8 +209,8 @@ QuasistaticSimulator::QuasistaticSimulator(
   auto builder = drake::systems::DiagramBuilder<double>();
 
   CreateMbp(&builder, model_directive_path, robot_stiffness_str,
-            object_sdf_paths, sim_params_.gravity, &plant_, &sg_,
-            &models_actuated_, &models_unactuated_, &robot_stiffness_);
+            object_sdf_paths, sim_params_.gravity, collision_filter, &plant_,
+            &sg_, &models_actuated_, &models_unactuated_, &robot_stiffness_);
   // All models instances.
   models_all_ = models_unactuated_;
   models_all_.insert(models_actuated_.begin(), models_actuated_.end());
@@ -156,7 +269,7 @@ QuasistaticSimulator::QuasistaticSimulator(
 
   // QP derivative.
   dqp_ = std::make_unique<QpDerivativesActive>(
-      sim_params_.gradient_lstsq_tolerance);
+      sim_params_.gradient_lstsq_tolerance, sim_params_.sparse_kkt_min_n_v);
   dsocp_ =
       std::make_unique<SocpDerivatives>(sim_params_.gradient_lstsq_tolerance);
 
@@ -398,6 +511,12 @@ void QuasistaticSimulator::Step(const ModelInstanceIndexToVecMap &q_a_cmd_dict,
   const auto q_dict = GetMbpPositions();
   auto q_next_dict(q_dict);
 
+  if (params.gradient_mode == GradientMode::kABBroyden and
+      fm != ForwardDynamicsMode::kQpMp and fm != ForwardDynamicsMode::kSocpMp) {
+    throw std::logic_error(
+        "GradientMode::kABBroyden is only supported by kQpMp and kSocpMp.");
+  }
+
   if (kPyramidModes.find(fm) != kPyramidModes.end()) {
     // Optimization coefficient matrices and vectors.
     MatrixXd Q, Jn, J;
@@ -419,8 +538,31 @@ void QuasistaticSimulator::Step(const ModelInstanceIndexToVecMap &q_a_cmd_dict,
         contact_results_.set_plant(plant_);
       }
 
-      BackwardQp(Q, tau_h, Jn, J, phi_constraints, q_dict, q_next_dict, v_star,
-                 beta_star, params);
+      // Same threshold as the active set of the QP derivatives. The contact
+      // mode is only needed to decide when the secant updates restart.
+      ContactMode contact_mode;
+      if (params.gradient_mode == GradientMode::kABBroyden) {
+        std::vector<bool> is_active(beta_star.size());
+        for (int i = 0; i < beta_star.size(); i++) {
+          is_active[i] = beta_star[i] > 0.1 * params.h;
+        }
+        contact_mode = CalcContactMode(is_active, params.nd_per_contact);
+      }
+      if (UpdateGradientsBroyden(q_dict, q_a_cmd_dict, q_next_dict,
+                                 contact_mode, params)) {
+        return;
+      }
+
+      try {
+        BackwardQp(Q, tau_h, Jn, J, phi_constraints, q_dict, q_next_dict,
+                   v_star, beta_star, GetExactGradientParams(params));
+      } catch (std::runtime_error &) {
+        // The gradients may be partially overwritten.
+        ResetBroyden();
+        throw;
+      }
+      SaveBroydenState(q_dict, q_a_cmd_dict, q_next_dict, contact_mode,
+                       params);
       return;
     }
 
@@ -462,8 +604,32 @@ void QuasistaticSimulator::Step(const ModelInstanceIndexToVecMap &q_a_cmd_dict,
         contact_results_.set_plant(plant_);
       }
 
-      BackwardSocp(Q, tau_h, J_list, e_list, phi, q_dict, q_next_dict, v_star,
-                   lambda_star_list, params);
+      // Same threshold as the active set of the SOCP derivatives.
+      // lambda_star_list is empty unless is_socp_calculating_dual(params).
+      ContactMode contact_mode;
+      if (params.gradient_mode == GradientMode::kABBroyden) {
+        std::vector<bool> is_active(lambda_star_list.size());
+        for (int i = 0; i < lambda_star_list.size(); i++) {
+          is_active[i] = lambda_star_list[i].norm() > 0.1 * params.h;
+        }
+        contact_mode = CalcContactMode(is_active, 1);
+      }
+      if (UpdateGradientsBroyden(q_dict, q_a_cmd_dict, q_next_dict,
+                                 contact_mode, params)) {
+        return;
+      }
+
+      try {
+        BackwardSocp(Q, tau_h, J_list, e_list, phi, q_dict, q_next_dict,
+                     v_star, lambda_star_list,
+                     GetExactGradientParams(params));
+      } catch (std::runtime_error &) {
+        // The gradients may be partially overwritten.
+        ResetBroyden();
+        throw;
+      }
+      SaveBroydenState(q_dict, q_a_cmd_dict, q_next_dict, contact_mode,
+                       params);
       return;
     }
 
@@ -488,7 +654,7 @@ void QuasistaticSimulator::CalcPyramidMatrices(
     const QuasistaticSimParameters &params, Eigen::MatrixXd *Q,
     Eigen::VectorXd *tau_h_ptr, Eigen::MatrixXd *Jn_ptr, Eigen::MatrixXd *J_ptr,
     Eigen::VectorXd *phi_ptr, Eigen::VectorXd *phi_constraints_ptr) const {
-  const auto sdps = CalcCollisionPairs(params.contact_detection_tolerance);
+  const auto sdps = CalcCollisionPairs(params);
   std::vector<MatrixXd> J_list;
   const auto n_d = params.nd_per_contact;
   cjc_->CalcJacobianAndPhiQp(context_plant_, sdps, n_d, phi_ptr, Jn_ptr,
@@ -516,7 +682,7 @@ void QuasistaticSimulator::CalcIcecreamMatrices(
     const QuasistaticSimParameters &params, Eigen::MatrixXd *Q,
     Eigen::VectorXd *tau_h, std::vector<Eigen::Matrix3Xd> *J_list,
     Eigen::VectorXd *phi) const {
-  const auto sdps = CalcCollisionPairs(params.contact_detection_tolerance);
+  const auto sdps = CalcCollisionPairs(params);
   cjc_->CalcJacobianAndPhiSocp(context_plant_, sdps, phi, J_list);
   CalcQAndTauH(q_dict, q_a_cmd_dict, tau_ext_dict, params.h, Q, tau_h,
                params.unactuated_mass_scale);
@@ -533,13 +699,203 @@ void QuasistaticSimulator::ForwardQp(
   auto &q_dict = *q_dict_ptr;
   const auto n_f = phi_constraints.size();
   const auto h = params.h;
+  const VectorXd e = phi_constraints / h;
+
+  if (not params.use_contact_islands) {
+    n_contact_islands_ = 0;
+    SolveQp(Q, tau_h, J, e, params, v_star_ptr, beta_star_ptr);
+  } else {
+    const auto n_d = params.nd_per_contact;
+    const auto islands = CalcContactIslands();
+    n_contact_islands_ = islands.size();
+    WakeUpModelsIfDiscontinuous(q_dict);
+    v_star_ptr->resize(n_v_);
+    *beta_star_ptr = VectorXd::Zero(n_f);
+    for (const auto &island : islands) {
+      const auto &idx_v = island.v_indices;
+      if (IsIslandAsleep(island, params)) {
+        (*v_star_ptr)(idx_v).setZero();
+        continue;
+      }
+      if (SolveFreeIsland(Q, tau_h, island, v_star_ptr)) {
+        continue;
+      }
+      std::vector<int> idx_f;
+      for (const auto i_c : island.contact_indices) {
+        for (int j = 0; j < n_d; j++) {
+          idx_f.push_back(i_c * n_d + j);
+        }
+      }
+      VectorXd v_star_i, beta_star_i;
+      SolveQp(Q(idx_v, idx_v), tau_h(idx_v), J(idx_f, idx_v), e(idx_f), params,
+              &v_star_i, &beta_star_i);
+      (*v_star_ptr)(idx_v) = v_star_i;
+      if (beta_star_i.size() > 0) {
+        (*beta_star_ptr)(idx_f) = beta_star_i;
+      }
+    }
+  }
+
+  // Update q_dict.
+  UpdateQdictFromV(*v_star_ptr, params, &q_dict);
+  if (params.use_contact_islands) {
+    UpdateSleepingModels(*v_star_ptr, q_dict, params);
+  }
+
+  // Update context_plant_ using the new q_dict.
+  UpdateMbpPositions(q_dict);
+}
+
+std::vector<QuasistaticSimulator::ContactIsland>
+QuasistaticSimulator::CalcContactIslands() const {
+  const auto &contact_pairs = cjc_->get_contact_pair_info_list();
+
+  // Model instances are numbered by their order in models_all_.
+  std::vector<const std::vector<int> *> model_v_indices;
+  std::vector<int> model_of_v(n_v_, -1);
+  for (const auto &model : models_all_) {
+    const auto &idx_v = velocity_indices_.at(model);
+    for (const auto i : idx_v) {
+      model_of_v[i] = model_v_indices.size();
+    }
+    model_v_indices.push_back(&idx_v);
+  }
+
+  // Union-find over model instances.
+  const int n_m = model_v_indices.size();
+  std::vector<int> parents(n_m);
+  std::iota(parents.begin(), parents.end(), 0);
+  auto find_root = [&parents](int i) {
+    while (parents[i] != i) {
+      parents[i] = parents[parents[i]];
+      i = parents[i];
+    }
+    return i;
+  };
+  for (const auto &cpi : contact_pairs) {
+    int root = -1;
+    for (const auto i : cpi.v_indices) {
+      const int r = find_root(model_of_v[i]);
+      if (root < 0) {
+        root = r;
+      } else if (r != root) {
+        parents[r] = root;
+      }
+    }
+  }
+
+  std::vector<drake::multibody::ModelInstanceIndex> models(models_all_.begin(),
+                                                          models_all_.end());
+
+  // Islands are ordered by the first model instance they contain. Model
+  //  instances without velocities do not form islands.
+  std::vector<ContactIsland> islands;
+  std::vector<int> island_of_root(n_m, -1);
+  for (int m = 0; m < n_m; m++) {
+    if (model_v_indices[m]->empty()) {
+      continue;
+    }
+    const int r = find_root(m);
+    if (island_of_root[r] < 0) {
+      island_of_root[r] = islands.size();
+      islands.emplace_back();
+    }
+    auto &island = islands[island_of_root[r]];
+    island.models.push_back(models[m]);
+    auto &v_indices = island.v_indices;
+    v_indices.insert(v_indices.end(), model_v_indices[m]->begin(),
+                     model_v_indices[m]->end());
+  }
+  for (auto &island : islands) {
+    std::sort(island.v_indices.begin(), island.v_indices.end());
+  }
+  for (int i_c = 0; i_c < contact_pairs.size(); i_c++) {
+    const auto &v_indices = contact_pairs[i_c].v_indices;
+    if (v_indices.empty()) {
+      continue;
+    }
+    const int r = find_root(model_of_v[v_indices.front()]);
+    islands[island_of_root[r]].contact_indices.push_back(i_c);
+  }
+  return islands;
+}
+
+bool QuasistaticSimulator::IsIslandAsleep(
+    const ContactIsland &island, const QuasistaticSimParameters &params) {
+  if (params.sleep_velocity_threshold <= 0 or
+      params.gradient_mode != GradientMode::kNone) {
+    return false;
+  }
+  for (const auto &model : island.models) {
+    const auto it = n_steps_at_rest_.find(model);
+    if (it == n_steps_at_rest_.end() or
+        it->second < params.sleep_min_steps) {
+      return false;
+    }
+  }
+  n_sleeping_islands_++;
+  return true;
+}
+
+void QuasistaticSimulator::WakeUpModelsIfDiscontinuous(
+    const ModelInstanceIndexToVecMap &q_dict) {
+  n_sleeping_islands_ = 0;
+  const VectorXd q = GetQVecFromDict(q_dict);
+  if (q.size() != sleep_q_next_.size() or q != sleep_q_next_) {
+    n_steps_at_rest_.clear();
+  }
+}
+
+void QuasistaticSimulator::UpdateSleepingModels(
+    const Eigen::Ref<const Eigen::VectorXd> &v_star,
+    const ModelInstanceIndexToVecMap &q_next_dict,
+    const QuasistaticSimParameters &params) {
+  if (params.sleep_velocity_threshold <= 0) {
+    return;
+  }
+  for (const auto &model : models_unactuated_) {
+    const auto &idx_v = velocity_indices_.at(model);
+    if (v_star(idx_v).lpNorm<Eigen::Infinity>() <
+        params.sleep_velocity_threshold) {
+      n_steps_at_rest_[model]++;
+    } else {
+      n_steps_at_rest_[model] = 0;
+    }
+  }
+  sleep_q_next_ = GetQVecFromDict(q_next_dict);
+}
+
+bool QuasistaticSimulator::SolveFreeIsland(
+    const Eigen::Ref<const Eigen::MatrixXd> &Q,
+    const Eigen::Ref<const Eigen::VectorXd> &tau_h,
+    const ContactIsland &island, Eigen::VectorXd *v_star_ptr) {
+  if (not island.contact_indices.empty()) {
+    return false;
+  }
+  // Without contacts, the program is unconstrained: Q * v = tau_h.
+  const auto &idx_v = island.v_indices;
+  const Eigen::LLT<MatrixXd> Q_llt(Q(idx_v, idx_v));
+  if (Q_llt.info() != Eigen::Success) {
+    return false;
+  }
+  (*v_star_ptr)(idx_v) = Q_llt.solve(tau_h(idx_v));
+  return true;
+}
+
+void QuasistaticSimulator::SolveQp(
+    const Eigen::Ref<const Eigen::MatrixXd> &Q,
+    const Eigen::Ref<const Eigen::VectorXd> &tau_h,
+    const Eigen::Ref<const Eigen::MatrixXd> &J,
+    const Eigen::Ref<const Eigen::VectorXd> &e,
+    const QuasistaticSimParameters &params, Eigen::VectorXd *v_star_ptr,
+    Eigen::VectorXd *beta_star_ptr) {
+  const auto n_f = e.size();
 
   // construct and solve MathematicalProgram.
   drake::solvers::MathematicalProgram prog;
-  auto v = prog.NewContinuousVariables(n_v_, "v");
+  auto v = prog.NewContinuousVariables(Q.rows(), "v");
   prog.AddQuadraticCost(Q, -tau_h, v, true);
 
-  const VectorXd e = phi_constraints / h;
   auto constraints = prog.AddLinearConstraint(
       -J, VectorXd::Constant(n_f, -std::numeric_limits<double>::infinity()), e,
       v);
@@ -555,40 +911,27 @@ void QuasistaticSimulator::ForwardQp(
   } else {
     *beta_star_ptr = Eigen::VectorXd(0);
   }
-
-  // Update q_dict.
-  UpdateQdictFromV(*v_star_ptr, params, &q_dict);
-
-  // Update context_plant_ using the new q_dict.
-  UpdateMbpPositions(q_dict);
 }
 
-void QuasistaticSimulator::ForwardSocp(
+void QuasistaticSimulator::SolveSocp(
     const Eigen::Ref<const Eigen::MatrixXd> &Q,
     const Eigen::Ref<const Eigen::VectorXd> &tau_h,
     const std::vector<Eigen::Matrix3Xd> &J_list,
-    const Eigen::Ref<const Eigen::VectorXd> &phi,
-    const QuasistaticSimParameters &params,
-    ModelInstanceIndexToVecMap *q_dict_ptr, Eigen::VectorXd *v_star_ptr,
-    std::vector<Eigen::VectorXd> *lambda_star_ptr,
-    std::vector<Eigen::VectorXd> *e_list) {
-  auto &q_dict = *q_dict_ptr;
-  VectorXd &v_star = *v_star_ptr;
-  const auto h = params.h;
-  const auto n_c = phi.size();
+    const std::vector<Eigen::VectorXd> &e_list,
+    const QuasistaticSimParameters &params, Eigen::VectorXd *v_star_ptr,
+    std::vector<Eigen::VectorXd> *lambda_star_ptr) {
+  const auto n_c = J_list.size();
 
   drake::solvers::MathematicalProgram prog;
-  auto v = prog.NewContinuousVariables(n_v_, "v");
+  auto v = prog.NewContinuousVariables(Q.rows(), "v");
 
   prog.AddQuadraticCost(Q, -tau_h, v, true);
 
   std::vector<drake::solvers::Binding<drake::solvers::LorentzConeConstraint>>
       constraints;
   for (int i_c = 0; i_c < n_c; i_c++) {
-    const double mu = cjc_->get_friction_coefficient(i_c);
-    e_list->emplace_back(Vector3d(phi[i_c] / mu / h, 0, 0));
     constraints.push_back(
-        prog.AddLorentzConeConstraint(J_list.at(i_c), e_list->back(), v));
+        prog.AddLorentzConeConstraint(J_list[i_c], e_list[i_c], v));
   }
 
   auto solver = PickBestSocpSolver(params);
@@ -598,17 +941,85 @@ void QuasistaticSimulator::ForwardSocp(
   }
 
   // Primal and dual solutions.
-  v_star = mp_result_.GetSolution(v);
+  *v_star_ptr = mp_result_.GetSolution(v);
+  lambda_star_ptr->clear();
   if (is_socp_calculating_dual(params)) {
     for (int i = 0; i < n_c; i++) {
       lambda_star_ptr->emplace_back(mp_result_.GetDualSolution(constraints[i]));
     }
+  }
+}
+
+void QuasistaticSimulator::ForwardSocp(
+    const Eigen::Ref<const Eigen::MatrixXd> &Q,
+    const Eigen::Ref<const Eigen::VectorXd> &tau_h,
+    const std::vector<Eigen::Matrix3Xd> &J_list,
+    const Eigen::Ref<const Eigen::VectorXd> &phi,
+    const QuasistaticSimParameters &params,
+    ModelInstanceIndexToVecMap *q_dict_ptr, Eigen::VectorXd *v_star_ptr,
+    std::vector<Eigen::VectorXd> *lambda_star_ptr,
+    std::vector<Eigen::VectorXd> *e_list) {
+  auto &q_dict = *q_dict_ptr;
+  VectorXd &v_star = *v_star_ptr;
+  const auto h = params.h;
+  const auto n_c = phi.size();
+
+  for (int i_c = 0; i_c < n_c; i_c++) {
+    const double mu = cjc_->get_friction_coefficient(i_c);
+    e_list->emplace_back(Vector3d(phi[i_c] / mu / h, 0, 0));
+  }
+
+  if (not params.use_contact_islands) {
+    n_contact_islands_ = 0;
+    SolveSocp(Q, tau_h, J_list, *e_list, params, &v_star, lambda_star_ptr);
   } else {
+    const auto islands = CalcContactIslands();
+    n_contact_islands_ = islands.size();
+    WakeUpModelsIfDiscontinuous(q_dict);
+    v_star.resize(n_v_);
     lambda_star_ptr->clear();
+    if (is_socp_calculating_dual(params)) {
+      lambda_star_ptr->resize(n_c);
+    }
+    for (const auto &island : islands) {
+      const auto &idx_v = island.v_indices;
+      if (IsIslandAsleep(island, params)) {
+        v_star(idx_v).setZero();
+        continue;
+      }
+      if (SolveFreeIsland(Q, tau_h, island, &v_star)) {
+        continue;
+      }
+      std::vector<Eigen::Matrix3Xd> J_list_i;
+      std::vector<Eigen::VectorXd> e_list_i;
+      for (const auto i_c : island.contact_indices) {
+        J_list_i.emplace_back(J_list[i_c](Eigen::all, idx_v));
+        e_list_i.push_back(e_list->at(i_c));
+      }
+      VectorXd v_star_i;
+      std::vector<Eigen::VectorXd> lambda_star_i;
+      SolveSocp(Q(idx_v, idx_v), tau_h(idx_v), J_list_i, e_list_i, params,
+                &v_star_i, &lambda_star_i);
+      v_star(idx_v) = v_star_i;
+      for (int i = 0; i < lambda_star_i.size(); i++) {
+        lambda_star_ptr->at(island.contact_indices[i]) =
+            std::move(lambda_star_i[i]);
+      }
+    }
+    // Contacts of sleeping islands, and contacts whose bodies have no
+    //  velocities, which are in no island.
+    for (auto &lambda_star : *lambda_star_ptr) {
+      if (lambda_star.size() == 0) {
+        lambda_star = Vector3d::Zero();
+      }
+    }
   }
 
   // Update q_dict.
   UpdateQdictFromV(v_star, params, &q_dict);
+  if (params.use_contact_islands) {
+    UpdateSleepingModels(v_star, q_dict, params);
+  }
 
   // Update context_plant_ using the new q_dict.
   UpdateMbpPositions(q_dict);
@@ -711,6 +1122,88 @@ void QuasistaticSimulator::ForwardLogIcecream(
   UpdateMbpPositions(q_dict);
 }
 
+QuasistaticSimParameters QuasistaticSimulator::GetExactGradientParams(
+    const QuasistaticSimParameters &params) {
+  auto params_exact = params;
+  if (params.gradient_mode == GradientMode::kABBroyden) {
+    params_exact.gradient_mode = GradientMode::kAB;
+  }
+  return params_exact;
+}
+
+QuasistaticSimulator::ContactMode
+QuasistaticSimulator::CalcContactMode(const std::vector<bool> &is_active,
+                                      const int n_per_contact) const {
+  const auto &contact_info_list = cjc_->get_contact_pair_info_list();
+  DRAKE_ASSERT(is_active.size() == contact_info_list.size() * n_per_contact);
+  ContactMode contact_mode;
+  contact_mode.reserve(is_active.size());
+  for (int i = 0; i < is_active.size(); i++) {
+    const auto &cpi = contact_info_list[i / n_per_contact];
+    contact_mode.emplace_back(CollisionPair(cpi.id_A, cpi.id_B),
+                              i % n_per_contact, is_active[i]);
+  }
+  std::sort(contact_mode.begin(), contact_mode.end());
+  return contact_mode;
+}
+
+bool QuasistaticSimulator::UpdateGradientsBroyden(
+    const ModelInstanceIndexToVecMap &q_dict,
+    const ModelInstanceIndexToVecMap &q_a_cmd_dict,
+    const ModelInstanceIndexToVecMap &q_next_dict,
+    const ContactMode &contact_mode, const QuasistaticSimParameters &params) {
+  if (params.gradient_mode != GradientMode::kABBroyden) {
+    // The gradients of other modes do not continue the secant updates.
+    ResetBroyden();
+    gradient_staleness_ = 0;
+    return false;
+  }
+
+  VectorXd z(n_q_ + n_v_a_);
+  z << GetQVecFromDict(q_dict), GetQaCmdVecFromDict(q_a_cmd_dict);
+
+  // The gradients are computed exactly at the first call, when the contact
+  // mode changes, and after broyden_max_steps corrections.
+  if (broyden_z_.size() != z.size() or
+      contact_mode != broyden_contact_mode_ or
+      gradient_staleness_ >= params.broyden_max_steps) {
+    return false;
+  }
+
+  // "Good" Broyden update of [A, B], which makes it consistent with the
+  // secant dq_next = [A, B] dz of the last two calls.
+  VectorXd q_next = GetQVecFromDict(q_next_dict);
+  const VectorXd dz = z - broyden_z_;
+  const double dz_squared_norm = dz.squaredNorm();
+  if (dz_squared_norm > 0) {
+    const VectorXd r = q_next - broyden_q_next_ -
+                       Dq_nextDq_ * dz.head(n_q_) -
+                       Dq_nextDqa_cmd_ * dz.tail(n_v_a_);
+    Dq_nextDq_ += r * dz.head(n_q_).transpose() / dz_squared_norm;
+    Dq_nextDqa_cmd_ += r * dz.tail(n_v_a_).transpose() / dz_squared_norm;
+  }
+  gradient_staleness_++;
+
+  broyden_z_ = std::move(z);
+  broyden_q_next_ = std::move(q_next);
+  return true;
+}
+
+void QuasistaticSimulator::SaveBroydenState(
+    const ModelInstanceIndexToVecMap &q_dict,
+    const ModelInstanceIndexToVecMap &q_a_cmd_dict,
+    const ModelInstanceIndexToVecMap &q_next_dict,
+    const ContactMode &contact_mode, const QuasistaticSimParameters &params) {
+  if (params.gradient_mode != GradientMode::kABBroyden) {
+    return;
+  }
+  broyden_z_.resize(n_q_ + n_v_a_);
+  broyden_z_ << GetQVecFromDict(q_dict), GetQaCmdVecFromDict(q_a_cmd_dict);
+  broyden_q_next_ = GetQVecFromDict(q_next_dict);
+  broyden_contact_mode_ = contact_mode;
+  gradient_staleness_ = 0;
+}
+
 void QuasistaticSimulator::BackwardQp(
     const Eigen::Ref<const Eigen::MatrixXd> &Q,
     const Eigen::Ref<const Eigen::VectorXd> &tau_h,
@@ -1026,6 +1519,10 @@ std::vector<std::vector<int>> CalcRelativeActiveIndicesList(
  *  relative_active_indices_list[i] stores the indices of its active rows,
  *  ranging from 0 to n_d - 1.
  *
+ * contact_pairs[i] is the ContactPairInfo of J_active_ad_list[i]. Only the
+ *  columns contact_pairs[i].v_indices of J_active_ad_list[i] can be
+ *  non-zero, and only their derivatives are read.
+ *
  * This function returns DG_active_vecDq, a matrix of shape
  *  (n_lambda_active * n_v, n_q).
  *
@@ -1034,10 +1531,11 @@ std::vector<std::vector<int>> CalcRelativeActiveIndicesList(
 template <Eigen::Index M>
 MatrixXd CalcDGactiveDqFromJActiveList(
     const std::vector<Eigen::Matrix<AutoDiffXd, M, -1>> &J_active_ad_list,
-    const std::vector<std::vector<int>> *relative_active_indices_list) {
+    const std::vector<ContactPairInfo<AutoDiffXd>> &contact_pairs,
+    const std::vector<std::vector<int>> *relative_active_indices_list,
+    const int n_q) {
   const int m = J_active_ad_list.front().rows();
   const auto n_v = J_active_ad_list.front().cols();
-  const auto n_q = J_active_ad_list.front()(0, 0).derivatives().size();
   int n_la; // Total number of active rows in G_active.
   if (relative_active_indices_list) {
     n_la = std::accumulate(
@@ -1051,28 +1549,32 @@ MatrixXd CalcDGactiveDqFromJActiveList(
   std::vector<int> row_indices_all(m);
   std::iota(row_indices_all.begin(), row_indices_all.end(), 0);
 
-  MatrixXd DvecG_activeDq(n_la * n_v, n_q);
-  for (int i_q = 0; i_q < n_q; i_q++) {
-    // Fill one column of DvecG_activeDq.
-    int i_G = 0; // row index into DvecG_activeDq.
-    for (int j = 0; j < n_v; j++) {
-      for (int i_c = 0; i_c < J_active_ad_list.size(); i_c++) {
-        const auto &J_i = J_active_ad_list[i_c];
-
-        // Find indices of active rows of the current J_i.
-        const std::vector<int> *row_indices{nullptr};
-        if (relative_active_indices_list) {
-          row_indices = &(relative_active_indices_list->at(i_c));
-        } else {
-          row_indices = &row_indices_all;
-        }
+  // vec(G_active) stacks the columns of G_active, so the derivative of
+  //  G_active(i_la, j) is row (j * n_la + i_la) of DvecG_activeDq.
+  MatrixXd DvecG_activeDq = MatrixXd::Zero(n_la * n_v, n_q);
+  int i_la_start = 0; // Active rows of the contacts before i_c.
+  for (int i_c = 0; i_c < J_active_ad_list.size(); i_c++) {
+    const auto &J_i = J_active_ad_list[i_c];
+
+    // Find indices of active rows of the current J_i.
+    const std::vector<int> *row_indices{nullptr};
+    if (relative_active_indices_list) {
+      row_indices = &(relative_active_indices_list->at(i_c));
+    } else {
+      row_indices = &row_indices_all;
+    }
 
-        for (const auto &i : *row_indices) {
-          DvecG_activeDq(i_G, i_q) = -J_i(i, j).derivatives()[i_q];
-          i_G += 1;
+    for (const auto j : contact_pairs[i_c].v_indices) {
+      int i_G = j * n_la + i_la_start; // row index into DvecG_activeDq.
+      for (const auto &i : *row_indices) {
+        const auto &DJDq = J_i(i, j).derivatives();
+        if (DJDq.size() > 0) {
+          DvecG_activeDq.row(i_G) = -DJDq.transpose();
         }
+        i_G += 1;
       }
     }
+    i_la_start += row_indices->size();
   }
   return DvecG_activeDq;
 }
@@ -1095,17 +1597,20 @@ Eigen::MatrixXd QuasistaticSimulator::CalcDfDxQp(
 
   /*----------------------------------------------------------------*/
   // e := phi_constraints / h.
-  MatrixXd De_active_Dq(n_la, n_q_);
+  // Row i of De_active_Dq is row i_c of Jn, converted in one call.
+  std::vector<int> active_rows_of_Jn(n_la);
   std::vector<int> active_contact_indices;
   for (int i = 0; i < n_la; i++) {
-    const size_t i_c = lambda_star_active_indices[i] / n_d;
-    De_active_Dq.row(i) = ConvertColVToQdot(q_dict, Jn.row(i_c)) / h;
+    const int i_c = lambda_star_active_indices[i] / n_d;
+    active_rows_of_Jn[i] = i_c;
 
     if (active_contact_indices.empty() or
         active_contact_indices.back() != i_c) {
       active_contact_indices.push_back(i_c);
     }
   }
+  const MatrixXd De_active_Dq =
+      ConvertColVToQdot(q_dict, Jn(active_rows_of_Jn, Eigen::all)) / h;
 
   Dv_nextDq += Dv_nextDe(Eigen::all, lambda_star_active_indices) * De_active_Dq;
 
@@ -1129,7 +1634,8 @@ Eigen::MatrixXd QuasistaticSimulator::CalcDfDxQp(
     const auto relative_active_indices_list =
         CalcRelativeActiveIndicesList(lambda_star_active_indices, n_d);
     const auto DvecG_activeDq = CalcDGactiveDqFromJActiveList<-1>(
-        J_active_ad_list, &relative_active_indices_list);
+        J_active_ad_list, cjc_ad_->get_contact_pair_info_list(),
+        &relative_active_indices_list, n_q_);
 
     Dv_nextDq += Dv_nextDvecG_active * DvecG_activeDq;
   }
@@ -1155,16 +1661,17 @@ Eigen::MatrixXd QuasistaticSimulator::CalcDfDxSocp(
 
   /*-------------------------------------------------------------------*/
   // e[i] := phi[i] / h / mu[i].
-  MatrixXd De_active_Dq(n_la, n_q_);
   // The vector e, as defined in the SocpDerivatives class, e is an (m * n_l)
   // vector, where n_l == J_list.size(). But we know that for every m-length
   // segment of e, only the first element is a function of q.
+  MatrixXd J0_active(n_la, n_v_);
   vector<int> active_indices_into_e;
   for (int i = 0; i < n_la; i++) {
     const int i_c = lambda_star_active_indices[i];
-    De_active_Dq.row(i) = ConvertColVToQdot(q_dict, J_list[i_c].row(0)) / h;
+    J0_active.row(i) = J_list[i_c].row(0);
     active_indices_into_e.push_back(i_c * m);
   }
+  const MatrixXd De_active_Dq = ConvertColVToQdot(q_dict, J0_active) / h;
 
   Dv_nextDq += Dv_nextDe(Eigen::all, active_indices_into_e) * De_active_Dq;
   /*----------------------------------------------------------------*/
@@ -1179,8 +1686,9 @@ Eigen::MatrixXd QuasistaticSimulator::CalcDfDxSocp(
     cjc_ad_->CalcJacobianAndPhiSocp(context_plant_ad_, sdps_active,
                                     &phi_active_ad, &J_active_ad_list);
 
-    const auto DvecG_activeDq =
-        CalcDGactiveDqFromJActiveList<3>(J_active_ad_list, nullptr);
+    const auto DvecG_activeDq = CalcDGactiveDqFromJActiveList<3>(
+        J_active_ad_list, cjc_ad_->get_contact_pair_info_list(), nullptr,
+        n_q_);
 
     Dv_nextDq += Dv_nextDvecG_active * DvecG_activeDq;
   }
@@ -1237,16 +1745,19 @@ Eigen::MatrixXd QuasistaticSimulator::CalcDfDxLogIcecream(
 
   //  cout << "DyDq\n" << DyDq << endl;
 
+  // Only the columns v_indices of the contact Jacobians are contracted.
+  const auto &contact_pairs = cjc_ad_->get_contact_pair_info_list();
   VectorX<AutoDiffXd> y(n_v_);
   y.setZero();
   for (int i_c = 0; i_c < n_c; i_c++) {
-    const auto &J = J_ad_list[i_c];
-    Vector3<AutoDiffXd> w = J * v_star;
+    const auto &v_indices = contact_pairs[i_c].v_indices;
+    const Matrix3X<AutoDiffXd> J = J_ad_list[i_c](Eigen::all, v_indices);
+    Vector3<AutoDiffXd> w = J * v_star(v_indices);
     w[0] += phi_ad[i_c] / h / cjc_->get_friction_coefficient(i_c);
     AutoDiffXd d = -w[0] * w[0] + w[1] * w[1] + w[2] * w[2];
     VectorX<AutoDiffXd> thing_to_add =
         2 * J.transpose() * Vector3<AutoDiffXd>(w[0] / d, -w[1] / d, -w[2] / d);
-    y += thing_to_add;
+    y(v_indices) += thing_to_add;
 
     //    const auto A_to_add = drake::math::ExtractGradient(thing_to_add);
     //    cout << i_c;
@@ -1286,14 +1797,18 @@ Eigen::MatrixXd QuasistaticSimulator::CalcDfDxLogPyramid(
   cjc_ad_->CalcJacobianAndPhiQp(context_plant_ad_, sdps, n_d, &phi_ad, &Jn_ad,
                                 &J_ad_list);
 
+  // Only the columns v_indices of the contact Jacobians are contracted.
+  const auto &contact_pairs = cjc_ad_->get_contact_pair_info_list();
   const auto n_c = sdps.size();
   VectorX<AutoDiffXd> y(n_v_);
   y.setZero();
   for (int i = 0; i < n_c; i++) {
+    const auto &v_indices = contact_pairs[i].v_indices;
+    const VectorXd v_star_i = v_star(v_indices);
     for (int j = 0; j < n_d; j++) {
-      const Eigen::RowVectorX<AutoDiffXd> &J_ij = J_ad_list[i].row(j);
-      const auto d = J_ij.dot(v_star) + phi_ad[i] / h;
-      y -= J_ij.transpose() / d;
+      const Eigen::RowVectorX<AutoDiffXd> J_ij = J_ad_list[i](j, v_indices);
+      const auto d = J_ij.dot(v_star_i) + phi_ad[i] / h;
+      y(v_indices) -= J_ij.transpose() / d;
     }
   }
 
@@ -1474,18 +1989,39 @@ QuasistaticSimulator::CalcSignedDistancePairsFromCollisionPairs(
   }
 
   for (const auto i : *active_contact_indices) {
-    const auto &collision_pair = collision_pairs_[i];
-    sdps_ad.push_back(query_object_ad_->ComputeSignedDistancePairClosestPoints(
-        collision_pair.first, collision_pair.second));
+    const auto &[id_A, id_B] = collision_pairs_[i];
+    // Pairs approximated by sphere proxies are differentiated through the
+    // same spheres.
+    auto sdp_ad =
+        sphere_proxies_.CalcApproximatedPair(*query_object_ad_, id_A, id_B);
+    if (sdp_ad) {
+      sdps_ad.emplace_back(std::move(*sdp_ad));
+      continue;
+    }
+    sdps_ad.push_back(
+        query_object_ad_->ComputeSignedDistancePairClosestPoints(id_A, id_B));
   }
   return sdps_ad;
 }
 
 std::vector<drake::geometry::SignedDistancePair<double>>
 QuasistaticSimulator::CalcCollisionPairs(
-    double contact_detection_tolerance) const {
-  auto sdps = query_object_->ComputeSignedDistancePairwiseClosestPoints(
-      contact_detection_tolerance);
+    const QuasistaticSimParameters &params) const {
+  std::vector<drake::geometry::SignedDistancePair<double>> sdps;
+  if (params.use_sphere_proxies) {
+    sdps = sphere_proxies_.ComputeSignedDistancePairs(
+        *query_object_, params.contact_detection_tolerance,
+        params.sphere_proxy_refinement_band);
+  } else {
+    sphere_proxies_.ClearApproximatedPairs();
+    sdps = collision_pair_cache_.ComputeSignedDistancePairs(
+        *query_object_, params.contact_detection_tolerance,
+        params.collision_cache_margin);
+  }
+  removed_collision_pairs_.clear();
+  if (params.contact_reduction_max_points > 0) {
+    sdps = ReduceContacts(std::move(sdps), params);
+  }
   collision_pairs_.clear();
 
   // Save collision pairs, which may later be used in gradient computation by
@@ -1496,6 +2032,92 @@ QuasistaticSimulator::CalcCollisionPairs(
   return sdps;
 }
 
+std::vector<drake::geometry::SignedDistancePair<double>>
+QuasistaticSimulator::ReduceContacts(
+    std::vector<drake::geometry::SignedDistancePair<double>> sdps,
+    const QuasistaticSimParameters &params) const {
+  const auto &inspector = query_object_->inspector();
+  auto get_body_index = [&](drake::geometry::GeometryId g_id) {
+    return plant_->GetBodyFromFrameId(inspector.GetFrameId(g_id))->index();
+  };
+  const double cos_max_angle = std::cos(params.contact_reduction_max_angle);
+  const int n_max = params.contact_reduction_max_points;
+
+  // Clusters of indices into sdps, and the body pairs and normals, pointing
+  //  from the body with the smaller index, of their first pairs.
+  std::vector<std::vector<int>> clusters;
+  std::vector<std::pair<int, int>> cluster_bodies;
+  std::vector<Vector3d> cluster_normals;
+  std::vector<Vector3d> p_WC_list;
+  for (int i = 0; i < sdps.size(); i++) {
+    const auto &sdp = sdps[i];
+    const int body_A = get_body_index(sdp.id_A);
+    const int body_B = get_body_index(sdp.id_B);
+    const std::pair<int, int> bodies(std::min(body_A, body_B),
+                                     std::max(body_A, body_B));
+    const Vector3d nhat = body_A < body_B ? sdp.nhat_BA_W : -sdp.nhat_BA_W;
+    p_WC_list.emplace_back(query_object_->GetPoseInWorld(sdp.id_A) *
+                           sdp.p_ACa);
+
+    int i_cluster = 0;
+    while (i_cluster < clusters.size() and
+           (cluster_bodies[i_cluster] != bodies or
+            cluster_normals[i_cluster].dot(nhat) < cos_max_angle)) {
+      i_cluster++;
+    }
+    if (i_cluster == clusters.size()) {
+      clusters.emplace_back();
+      cluster_bodies.push_back(bodies);
+      cluster_normals.push_back(nhat);
+    }
+    clusters[i_cluster].push_back(i);
+  }
+
+  std::vector<bool> is_kept(sdps.size(), true);
+  for (const auto &cluster : clusters) {
+    if (cluster.size() <= n_max) {
+      continue;
+    }
+    // Farthest point sampling, starting from the deepest pair.
+    std::vector<int> kept{*std::min_element(
+        cluster.begin(), cluster.end(), [&sdps](int a, int b) {
+          return sdps[a].distance < sdps[b].distance;
+        })};
+    // d_min is -1 for the kept pairs, so that a pair is not kept twice if
+    //  the remaining points coincide with kept ones.
+    std::vector<double> d_min(cluster.size());
+    for (int k = 0; k < cluster.size(); k++) {
+      d_min[k] = cluster[k] == kept[0]
+                     ? -1
+                     : (p_WC_list[cluster[k]] - p_WC_list[kept[0]]).norm();
+    }
+    while (kept.size() < n_max) {
+      const int k_far =
+          std::max_element(d_min.begin(), d_min.end()) - d_min.begin();
+      kept.push_back(cluster[k_far]);
+      d_min[k_far] = -1;
+      const auto &p_WC_far = p_WC_list[cluster[k_far]];
+      for (int k = 0; k < cluster.size(); k++) {
+        d_min[k] =
+            std::min(d_min[k], (p_WC_list[cluster[k]] - p_WC_far).norm());
+      }
+    }
+    for (const auto i : cluster) {
+      is_kept[i] = std::find(kept.begin(), kept.end(), i) != kept.end();
+    }
+  }
+
+  std::vector<drake::geometry::SignedDistancePair<double>> sdps_reduced;
+  for (int i = 0; i < sdps.size(); i++) {
+    if (is_kept[i]) {
+      sdps_reduced.emplace_back(std::move(sdps[i]));
+    } else {
+      removed_collision_pairs_.emplace_back(sdps[i].id_A, sdps[i].id_B);
+    }
+  }
+  return sdps_reduced;
+}
+
 ModelInstanceIndexToMatrixMap
 QuasistaticSimulator::CalcScaledMassMatrix(double h,
                                            double unactuated_mass_scale) const {
@@ -1,5 +1,8 @@
 #pragma once
 #include <iostream>
+#include <map>
+#include <tuple>
+#include <vector>
 
 #include "drake/multibody/plant/externally_applied_spatial_force.h"
 #include "drake/solvers/gurobi_solver.h"
@@ -8,10 +11,12 @@
 #include "drake/solvers/scs_solver.h"
 #include "drake/solvers/osqp_solver.h"
 
+#include "collision_pair_cache.h"
 #include "contact_jacobian_calculator.h"
 #include "log_barrier_solver.h"
 #include "qp_derivatives.h"
 #include "socp_derivatives.h"
+#include "sphere_proxy_broadphase.h"
 
 /*
  * Denotes whether the indices are those of a model's configuration vector
@@ -27,7 +32,8 @@ public:
       const std::unordered_map<std::string, Eigen::VectorXd>
           &robot_stiffness_str,
       const std::unordered_map<std::string, std::string> &object_sdf_paths,
-      QuasistaticSimParameters sim_params);
+      QuasistaticSimParameters sim_params,
+      const CollisionFilterParameters &collision_filter = {});
 
   void UpdateMbpPositions(const ModelInstanceIndexToVecMap &q_dict);
   void UpdateMbpPositions(const Eigen::Ref<const Eigen::VectorXd> &q);
@@ -102,6 +108,14 @@ public:
     return *query_object_;
   };
 
+  const CollisionPairCache &get_collision_pair_cache() const {
+    return collision_pair_cache_;
+  }
+
+  const SphereProxyBroadphase &get_sphere_proxy_broadphase() const {
+    return sphere_proxies_;
+  }
+
   const drake::multibody::MultibodyPlant<double> &get_plant() const {
     return *plant_;
   }
@@ -125,8 +139,42 @@ public:
   int num_actuated_dofs() const { return n_v_a_; };
   int num_unactuated_dofs() const { return n_v_u_; };
 
-  Eigen::MatrixXd get_Dq_nextDq() const { return Dq_nextDq_; };
-  Eigen::MatrixXd get_Dq_nextDqa_cmd() const { return Dq_nextDqa_cmd_; };
+  const Eigen::MatrixXd &get_Dq_nextDq() const { return Dq_nextDq_; };
+  const Eigen::MatrixXd &get_Dq_nextDqa_cmd() const { return Dq_nextDqa_cmd_; };
+
+  /*
+   * Under GradientMode::kABBroyden, the number of Broyden corrections
+   * applied to get_Dq_nextDq() and get_Dq_nextDqa_cmd() since they were last
+   * computed exactly. 0 means that they are exact.
+   */
+  int get_gradient_staleness() const { return gradient_staleness_; }
+
+  /*
+   * Number of contact islands of the last call under kQpMp or kSocpMp with
+   * use_contact_islands, including islands without contacts. 0 otherwise.
+   */
+  int get_n_contact_islands() const { return n_contact_islands_; }
+
+  /*
+   * Number of islands of the last call with use_contact_islands which were
+   * asleep, and therefore not solved. See sleep_velocity_threshold.
+   */
+  int get_n_sleeping_islands() const { return n_sleeping_islands_; }
+
+  /*
+   * Geometry pairs within the contact detection tolerance which were
+   * removed by contact reduction in the last call. See
+   * contact_reduction_max_points.
+   */
+  const std::vector<CollisionPair> &get_removed_collision_pairs() const {
+    return removed_collision_pairs_;
+  }
+
+  /*
+   * Makes the next call under GradientMode::kABBroyden compute the gradients
+   * exactly, e.g. at the start of a new trajectory.
+   */
+  void ResetBroyden() { broyden_z_.resize(0); }
 
   std::unordered_map<drake::multibody::ModelInstanceIndex, std::vector<int>>
   GetVelocityIndices() const {
@@ -276,8 +324,28 @@ private:
                                      const ModelInstanceIndexToVecMap &q_dict,
                                      Eigen::MatrixXd *B_ptr) const;
 
+  /*
+   * Signed distance pairs within params.contact_detection_tolerance, after
+   * contact reduction if it is enabled. Saves their geometry pairs into
+   * collision_pairs_, and the pairs removed by contact reduction into
+   * removed_collision_pairs_.
+   */
   std::vector<drake::geometry::SignedDistancePair<double>>
-  CalcCollisionPairs(double contact_detection_tolerance) const;
+  CalcCollisionPairs(const QuasistaticSimParameters &params) const;
+
+  /*
+   * Contact reduction. The signed distance pairs between the same two
+   * bodies are clustered greedily, in their order, by the angle between
+   * their normals and the normal of the first pair of each cluster. A
+   * cluster with more than params.contact_reduction_max_points pairs keeps
+   * that many of them: the deepest pair, and then repeatedly the pair whose
+   * contact point is farthest from the contact points kept so far, which
+   * picks the extremes of the contact patch. The kept pairs stay in their
+   * original order.
+   */
+  std::vector<drake::geometry::SignedDistancePair<double>>
+  ReduceContacts(std::vector<drake::geometry::SignedDistancePair<double>> sdps,
+                 const QuasistaticSimParameters &params) const;
 
   std::vector<drake::geometry::SignedDistancePair<drake::AutoDiffXd>>
   CalcSignedDistancePairsFromCollisionPairs(
@@ -314,6 +382,78 @@ private:
       const std::vector<Eigen::VectorXd> &lambda_star, double h,
       drake::multibody::ContactResults<double> *contact_results);
 
+  /*
+   * Model instances in models_all_ which are coupled by the contacts of
+   * the last call to cjc_, directly or through other model instances. The
+   * programs of different islands share no velocities and can be solved
+   * separately, as Q is block-diagonal over model instances.
+   */
+  struct ContactIsland {
+    // Velocities of the model instances in the island, in increasing order.
+    std::vector<int> v_indices;
+    // Contacts in the island, in increasing order.
+    std::vector<int> contact_indices;
+    std::vector<drake::multibody::ModelInstanceIndex> models;
+  };
+  std::vector<ContactIsland> CalcContactIslands() const;
+
+  /*
+   * If the island has no contacts and its block of Q is positive definite,
+   * writes the minimizer of its unconstrained program into the island's
+   * velocities of v_star and returns true. Returns false otherwise.
+   */
+  static bool SolveFreeIsland(const Eigen::Ref<const Eigen::MatrixXd> &Q,
+                              const Eigen::Ref<const Eigen::VectorXd> &tau_h,
+                              const ContactIsland &island,
+                              Eigen::VectorXd *v_star_ptr);
+
+  /*
+   * Sleeping: an island is asleep, and its velocities are fixed at 0
+   * without solving its program, if all its model instances have been at
+   * rest for at least params.sleep_min_steps consecutive steps. A model
+   * instance is at rest in a step if all its velocities are below
+   * params.sleep_velocity_threshold in magnitude. Actuated model instances
+   * are never at rest, so an island is woken up as soon as a robot is
+   * within contact_detection_tolerance of one of its objects.
+   *
+   * The counts only carry over between consecutive steps, i.e. they are
+   * cleared if a step does not start from where the previous one ended.
+   * Sleeping is disabled when gradients are requested.
+   */
+  bool IsIslandAsleep(const ContactIsland &island,
+                      const QuasistaticSimParameters &params);
+  void WakeUpModelsIfDiscontinuous(const ModelInstanceIndexToVecMap &q_dict);
+  void UpdateSleepingModels(const Eigen::Ref<const Eigen::VectorXd> &v_star,
+                            const ModelInstanceIndexToVecMap &q_next_dict,
+                            const QuasistaticSimParameters &params);
+
+  /*
+   * Solves the QP
+   *  min. 0.5 * v.T * Q * v - tau_h.T * v s.t. -J * v <= e,
+   * and returns its primal solution and the multipliers beta_star of the
+   * constraints.
+   */
+  void SolveQp(const Eigen::Ref<const Eigen::MatrixXd> &Q,
+               const Eigen::Ref<const Eigen::VectorXd> &tau_h,
+               const Eigen::Ref<const Eigen::MatrixXd> &J,
+               const Eigen::Ref<const Eigen::VectorXd> &e,
+               const QuasistaticSimParameters &params,
+               Eigen::VectorXd *v_star_ptr, Eigen::VectorXd *beta_star_ptr);
+
+  /*
+   * Solves the SOCP
+   *  min. 0.5 * v.T * Q * v - tau_h.T * v s.t. J_i * v + e_i in Q^3,
+   * and returns its primal solution, and the duals of the cone constraints
+   * if is_socp_calculating_dual(params).
+   */
+  void SolveSocp(const Eigen::Ref<const Eigen::MatrixXd> &Q,
+                 const Eigen::Ref<const Eigen::VectorXd> &tau_h,
+                 const std::vector<Eigen::Matrix3Xd> &J_list,
+                 const std::vector<Eigen::VectorXd> &e_list,
+                 const QuasistaticSimParameters &params,
+                 Eigen::VectorXd *v_star_ptr,
+                 std::vector<Eigen::VectorXd> *lambda_star_ptr);
+
   void ForwardQp(const Eigen::Ref<const Eigen::MatrixXd> &Q,
                  const Eigen::Ref<const Eigen::VectorXd> &tau_h,
                  const Eigen::Ref<const Eigen::MatrixXd> &J,
@@ -395,6 +535,49 @@ private:
                            const QuasistaticSimParameters &params,
                            const Eigen::LLT<Eigen::MatrixXd> &H_llt);
 
+  /*
+   * The active set of the contact forces, as (geometry pair, index of the
+   * constraint within the contact, is active) for every constraint, sorted,
+   * so that it does not depend on the order of the contacts.
+   */
+  using ContactMode = std::vector<std::tuple<CollisionPair, int, bool>>;
+
+  /*
+   * is_active[i] tells if constraint i, the (i % n_per_contact)-th
+   * constraint of contact i / n_per_contact, is active.
+   */
+  ContactMode CalcContactMode(const std::vector<bool> &is_active,
+                              int n_per_contact) const;
+
+  /*
+   * Under GradientMode::kABBroyden, updates Dq_nextDq_ and Dq_nextDqa_cmd_
+   * with a Broyden correction and returns true, unless they need to be
+   * computed exactly, in which case it returns false and the exact
+   * gradients need to be followed by SaveBroydenState. Always returns false
+   * under other gradient modes.
+   */
+  bool UpdateGradientsBroyden(const ModelInstanceIndexToVecMap &q_dict,
+                              const ModelInstanceIndexToVecMap &q_a_cmd_dict,
+                              const ModelInstanceIndexToVecMap &q_next_dict,
+                              const ContactMode &contact_mode,
+                              const QuasistaticSimParameters &params);
+
+  /*
+   * Under GradientMode::kABBroyden, makes the exact Dq_nextDq_ and
+   * Dq_nextDqa_cmd_ of this call the start of the next secant updates.
+   */
+  void SaveBroydenState(const ModelInstanceIndexToVecMap &q_dict,
+                        const ModelInstanceIndexToVecMap &q_a_cmd_dict,
+                        const ModelInstanceIndexToVecMap &q_next_dict,
+                        const ContactMode &contact_mode,
+                        const QuasistaticSimParameters &params);
+
+  /*
+   * params, with GradientMode::kABBroyden replaced by GradientMode::kAB.
+   */
+  static QuasistaticSimParameters
+  GetExactGradientParams(const QuasistaticSimParameters &params);
+
   bool is_socp_calculating_dual(const QuasistaticSimParameters& params) const {
     return params.calc_contact_forces or
         params.gradient_mode != GradientMode::kNone;
@@ -426,6 +609,20 @@ private:
   Eigen::MatrixXd Dq_nextDq_;
   Eigen::MatrixXd Dq_nextDqa_cmd_;
 
+  // State of GradientMode::kABBroyden: (q, u), q_next and the contact mode
+  // of the previous call. broyden_z_ is empty if there is no previous call.
+  Eigen::VectorXd broyden_z_;
+  Eigen::VectorXd broyden_q_next_;
+  ContactMode broyden_contact_mode_;
+  int gradient_staleness_{0};
+
+  int n_contact_islands_{0};
+
+  // Sleeping state, see IsIslandAsleep.
+  std::map<drake::multibody::ModelInstanceIndex, int> n_steps_at_rest_;
+  Eigen::VectorXd sleep_q_next_;
+  int n_sleeping_islands_{0};
+
   // Systems.
   std::unique_ptr<drake::systems::Diagram<double>> diagram_;
   drake::multibody::MultibodyPlant<double> *plant_{nullptr};
@@ -450,6 +647,9 @@ private:
   // Internal state (for interfacing with QuasistaticSystem).
   const drake::geometry::QueryObject<double> *query_object_{nullptr};
   mutable std::vector<CollisionPair> collision_pairs_;
+  mutable std::vector<CollisionPair> removed_collision_pairs_;
+  mutable CollisionPairCache collision_pair_cache_;
+  mutable SphereProxyBroadphase sphere_proxies_;
   mutable const drake::geometry::QueryObject<drake::AutoDiffXd>
       *query_object_ad_{nullptr};
   mutable drake::multibody::ContactResults<double> contact_results_;
@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+#include "drake/common/drake_throw.h"
+
+#include "randomized_lattice_rule.h"
+
+double InverseNormalCdf(const double p) {
+  static constexpr double a[] = {-3.969683028665376e+01, 2.209460984245205e+02,
+                                 -2.759285104469687e+02, 1.383577518672690e+02,
+                                 -3.066479806614716e+01, 2.506628277459239e+00};
+  static constexpr double b[] = {-5.447609879822406e+01, 1.615858368580409e+02,
+                                 -1.556989798598866e+02, 6.680131188771972e+01,
+                                 -1.328068155288572e+01};
+  static constexpr double c[] = {-7.784894002430293e-03, -3.223964580411365e-01,
+                                 -2.400758277161838e+00, -2.549732539343734e+00,
+                                 4.374664141464968e+00,  2.938163982698783e+00};
+  static constexpr double d[] = {7.784695709041462e-03, 3.224671290700398e-01,
+                                 2.445134137142996e+00, 3.754408661907416e+00};
+  constexpr double p_low = 0.02425;
+
+  double x;
+  if (p < p_low) {
+    const double q = std::sqrt(-2 * std::log(p));
+    x = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+        ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+  } else if (p <= 1 - p_low) {
+    const double q = p - 0.5;
+    const double r = q * q;
+    x = (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) *
+        q /
+        (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+  } else {
+    const double q = std::sqrt(-2 * std::log1p(-p));
+    x = -(((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q +
+          c[5]) /
+        ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+  }
+
+  // Halley refinement.
+  const double e = 0.5 * std::erfc(-x / M_SQRT2) - p;
+  const double u = e * std::sqrt(2 * M_PI) * std::exp(x * x / 2);
+  return x - u / (1 + x * u / 2);
+}
+
+KorobovLattice::KorobovLattice(const int n_points, const int dim)
+    : n_points_(n_points) {
+  DRAKE_THROW_UNLESS(n_points > 0);
+  DRAKE_THROW_UNLESS(dim > 0);
+
+  // Evenly spaced candidates in [1, n_points), skipping the ones which are
+  // not co-prime with n_points.
+  const int stride = std::max(1, (n_points - 1) / kMaxCandidates);
+  double p2_min = std::numeric_limits<double>::infinity();
+  z_ = MakeGenerator(1, n_points, dim);
+  for (int a = 1; a < n_points; a += stride) {
+    if (std::gcd(a, n_points) != 1) {
+      continue;
+    }
+    auto z = MakeGenerator(a, n_points, dim);
+    const double p2 = CalcP2(z, n_points);
+    if (p2 < p2_min) {
+      p2_min = p2;
+      z_ = std::move(z);
+    }
+  }
+}
+
+std::vector<uint64_t> KorobovLattice::MakeGenerator(const uint64_t a,
+                                                    const int n_points,
+                                                    const int dim) {
+  std::vector<uint64_t> z(dim);
+  z[0] = 1 % n_points;
+  for (int j = 1; j < dim; j++) {
+    z[j] = z[j - 1] * a % n_points;
+  }
+  return z;
+}
+
+double KorobovLattice::CalcP2(const std::vector<uint64_t> &z,
+                              const int n_points) {
+  // P_2 = -1 + 1 / n * sum_k prod_j (1 + 2 pi^2 B_2({k z_j / n})), where
+  // B_2(x) = x^2 - x + 1 / 6 is the Bernoulli polynomial of degree 2.
+  double sum = 0;
+  for (int k = 0; k < n_points; k++) {
+    double prod = 1;
+    for (const auto z_j : z) {
+      const double x = static_cast<double>(k * z_j % n_points) / n_points;
+      prod *= 1 + 2 * M_PI * M_PI * (x * x - x + 1. / 6);
+    }
+    sum += prod;
+  }
+  return sum / n_points - 1;
+}
+
+void KorobovLattice::Point(const int i, Eigen::VectorXd *x_ptr) const {
+  auto &x = *x_ptr;
+  x.resize(z_.size());
+  for (size_t j = 0; j < z_.size(); j++) {
+    x[j] = static_cast<double>(i * z_[j] % n_points_) / n_points_;
+  }
+}
+
+RandomizedLatticeGaussianSampler::RandomizedLatticeGaussianSampler(
+    const int n_points, const int dim, const uint64_t seed)
+    : lattice_(n_points, dim), key_(Philox4x32::MakeKey(seed)) {}
+
+void RandomizedLatticeGaussianSampler::Sample(const uint32_t i_step,
+                                              const uint32_t i_sample,
+                                              Eigen::VectorXd *z_ptr) const {
+  DRAKE_THROW_UNLESS(static_cast<int>(i_sample) < lattice_.get_n_points());
+  auto &z = *z_ptr;
+  const auto n = z.size();
+  Eigen::VectorXd x;
+  lattice_.Point(i_sample, &x);
+  DRAKE_THROW_UNLESS(x.size() == n);
+
+  // The last word of the counter is 1, so that the shifts do not overlap
+  // with the random numbers of CounterBasedGaussianSampler.
+  for (Eigen::Index i = 0; i < n; i += 4) {
+    const auto r = Philox4x32::Generate(
+        {static_cast<uint32_t>(i / 4), 0, i_step, 1}, key_);
+    for (int j = 0; j < 4 and i + j < n; j++) {
+      double u = x[i + j] + Philox4x32::ToUniform(r[j]);
+      u -= std::floor(u);
+      // Keeps u in the open interval (0, 1).
+      u = std::clamp(u, 0.5 / (1ull << 32), 1 - 0.5 / (1ull << 32));
+      z[i + j] = InverseNormalCdf(u);
+    }
+  }
+}
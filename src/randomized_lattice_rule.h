@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "counter_based_random.h"
+
+/*
+ * Inverse of the cumulative distribution function of the standard Gaussian
+ * distribution, p in (0, 1). Uses the rational approximation by P. J. Acklam,
+ * followed by one step of Halley's method, which brings the relative error
+ * close to machine precision.
+ */
+double InverseNormalCdf(double p);
+
+/*
+ * Rank-1 Korobov lattice rule with n_points points in [0, 1)^dim:
+ *  x_i = frac(i * z / n_points), z = (1, a, a^2, ..., a^(dim-1)) mod n_points.
+ * The multiplier a is chosen to minimize the P_2 criterion (the worst-case
+ * error in the unweighted Korobov space with smoothness 2), over at most
+ * kMaxCandidates multipliers co-prime with n_points.
+ */
+class KorobovLattice {
+public:
+  KorobovLattice(int n_points, int dim);
+
+  /*
+   * Fills x_ptr with the fractional parts of i * z / n_points.
+   */
+  void Point(int i, Eigen::VectorXd *x_ptr) const;
+
+  int get_n_points() const { return n_points_; }
+  const std::vector<uint64_t> &get_generator() const { return z_; }
+
+  static constexpr int kMaxCandidates{256};
+
+private:
+  static std::vector<uint64_t> MakeGenerator(uint64_t a, int n_points,
+                                             int dim);
+  static double CalcP2(const std::vector<uint64_t> &z, int n_points);
+
+  const int n_points_;
+  std::vector<uint64_t> z_;
+};
+
+/*
+ * Randomized quasi-Monte Carlo Gaussian samples. At time step i_step, sample
+ * i_sample is the i_sample-th point of a Korobov lattice, shifted modulo 1 by
+ * a uniform random vector that only depends on (seed, i_step)
+ * (Cranley-Patterson rotation), and mapped through InverseNormalCdf.
+ *
+ * Every time step gets an independent randomization of the same point set,
+ * so the average over the samples of a time step is an unbiased estimate.
+ * i_sample needs to be smaller than n_points.
+ */
+class RandomizedLatticeGaussianSampler : public GaussianSampler {
+public:
+  RandomizedLatticeGaussianSampler(int n_points, int dim, uint64_t seed);
+
+  void Sample(uint32_t i_step, uint32_t i_sample,
+              Eigen::VectorXd *z_ptr) const override;
+
+private:
+  const KorobovLattice lattice_;
+  const Philox4x32::Key key_;
+};
@@ -0,0 +1,397 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#include "drake/common/autodiff.h"
+#include "drake/geometry/shape_specification.h"
+
+#include "sphere_proxy_broadphase.h"
+
+using drake::Vector3;
+using drake::geometry::GeometryId;
+using drake::geometry::QueryObject;
+using drake::geometry::SignedDistancePair;
+using Eigen::Matrix3Xd;
+using Eigen::Vector3d;
+using Eigen::VectorXd;
+
+namespace {
+// Upper bound on the number of spheres of a box or a cylinder.
+constexpr int kMaxSpheresPerGeometry = 64;
+
+/*
+ * Builds the spheres which cover a shape, in the frame of the shape.
+ */
+class SphereProxyReifier : public drake::geometry::ShapeReifier {
+public:
+  // Returns false if the shape has no proxy.
+  bool Calc(const drake::geometry::Shape &shape, Matrix3Xd *p_GS_ptr,
+            VectorXd *radii_ptr) {
+    p_GS_ = p_GS_ptr;
+    radii_ = radii_ptr;
+    is_valid_ = true;
+    shape.Reify(this);
+    return is_valid_;
+  }
+
+private:
+  using ShapeReifier::ImplementGeometry;
+
+  void ImplementGeometry(const drake::geometry::Sphere &sphere,
+                         void *) override {
+    *p_GS_ = Matrix3Xd::Zero(3, 1);
+    *radii_ = VectorXd::Constant(1, sphere.radius());
+  }
+  void ImplementGeometry(const drake::geometry::Box &box, void *) override {
+    CoverBox(box.size());
+  }
+  void ImplementGeometry(const drake::geometry::Cylinder &cylinder,
+                         void *) override {
+    // Cells of length close to the diameter, along the z axis.
+    const double r = cylinder.radius();
+    const double L = cylinder.length();
+    const int n = std::clamp<int>(std::ceil(L / (2 * r)), 1,
+                                  kMaxSpheresPerGeometry);
+    const double l = L / n;
+    p_GS_->setZero(3, n);
+    for (int k = 0; k < n; k++) {
+      (*p_GS_)(2, k) = -L / 2 + (k + 0.5) * l;
+    }
+    *radii_ = VectorXd::Constant(n, std::hypot(r, l / 2));
+  }
+  void ImplementGeometry(const drake::geometry::Capsule &capsule,
+                         void *) override {
+    // Centers at most r apart on the axis, so that every point within r of
+    // the axis is within hypot(r, spacing / 2) of a center.
+    const double r = capsule.radius();
+    const double L = capsule.length();
+    const int n = std::clamp<int>(std::ceil(L / r), 0,
+                                  kMaxSpheresPerGeometry - 1) + 1;
+    const double spacing = n > 1 ? L / (n - 1) : 0;
+    p_GS_->setZero(3, n);
+    for (int k = 0; k < n; k++) {
+      (*p_GS_)(2, k) = n > 1 ? -L / 2 + k * spacing : 0;
+    }
+    *radii_ = VectorXd::Constant(n, std::hypot(r, spacing / 2));
+  }
+  void ImplementGeometry(const drake::geometry::Ellipsoid &ellipsoid,
+                         void *) override {
+    *p_GS_ = Matrix3Xd::Zero(3, 1);
+    *radii_ = VectorXd::Constant(
+        1, std::max({ellipsoid.a(), ellipsoid.b(), ellipsoid.c()}));
+  }
+  void ImplementGeometry(const drake::geometry::Mesh &mesh,
+                         void *) override {
+    CoverMesh(mesh.filename(), mesh.scale());
+  }
+  void ImplementGeometry(const drake::geometry::Convex &convex,
+                         void *) override {
+    CoverMesh(convex.filename(), convex.scale());
+  }
+  void ThrowUnsupportedGeometry(const std::string &) override {
+    is_valid_ = false;
+  }
+
+  /*
+   * Covers the axis-aligned bounding box of the vertices of an OBJ file,
+   * which contains the mesh and its convex hull.
+   */
+  void CoverMesh(const std::string &filename, const double scale) {
+    std::ifstream obj(filename);
+    const double inf = std::numeric_limits<double>::infinity();
+    Vector3d p_min = Vector3d::Constant(inf);
+    Vector3d p_max = Vector3d::Constant(-inf);
+    std::string line;
+    while (std::getline(obj, line)) {
+      if (line.rfind("v ", 0) != 0) {
+        continue;
+      }
+      std::istringstream ss(line.substr(2));
+      Vector3d p;
+      if (ss >> p[0] >> p[1] >> p[2]) {
+        p_min = p_min.cwiseMin(scale * p);
+        p_max = p_max.cwiseMax(scale * p);
+      }
+    }
+    if (not(p_min.array() <= p_max.array()).all()) {
+      // Not an OBJ file, or no vertices.
+      is_valid_ = false;
+      return;
+    }
+    CoverBox(p_max - p_min, (p_min + p_max) / 2);
+  }
+
+  void CoverBox(const Vector3d &size,
+                const Vector3d &center = Vector3d::Zero()) {
+    if (size.maxCoeff() <= 0) {
+      *p_GS_ = center;
+      *radii_ = VectorXd::Zero(1);
+      return;
+    }
+    // Nearly cubic cells, whose edges are at least the smallest dimension
+    // of the box. Flat boxes, e.g. of planar meshes, get at most
+    // kMaxSpheresPerGeometry cells along their longest edge.
+    double s = std::max(size.minCoeff(),
+                        size.maxCoeff() / kMaxSpheresPerGeometry);
+    Eigen::Vector3i n;
+    while (true) {
+      for (int i = 0; i < 3; i++) {
+        n[i] = std::max<int>(std::ceil(size[i] / s), 1);
+      }
+      if (n.prod() <= kMaxSpheresPerGeometry) {
+        break;
+      }
+      s *= 2;
+    }
+    const Vector3d d = size.cwiseQuotient(n.cast<double>());
+    p_GS_->resize(3, n.prod());
+    int k = 0;
+    for (int i = 0; i < n[0]; i++) {
+      for (int j = 0; j < n[1]; j++) {
+        for (int l = 0; l < n[2]; l++) {
+          p_GS_->col(k++) = center - size / 2 +
+                            Vector3d(i + 0.5, j + 0.5, l + 0.5).cwiseProduct(d);
+        }
+      }
+    }
+    *radii_ = VectorXd::Constant(n.prod(), d.norm() / 2);
+  }
+
+  Matrix3Xd *p_GS_{nullptr};
+  VectorXd *radii_{nullptr};
+  bool is_valid_{true};
+};
+} // namespace
+
+void SphereProxyBroadphase::Initialize(
+    const drake::geometry::SceneGraphInspector<double> &inspector) {
+  const auto candidates = inspector.GetCollisionCandidates();
+
+  // Ordinals of the geometries with a proxy, -1 for the others.
+  std::unordered_map<GeometryId, int> ordinals;
+  auto get_ordinal = [&](const GeometryId id) {
+    const auto it = ordinals.find(id);
+    if (it != ordinals.end()) {
+      return it->second;
+    }
+    Proxy proxy;
+    proxy.id = id;
+    if (not SphereProxyReifier().Calc(inspector.GetShape(id), &proxy.p_GS,
+                                      &proxy.radii)) {
+      return ordinals[id] = -1;
+    }
+    proxy.r_bound =
+        (proxy.p_GS.colwise().norm().transpose() + proxy.radii).maxCoeff();
+    proxy.p_WS.resize(3, proxy.p_GS.cols());
+    proxies_.emplace_back(std::move(proxy));
+    return ordinals[id] = proxies_.size() - 1;
+  };
+  for (const auto &[id_A, id_B] : candidates) {
+    get_ordinal(id_A);
+    get_ordinal(id_B);
+  }
+
+  const int n_g = proxies_.size();
+  is_candidate_.assign(n_g * n_g, false);
+  for (const auto &[id_A, id_B] : candidates) {
+    const int k_A = ordinals[id_A];
+    const int k_B = ordinals[id_B];
+    if (k_A < 0 or k_B < 0) {
+      exact_candidates_.emplace_back(id_A, id_B);
+      continue;
+    }
+    is_candidate_[k_A * n_g + k_B] = true;
+    is_candidate_[k_B * n_g + k_A] = true;
+    n_proxy_candidates_++;
+  }
+
+  sweep_order_.resize(n_g);
+  std::iota(sweep_order_.begin(), sweep_order_.end(), 0);
+  x_min_.resize(n_g);
+  x_max_.resize(n_g);
+  is_initialized_ = true;
+}
+
+const Matrix3Xd &SphereProxyBroadphase::UpdateSphereCenters(
+    const QueryObject<double> &query_object, const int k) {
+  auto &proxy = proxies_[k];
+  if (proxy.i_query != i_query_) {
+    const auto &X_WG = query_object.GetPoseInWorld(proxy.id);
+    proxy.p_WS.noalias() = X_WG.rotation().matrix() * proxy.p_GS;
+    proxy.p_WS.colwise() += X_WG.translation();
+    proxy.i_query = i_query_;
+  }
+  return proxy.p_WS;
+}
+
+template <typename T>
+SignedDistancePair<T> SphereProxyBroadphase::CalcSpherePair(
+    const QueryObject<T> &query_object, const ApproximatedPair &pair) const {
+  const auto &proxy_A = proxies_[pair.k_A];
+  const auto &proxy_B = proxies_[pair.k_B];
+  const T r_A = proxy_A.radii[pair.i_A];
+  const T r_B = proxy_B.radii[pair.i_B];
+  const Vector3<T> p_ASa = proxy_A.p_GS.col(pair.i_A).template cast<T>();
+  const Vector3<T> p_BSb = proxy_B.p_GS.col(pair.i_B).template cast<T>();
+  const auto X_WA = query_object.GetPoseInWorld(pair.id_A);
+  const auto X_WB = query_object.GetPoseInWorld(pair.id_B);
+
+  const Vector3<T> p_SbSa_W = X_WA * p_ASa - X_WB * p_BSb;
+  const T d = p_SbSa_W.norm();
+  // Concentric spheres have no unique normal.
+  Vector3<T> nhat_BA_W = Vector3<T>::UnitZ();
+  if (d > 0) {
+    nhat_BA_W = p_SbSa_W / d;
+  }
+  const Vector3<T> p_ACa =
+      p_ASa - r_A * (X_WA.rotation().inverse() * nhat_BA_W);
+  const Vector3<T> p_BCb =
+      p_BSb + r_B * (X_WB.rotation().inverse() * nhat_BA_W);
+  return SignedDistancePair<T>(pair.id_A, pair.id_B, p_ACa, p_BCb,
+                               d - r_A - r_B, nhat_BA_W);
+}
+
+template <typename T>
+std::optional<SignedDistancePair<T>>
+SphereProxyBroadphase::CalcApproximatedPair(const QueryObject<T> &query_object,
+                                            const GeometryId id_A,
+                                            const GeometryId id_B) const {
+  const auto it = std::lower_bound(
+      approximated_pairs_.begin(), approximated_pairs_.end(),
+      std::make_pair(id_A, id_B),
+      [](const ApproximatedPair &pair,
+         const std::pair<GeometryId, GeometryId> &ids) {
+        return std::make_pair(pair.id_A, pair.id_B) < ids;
+      });
+  if (it == approximated_pairs_.end() or it->id_A != id_A or
+      it->id_B != id_B) {
+    return std::nullopt;
+  }
+  return CalcSpherePair(query_object, *it);
+}
+
+std::vector<SignedDistancePair<double>>
+SphereProxyBroadphase::ComputeSignedDistancePairs(
+    const QueryObject<double> &query_object,
+    const double contact_detection_tolerance, const double refinement_band) {
+  if (not is_initialized_) {
+    Initialize(query_object.inspector());
+  }
+  i_query_++;
+  approximated_pairs_.clear();
+
+  std::vector<SignedDistancePair<double>> sdps;
+  auto query_exactly = [&](const GeometryId id_A, const GeometryId id_B) {
+    auto sdp = query_object.ComputeSignedDistancePairClosestPoints(id_A, id_B);
+    n_exact_queries_++;
+    if (sdp.distance <= contact_detection_tolerance) {
+      sdps.emplace_back(std::move(sdp));
+    }
+  };
+  for (const auto &[id_A, id_B] : exact_candidates_) {
+    query_exactly(id_A, id_B);
+  }
+
+  // Intervals of the bounding spheres along x. Extending the upper ends by
+  // the tolerance makes two intervals overlap iff the x coordinates of the
+  // centers are within r_bound_A + r_bound_B + tolerance.
+  const int n_g = proxies_.size();
+  for (int k = 0; k < n_g; k++) {
+    const double x =
+        query_object.GetPoseInWorld(proxies_[k].id).translation().x();
+    x_min_[k] = x - proxies_[k].r_bound;
+    x_max_[k] = x + proxies_[k].r_bound + contact_detection_tolerance;
+  }
+  // Insertion sort, which takes linear time when the order of the last
+  // query changes little.
+  for (int i = 1; i < n_g; i++) {
+    const int k = sweep_order_[i];
+    int j = i;
+    for (; j > 0 and x_min_[sweep_order_[j - 1]] > x_min_[k]; j--) {
+      sweep_order_[j] = sweep_order_[j - 1];
+    }
+    sweep_order_[j] = k;
+  }
+
+  int n_kept_pairs = 0;
+  for (int i = 0; i < n_g; i++) {
+    const int k_A = sweep_order_[i];
+    for (int j = i + 1; j < n_g and x_min_[sweep_order_[j]] <= x_max_[k_A];
+         j++) {
+      const int k_B = sweep_order_[j];
+      if (not is_candidate_[k_A * n_g + k_B]) {
+        continue;
+      }
+      const auto &proxy_A = proxies_[k_A];
+      const auto &proxy_B = proxies_[k_B];
+
+      // Bounding spheres.
+      const auto &p_WAo = query_object.GetPoseInWorld(proxy_A.id).translation();
+      const auto &p_WBo = query_object.GetPoseInWorld(proxy_B.id).translation();
+      if ((p_WAo - p_WBo).norm() - proxy_A.r_bound - proxy_B.r_bound >
+          contact_detection_tolerance) {
+        continue;
+      }
+
+      // Proxy spheres. The distances from a sphere of A to all spheres of B
+      // are one vectorized Eigen expression, which does not allocate.
+      const Matrix3Xd &p_WS_A = UpdateSphereCenters(query_object, k_A);
+      const Matrix3Xd &p_WS_B = UpdateSphereCenters(query_object, k_B);
+      ApproximatedPair pair{proxy_A.id, proxy_B.id, k_A, k_B, 0, 0};
+      double d_min = std::numeric_limits<double>::infinity();
+      for (int i_A = 0; i_A < p_WS_A.cols(); i_A++) {
+        Eigen::Index i_B;
+        const double d =
+            ((p_WS_B.colwise() - p_WS_A.col(i_A)).colwise().norm().transpose() -
+             proxy_B.radii)
+                .minCoeff(&i_B) -
+            proxy_A.radii[i_A];
+        if (d < d_min) {
+          d_min = d;
+          pair.i_A = i_A;
+          pair.i_B = i_B;
+        }
+      }
+      if (d_min > contact_detection_tolerance) {
+        continue;
+      }
+      n_kept_pairs++;
+
+      // Pairs are ordered by their ids, like the collision candidates.
+      if (pair.id_B < pair.id_A) {
+        std::swap(pair.id_A, pair.id_B);
+        std::swap(pair.k_A, pair.k_B);
+        std::swap(pair.i_A, pair.i_B);
+      }
+      if (d_min < refinement_band) {
+        query_exactly(pair.id_A, pair.id_B);
+      } else {
+        approximated_pairs_.push_back(pair);
+      }
+    }
+  }
+  n_culled_pairs_ += n_proxy_candidates_ - n_kept_pairs;
+
+  std::sort(approximated_pairs_.begin(), approximated_pairs_.end(),
+            [](const ApproximatedPair &a, const ApproximatedPair &b) {
+              return std::make_pair(a.id_A, a.id_B) <
+                     std::make_pair(b.id_A, b.id_B);
+            });
+  for (const auto &pair : approximated_pairs_) {
+    sdps.emplace_back(CalcSpherePair(query_object, pair));
+  }
+  n_approximated_pairs_ += approximated_pairs_.size();
+  return sdps;
+}
+
+template std::optional<SignedDistancePair<double>>
+SphereProxyBroadphase::CalcApproximatedPair(const QueryObject<double> &,
+                                            GeometryId, GeometryId) const;
+template std::optional<SignedDistancePair<drake::AutoDiffXd>>
+SphereProxyBroadphase::CalcApproximatedPair(
+    const QueryObject<drake::AutoDiffXd> &, GeometryId, GeometryId) const;
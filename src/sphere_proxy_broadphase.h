@@ -0,0 +1,134 @@
+#pragma once
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "drake/geometry/query_object.h"
+#include "drake/geometry/scene_graph_inspector.h"
+
+/*
+ * A signed distance query which approximates geometries by sets of spheres.
+ *
+ * Every geometry with the proximity role is covered, in its own frame, by a
+ * small set of spheres built from its shape at the first query:
+ *  - a sphere by itself,
+ *  - a capsule by spheres centered on its axis,
+ *  - a box or a cylinder by one sphere per cell of a grid of nearly cubic
+ *    cells,
+ *  - an ellipsoid by the sphere of its largest semi-axis,
+ *  - a mesh or a convex mesh from an OBJ file like a box, using the
+ *    axis-aligned bounding box of its scaled vertices.
+ * Other shapes, e.g. half spaces, have no proxy, and their collision
+ * candidates are always queried exactly.
+ *
+ * As the spheres contain the geometry, the smallest signed distance between
+ * the spheres of two geometries, the proxy distance, is a lower bound of the
+ * signed distance between them. A query
+ *  1. sweeps the bounding spheres of the geometries along the world x axis
+ *     and prunes the pairs whose bounding spheres are farther apart than the
+ *     tolerance,
+ *  2. computes the proxy distances of the remaining collision candidates
+ *     and culls those greater than the tolerance,
+ *  3. queries the pairs whose proxy distance is less than refinement_band
+ *     exactly, with ComputeSignedDistancePairClosestPoints, and
+ *  4. approximates the other pairs by the signed distance pair of their
+ *     closest two spheres.
+ * With an infinite refinement_band, no pair is approximated and the result
+ * contains the same pairs as ComputeSignedDistancePairwiseClosestPoints,
+ * possibly in a different order.
+ *
+ * The collision candidates are read from SceneGraph at the first query, so
+ * collision filters must not change afterwards.
+ */
+class SphereProxyBroadphase {
+public:
+  std::vector<drake::geometry::SignedDistancePair<double>>
+  ComputeSignedDistancePairs(
+      const drake::geometry::QueryObject<double> &query_object,
+      double contact_detection_tolerance, double refinement_band);
+
+  /*
+   * If the signed distance pair of (id_A, id_B) of the last query was
+   * approximated by two spheres, returns the pair of the same spheres
+   * evaluated with query_object, e.g. with AutoDiffXd poses for the
+   * gradients, in closed form. Returns nullopt otherwise.
+   */
+  template <typename T>
+  std::optional<drake::geometry::SignedDistancePair<T>>
+  CalcApproximatedPair(const drake::geometry::QueryObject<T> &query_object,
+                       drake::geometry::GeometryId id_A,
+                       drake::geometry::GeometryId id_B) const;
+
+  // Forgets the approximated pairs of the last query.
+  void ClearApproximatedPairs() { approximated_pairs_.clear(); }
+
+  // Numbers of candidates which were culled by the proxies, queried
+  // exactly, and approximated by the proxies, over all calls.
+  int get_n_culled_pairs() const { return n_culled_pairs_; }
+  int get_n_exact_queries() const { return n_exact_queries_; }
+  int get_n_approximated_pairs() const { return n_approximated_pairs_; }
+
+private:
+  // Spheres in the frame of a geometry G.
+  struct Proxy {
+    drake::geometry::GeometryId id;
+    Eigen::Matrix3Xd p_GS;
+    Eigen::VectorXd radii;
+    // Radius of the sphere centered at the origin of G which contains all
+    // spheres.
+    double r_bound{0};
+    // Sphere centers in world frame, and the query they were computed for.
+    Eigen::Matrix3Xd p_WS;
+    int i_query{-1};
+  };
+
+  struct ApproximatedPair {
+    drake::geometry::GeometryId id_A;
+    drake::geometry::GeometryId id_B;
+    // Ordinals of A and B, and indices of their closest spheres.
+    int k_A{0};
+    int k_B{0};
+    int i_A{0};
+    int i_B{0};
+  };
+
+  void
+  Initialize(const drake::geometry::SceneGraphInspector<double> &inspector);
+
+  template <typename T>
+  drake::geometry::SignedDistancePair<T>
+  CalcSpherePair(const drake::geometry::QueryObject<T> &query_object,
+                 const ApproximatedPair &pair) const;
+
+  const Eigen::Matrix3Xd &
+  UpdateSphereCenters(const drake::geometry::QueryObject<double> &query_object,
+                      int k);
+
+  bool is_initialized_{false};
+  // Geometries with a proxy, indexed by their ordinals.
+  std::vector<Proxy> proxies_;
+  // is_candidate_[k_A * proxies_.size() + k_B] tells if the geometries of
+  // ordinals k_A and k_B are a collision candidate.
+  std::vector<bool> is_candidate_;
+  int n_proxy_candidates_{0};
+  // Candidates which involve a geometry without a proxy.
+  std::vector<std::pair<drake::geometry::GeometryId,
+                        drake::geometry::GeometryId>> exact_candidates_;
+
+  // Sweep and prune state: ordinals sorted by the lower ends of their
+  // bounding intervals along x, which are kept across queries so that
+  // re-sorting is cheap when the geometries move a little.
+  std::vector<int> sweep_order_;
+  std::vector<double> x_min_;
+  std::vector<double> x_max_;
+  int i_query_{0};
+
+  // Sorted by (id_A, id_B).
+  std::vector<ApproximatedPair> approximated_pairs_;
+
+  int n_culled_pairs_{0};
+  int n_exact_queries_{0};
+  int n_approximated_pairs_{0};
+};
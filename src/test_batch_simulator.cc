@@ -1,11 +1,17 @@
+#include <algorithm>
 #include <iostream>
+#include <limits>
 #include <random>
 #include <thread>
+#include <tuple>
 
 #include <gtest/gtest.h>
 
 #include "get_model_paths.h"
+#include "ilqr_solver.h"
+#include "mppi_controller.h"
 #include "quasistatic_parser.h"
+#include "trajectory_cache.h"
 
 using drake::multibody::ModelInstanceIndex;
 using Eigen::MatrixXd;
@@ -116,6 +122,36 @@ protected:
     x_batch_.rowwise() += x0.transpose();
   }
 
+  // Sets x_trj_ and u_trj_ to T copies of the first state and input
+  // samples, and std_u_ to the standard deviation of bundled input samples.
+  void SetNominalTrj(const int T) {
+    x_trj_.resize(T, x_batch_.cols());
+    u_trj_.resize(T, u_batch_.cols());
+    x_trj_.rowwise() = x_batch_.row(0);
+    u_trj_.rowwise() = u_batch_.row(0);
+    std_u_ = VectorXd::Constant(u_batch_.cols(), 0.1);
+  }
+
+  // A cost of T steps for the planar hand which moves the arms by 0.1 rad
+  // from x0, keeps the ball where it is, and tracks u_ref_trj.
+  QuadraticTrajectoryCost
+  MakePlanarHandGoalCost(const Eigen::Ref<const VectorXd> &x0, const int T,
+                         const Eigen::Ref<const MatrixXd> &u_ref_trj) const {
+    auto &q_sim = q_sim_batch_->get_q_sim();
+    const int n_q = x_batch_.cols();
+    const int n_u = u_batch_.cols();
+    auto q_goal_dict = q_sim.GetQDictFromVec(x0);
+    for (const auto &[model, idx] : q_sim.GetModelInstanceNameToIndexMap()) {
+      if (q_sim.get_actuated_models().count(idx) > 0) {
+        q_goal_dict[idx].array() += 0.1;
+      }
+    }
+    const VectorXd x_goal = q_sim.GetQVecFromDict(q_goal_dict);
+    return {MatrixXd::Identity(n_q, n_q), 10 * MatrixXd::Identity(n_q, n_q),
+            1e-3 * MatrixXd::Identity(n_u, n_u),
+            x_goal.transpose().replicate(T + 1, 1), u_ref_trj};
+  }
+
   void CompareIsValid(const std::vector<bool> &is_valid_batch_1,
                       const std::vector<bool> &is_valid_batch_2) const {
     EXPECT_EQ(n_tasks_, is_valid_batch_1.size());
@@ -149,10 +185,43 @@ protected:
     }
   }
 
+  // An input trajectory of T steps which ramps up slowly from the first
+  // sampled input.
+  MatrixXd MakeRampedUTrj(const int T) const {
+    MatrixXd u_trj = u_batch_.row(0).replicate(T, 1);
+    for (int t = 0; t < T; t++) {
+      u_trj.row(t).array() += 0.001 * t;
+    }
+    return u_trj;
+  }
+
+  // Rolls out u_trj from x0 with sim_params_ and returns the T + 1 states.
+  std::vector<VectorXd> Rollout(const Eigen::Ref<const VectorXd> &x0,
+                                const Eigen::Ref<const MatrixXd> &u_trj) {
+    auto &q_sim = q_sim_batch_->get_q_sim();
+    std::vector<VectorXd> x_trj{x0};
+    for (int t = 0; t < u_trj.rows(); t++) {
+      x_trj.push_back(q_sim.CalcDynamics(x_trj.back(), u_trj.row(t),
+                                         sim_params_));
+    }
+    return x_trj;
+  }
+
+  void CompareRollouts(const std::vector<VectorXd> &x_trj_1,
+                       const std::vector<VectorXd> &x_trj_2,
+                       const double tol = 1e-6) const {
+    ASSERT_EQ(x_trj_1.size(), x_trj_2.size());
+    for (int t = 0; t < x_trj_1.size(); t++) {
+      EXPECT_LT((x_trj_1[t] - x_trj_2[t]).norm(), tol);
+    }
+  }
+
   int n_tasks_{0};
   const double h_{0.1};
   QuasistaticSimParameters sim_params_;
   MatrixXd u_batch_, x_batch_;
+  MatrixXd x_trj_, u_trj_;
+  VectorXd std_u_;
   std::unique_ptr<BatchQuasistaticSimulator> q_sim_batch_;
 };
 
@@ -265,6 +334,38 @@ TEST_F(TestBatchQuasistaticSimulator, TestGradientAllegroHand) {
   CompareMatrices(A_batch_parallel, A_batch_serial, 1e-4);
 }
 
+TEST_F(TestBatchQuasistaticSimulator, TestPreallocatedBuffersPlanarHand) {
+  SetUpPlanarHand();
+  sim_params_.gradient_mode = GradientMode::kAB;
+  const auto n_q = x_batch_.cols();
+  const auto n_u = u_batch_.cols();
+
+  auto [x_next_batch, A_batch, B_batch, is_valid_batch] =
+      q_sim_batch_->CalcDynamicsParallel(x_batch_, u_batch_, sim_params_);
+
+  MatrixXd x_next_buffer(n_tasks_, n_q);
+  MatrixXd A_buffer(n_q, n_tasks_ * n_q);
+  MatrixXd B_buffer(n_q, n_tasks_ * n_u);
+  VectorXb is_valid_buffer(n_tasks_);
+  // Calling twice makes sure that the buffers can be reused.
+  for (int i = 0; i < 2; i++) {
+    q_sim_batch_->CalcDynamicsParallel(x_batch_, u_batch_, sim_params_,
+                                       x_next_buffer, A_buffer, B_buffer,
+                                       is_valid_buffer);
+  }
+
+  CompareIsValid(is_valid_batch, std::vector<bool>(is_valid_buffer.begin(),
+                                                   is_valid_buffer.end()));
+  CompareXNext(x_next_batch, x_next_buffer, 1e-10);
+  for (int i = 0; i < n_tasks_; i++) {
+    if (not is_valid_batch[i]) {
+      continue;
+    }
+    EXPECT_LT((A_batch[i] - A_buffer.middleCols(i * n_q, n_q)).norm(), 1e-10);
+    EXPECT_LT((B_batch[i] - B_buffer.middleCols(i * n_u, n_u)).norm(), 1e-10);
+  }
+}
+
 /*
  * Compare BatchQuasistaticSimulator::CalcBundledBTrjDirect against
  *        BatchQuasistaticSimulator::CalcBundledBTrjScalarStd.
@@ -283,22 +384,769 @@ TEST_F(TestBatchQuasistaticSimulator, TestBundledBTrj) {
   ASSERT_EQ(n_q, x_batch_.cols());
   ASSERT_EQ(n_u, u_batch_.cols());
 
-  MatrixXd x_trj(T + 1, n_q);
-  MatrixXd u_trj(T, n_u);
-
-  x_trj.rowwise() = x_batch_.row(0);
-  u_trj.rowwise() = u_batch_.row(0);
+  SetNominalTrj(T);
 
   sim_params_.gradient_mode = GradientMode::kBOnly;
   auto [A_bundled1, B_bundled1, c_bundled1] =
-      q_sim_batch_->CalcBundledABcTrjScalarStd(x_trj.topRows(T), u_trj, 0.1,
+      q_sim_batch_->CalcBundledABcTrjScalarStd(x_trj_, u_trj_, 0.1,
                                                sim_params_, n_samples, seed);
   auto B_bundled2 = q_sim_batch_->CalcBundledBTrjDirect(
-      x_trj.topRows(T), u_trj, 0.1, sim_params_, n_samples, seed);
+      x_trj_, u_trj_, 0.1, sim_params_, n_samples, seed);
   for (int i = 0; i < T; i++) {
     double err = (B_bundled1[i] - B_bundled2[i]).norm();
     EXPECT_LT(err, 1e-10);
   }
+
+  // The same holds for quasi-Monte Carlo antithetic samples.
+  BundledGradientParameters bundle_params;
+  bundle_params.n_samples = n_samples;
+  bundle_params.seed = seed;
+  bundle_params.use_antithetic_samples = true;
+  bundle_params.sample_sequence = SampleSequence::kRandomizedLattice;
+  const auto bundled3 = q_sim_batch_->CalcBundledABcTrj(
+      x_trj_, u_trj_, std_u_, sim_params_, bundle_params);
+  const auto B_bundled4 = q_sim_batch_->CalcBundledBTrjDirect(
+      x_trj_, u_trj_, std_u_, sim_params_, bundle_params);
+  for (int i = 0; i < T; i++) {
+    EXPECT_LT((bundled3.B_list[i] - B_bundled4[i]).norm(), 1e-10);
+  }
+}
+
+/*
+ * With a fixed seed, bundled gradients should not depend on the number of
+ * threads used to compute them.
+ */
+TEST_F(TestBatchQuasistaticSimulator, TestBundledABcTrjNumThreads) {
+  SetUpPlanarHand();
+
+  const int T = 10;
+  const int n_samples = 50;
+  const int seed = 1;
+
+  SetNominalTrj(T);
+
+  sim_params_.gradient_mode = GradientMode::kAB;
+  const auto n_threads = q_sim_batch_->get_num_max_parallel_executions();
+  auto [A_bundled1, B_bundled1, c_bundled1] =
+      q_sim_batch_->CalcBundledABcTrjScalarStd(x_trj_, u_trj_, 0.1, sim_params_,
+                                               n_samples, seed);
+  q_sim_batch_->set_num_max_parallel_executions(1);
+  auto [A_bundled2, B_bundled2, c_bundled2] =
+      q_sim_batch_->CalcBundledABcTrjScalarStd(x_trj_, u_trj_, 0.1, sim_params_,
+                                               n_samples, seed);
+  q_sim_batch_->set_num_max_parallel_executions(n_threads);
+
+  for (int t = 0; t < T; t++) {
+    EXPECT_LT((A_bundled1[t] - A_bundled2[t]).norm(), 1e-10);
+    EXPECT_LT((B_bundled1[t] - B_bundled2[t]).norm(), 1e-10);
+    EXPECT_LT((c_bundled1[t] - c_bundled2[t]).norm(), 1e-10);
+  }
+}
+
+TEST_F(TestBatchQuasistaticSimulator, TestBundledABcTrjVarianceReduction) {
+  SetUpPlanarHand();
+
+  const int T = 10;
+  const int n_samples = 50;
+  SetNominalTrj(T);
+
+  sim_params_.gradient_mode = GradientMode::kBOnly;
+  BundledGradientParameters bundle_params;
+  bundle_params.n_samples = n_samples;
+  bundle_params.seed = 1;
+
+  // Without variance reduction, the results are the same as those of the
+  // tuple-returning overload.
+  auto [A_bundled, B_bundled, c_bundled] = q_sim_batch_->CalcBundledABcTrj(
+      x_trj_, u_trj_, std_u_, sim_params_, n_samples, bundle_params.seed);
+  const auto plain = q_sim_batch_->CalcBundledABcTrj(
+      x_trj_, u_trj_, std_u_, sim_params_, bundle_params);
+  EXPECT_TRUE(plain.A_list.empty());
+  ASSERT_EQ(plain.B_list.size(), T);
+  ASSERT_EQ(plain.B_std_error_list.size(), T);
+  ASSERT_EQ(plain.c_std_error_list.size(), T);
+  for (int t = 0; t < T; t++) {
+    EXPECT_LT((plain.B_list[t] - B_bundled[t]).norm(), 1e-10);
+    EXPECT_LT((plain.c_list[t] - c_bundled[t]).norm(), 1e-10);
+    EXPECT_LE(plain.n_valid_samples[t], n_samples);
+  }
+
+  // The control variate reduces the standard error of c.
+  bundle_params.use_control_variate = true;
+  const auto cv = q_sim_batch_->CalcBundledABcTrj(x_trj_, u_trj_, std_u_,
+                                                  sim_params_, bundle_params);
+  bundle_params.use_control_variate = false;
+  bundle_params.use_antithetic_samples = true;
+  const auto antithetic = q_sim_batch_->CalcBundledABcTrj(
+      x_trj_, u_trj_, std_u_, sim_params_, bundle_params);
+  for (int t = 0; t < T; t++) {
+    EXPECT_LT(cv.c_std_error_list[t].norm(),
+              plain.c_std_error_list[t].norm());
+    EXPECT_LT(antithetic.c_std_error_list[t].norm(),
+              plain.c_std_error_list[t].norm());
+    EXPECT_EQ(antithetic.n_valid_samples[t] % 2, 0);
+  }
+
+  // Antithetic samples come in pairs.
+  bundle_params.n_samples = n_samples + 1;
+  EXPECT_THROW(q_sim_batch_->CalcBundledABcTrj(x_trj_, u_trj_, std_u_,
+                                               sim_params_, bundle_params),
+               std::exception);
+}
+
+TEST_F(TestBatchQuasistaticSimulator, TestBundledABcTrjAdaptive) {
+  SetUpPlanarHand();
+
+  const int T = 10;
+  const int n_samples = 20;
+  SetNominalTrj(T);
+
+  sim_params_.gradient_mode = GradientMode::kBOnly;
+  BundledGradientParameters bundle_params;
+  bundle_params.n_samples = n_samples;
+  bundle_params.seed = 1;
+  bundle_params.use_adaptive_sampling = true;
+  bundle_params.std_error_tolerance = 1e-3;
+  bundle_params.n_samples_budget = 3 * T * n_samples;
+
+  const auto bundled = q_sim_batch_->CalcBundledABcTrj(
+      x_trj_, u_trj_, std_u_, sim_params_, bundle_params);
+  int n_samples_total = 0;
+  for (int t = 0; t < T; t++) {
+    EXPECT_GE(bundled.n_samples_drawn[t], n_samples);
+    EXPECT_LE(bundled.n_valid_samples[t], bundled.n_samples_drawn[t]);
+    n_samples_total += bundled.n_samples_drawn[t];
+  }
+  EXPECT_LE(n_samples_total, bundle_params.n_samples_budget);
+
+  // Unless the budget is used up, every time step is within the tolerance.
+  if (n_samples_total < bundle_params.n_samples_budget) {
+    for (int t = 0; t < T; t++) {
+      EXPECT_LE(bundled.B_std_error_list[t].maxCoeff(),
+                bundle_params.std_error_tolerance);
+      EXPECT_LE(bundled.c_std_error_list[t].maxCoeff(),
+                bundle_params.std_error_tolerance);
+    }
+  }
+
+  // The first round is the same as the non-adaptive estimate.
+  bundle_params.use_adaptive_sampling = false;
+  const auto bundled_fixed = q_sim_batch_->CalcBundledABcTrj(
+      x_trj_, u_trj_, std_u_, sim_params_, bundle_params);
+  for (int t = 0; t < T; t++) {
+    if (bundled.n_samples_drawn[t] == n_samples) {
+      EXPECT_LT((bundled.B_list[t] - bundled_fixed.B_list[t]).norm(), 1e-10);
+    }
+  }
+
+  bundle_params.use_adaptive_sampling = true;
+  bundle_params.sample_sequence = SampleSequence::kRandomizedLattice;
+  EXPECT_THROW(q_sim_batch_->CalcBundledABcTrj(x_trj_, u_trj_, std_u_,
+                                               sim_params_, bundle_params),
+               std::logic_error);
+}
+
+TEST_F(TestBatchQuasistaticSimulator, TestBcLstsqTrj) {
+  SetUpPlanarHand();
+
+  const int T = 5;
+  const int n_q = x_batch_.cols();
+  const int n_u = u_batch_.cols();
+  SetNominalTrj(T);
+
+  BundledGradientParameters bundle_params;
+  bundle_params.n_samples = 100;
+  bundle_params.seed = 1;
+  const auto n_threads = q_sim_batch_->get_num_max_parallel_executions();
+  const auto [B_list1, c_list1] = q_sim_batch_->CalcBcLstsqTrj(
+      x_trj_, u_trj_, std_u_, sim_params_, bundle_params, 0);
+  q_sim_batch_->set_num_max_parallel_executions(1);
+  const auto [B_list2, c_list2] = q_sim_batch_->CalcBcLstsqTrj(
+      x_trj_, u_trj_, std_u_, sim_params_, bundle_params, 0);
+  q_sim_batch_->set_num_max_parallel_executions(n_threads);
+  const auto [B_list_ridge, c_list_ridge] = q_sim_batch_->CalcBcLstsqTrj(
+      x_trj_, u_trj_, std_u_, sim_params_, bundle_params, 1e3);
+
+  ASSERT_EQ(B_list1.size(), T);
+  for (int t = 0; t < T; t++) {
+    EXPECT_EQ(B_list1[t].rows(), n_q);
+    EXPECT_EQ(B_list1[t].cols(), n_u);
+    EXPECT_LT((B_list1[t] - B_list2[t]).norm(), 1e-10);
+    EXPECT_LT((c_list1[t] - c_list2[t]).norm(), 1e-10);
+    // The ridge term shrinks B, but does not change c.
+    EXPECT_LT(B_list_ridge[t].norm(), B_list1[t].norm());
+    EXPECT_LT((c_list_ridge[t] - c_list1[t]).norm(), 1e-10);
+  }
+
+  bundle_params.use_control_variate = true;
+  EXPECT_THROW(q_sim_batch_->CalcBcLstsqTrj(x_trj_, u_trj_, std_u_, sim_params_,
+                                            bundle_params, 0),
+               std::logic_error);
+}
+
+/*
+ * Empty trajectories give empty bundled gradients.
+ */
+TEST_F(TestBatchQuasistaticSimulator, TestBundledEmptyTrj) {
+  SetUpPlanarHand();
+  SetNominalTrj(0);
+  BundledGradientParameters bundle_params;
+  bundle_params.n_samples = 10;
+
+  sim_params_.gradient_mode = GradientMode::kAB;
+  const auto bundled = q_sim_batch_->CalcBundledABcTrj(
+      x_trj_, u_trj_, std_u_, sim_params_, bundle_params);
+  EXPECT_TRUE(bundled.A_list.empty());
+  EXPECT_TRUE(bundled.B_list.empty());
+  EXPECT_TRUE(bundled.c_list.empty());
+
+  const auto [B_list, c_list] = q_sim_batch_->CalcBcLstsqTrj(
+      x_trj_, u_trj_, std_u_, sim_params_, bundle_params, 0);
+  EXPECT_TRUE(B_list.empty());
+  EXPECT_TRUE(c_list.empty());
+}
+
+/*
+ * Compares BatchQuasistaticSimulator::RolloutParallel against calling
+ * QuasistaticSimulator::CalcDynamics step by step.
+ */
+TEST_F(TestBatchQuasistaticSimulator, TestRolloutParallel) {
+  SetUpPlanarHand();
+  sim_params_.gradient_mode = GradientMode::kBOnly;
+
+  const int K = 8;
+  const int T = 5;
+  const int n_q = x_batch_.cols();
+  const int n_u = u_batch_.cols();
+  const MatrixXd x0_batch = x_batch_.topRows(K);
+  std::vector<MatrixXd> u_trj_batch;
+  for (int k = 0; k < K; k++) {
+    MatrixXd u_trj(T, n_u);
+    for (int t = 0; t < T; t++) {
+      u_trj.row(t) = u_batch_.row((k + t) % n_tasks_);
+    }
+    u_trj_batch.push_back(u_trj);
+  }
+
+  const auto rollouts =
+      q_sim_batch_->RolloutParallel(x0_batch, u_trj_batch, sim_params_);
+  ASSERT_EQ(rollouts.x_trj_list.size(), K);
+  ASSERT_EQ(rollouts.B_trj_list.size(), K);
+  EXPECT_TRUE(rollouts.A_trj_list.empty());
+  EXPECT_EQ(rollouts.is_valid.rows(), K);
+  EXPECT_EQ(rollouts.is_valid.cols(), T);
+
+  auto &q_sim = q_sim_batch_->get_q_sim();
+  for (int k = 0; k < K; k++) {
+    VectorXd x = x0_batch.row(k);
+    const auto &x_trj = rollouts.x_trj_list[k];
+    ASSERT_EQ(x_trj.rows(), T + 1);
+    ASSERT_EQ(x_trj.cols(), n_q);
+    EXPECT_EQ((x_trj.row(0) - x0_batch.row(k)).norm(), 0);
+    for (int t = 0; t < T; t++) {
+      if (not rollouts.is_valid(k, t)) {
+        EXPECT_TRUE(x_trj.row(t + 1).hasNaN());
+        break;
+      }
+      x = q_sim.CalcDynamics(x, u_trj_batch[k].row(t), sim_params_);
+      EXPECT_LT((x_trj.row(t + 1).transpose() - x).norm(), 1e-10);
+      EXPECT_LT(
+          (rollouts.B_trj_list[k][t] - q_sim.get_Dq_nextDqa_cmd()).norm(),
+          1e-10);
+    }
+  }
+}
+
+/*
+ * MppiController should reduce the cost of reaching a goal configuration of
+ * the arms, and be reproducible given a seed.
+ */
+TEST_F(TestBatchQuasistaticSimulator, TestMppiPlanarHand) {
+  SetUpPlanarHand();
+  auto &q_sim = q_sim_batch_->get_q_sim();
+  const int T = 5;
+  const int n_u = u_batch_.cols();
+  const VectorXd x0 = x_batch_.row(0);
+  const VectorXd u0 = q_sim.GetQaCmdVecFromDict(q_sim.GetQDictFromVec(x0));
+
+  const VectorXd u_goal = u0.array() + 0.1;
+  const auto cost =
+      MakePlanarHandGoalCost(x0, T, u_goal.transpose().replicate(T, 1));
+
+  MppiParameters mppi_params;
+  mppi_params.n_samples = 64;
+  mppi_params.std_u = VectorXd::Constant(n_u, 0.05);
+  mppi_params.temperature = 0.01;
+  mppi_params.seed = 1;
+  const MatrixXd u_trj0 = u0.transpose().replicate(T, 1);
+
+  auto calc_cost = [&](const MatrixXd &u_trj) {
+    const auto rollouts = q_sim_batch_->RolloutParallel(
+        x0.transpose(), {u_trj}, sim_params_);
+    return cost.Eval(rollouts.x_trj_list[0], u_trj);
+  };
+
+  MppiController mppi(*q_sim_batch_, sim_params_, mppi_params, cost);
+  mppi.set_u_trj(u_trj0);
+  for (int i = 0; i < 10; i++) {
+    mppi.Iterate(x0);
+    EXPECT_NEAR(mppi.get_weights().sum(), 1, 1e-10);
+    EXPECT_EQ(mppi.get_costs().size(), mppi_params.n_samples);
+  }
+  EXPECT_LT(calc_cost(mppi.get_u_trj()), 0.5 * calc_cost(u_trj0));
+
+  // Same seed, same iterates, whether the cost is given as a
+  // QuadraticTrajectoryCost or as a function.
+  MppiController mppi2(*q_sim_batch_, sim_params_, mppi_params,
+                       [&cost](const MatrixXd &x_trj, const MatrixXd &u_trj) {
+                         return cost.Eval(x_trj, u_trj);
+                       });
+  mppi2.set_u_trj(u_trj0);
+  for (int i = 0; i < 10; i++) {
+    mppi2.Iterate(x0);
+  }
+  EXPECT_EQ((mppi.get_u_trj() - mppi2.get_u_trj()).norm(), 0);
+}
+
+/*
+ * The feedback overload of RolloutParallel applies
+ *  u_t = u_ff_t + K_t * (x_t - x_nominal_t).
+ */
+TEST_F(TestBatchQuasistaticSimulator, TestRolloutParallelFeedback) {
+  SetUpPlanarHand();
+  const int K = 4;
+  const int T = 5;
+  const int n_q = x_batch_.cols();
+  const int n_u = u_batch_.cols();
+  const MatrixXd x0_batch = x_batch_.topRows(K);
+  std::mt19937 gen(2);
+  std::vector<MatrixXd> u_trj_batch;
+  for (int k = 0; k < K; k++) {
+    u_trj_batch.push_back(u_batch_.middleRows(k, T));
+  }
+  std::vector<MatrixXd> K_list;
+  for (int t = 0; t < T; t++) {
+    K_list.push_back(0.1 * CreateRandomMatrix(n_u, n_q, gen));
+  }
+  const MatrixXd x_trj_nominal = x0_batch.row(0).replicate(T + 1, 1);
+
+  const auto rollouts = q_sim_batch_->RolloutParallel(
+      x0_batch, u_trj_batch, K_list, x_trj_nominal, sim_params_);
+
+  auto &q_sim = q_sim_batch_->get_q_sim();
+  for (int k = 0; k < K; k++) {
+    VectorXd x = x0_batch.row(k);
+    for (int t = 0; t < T; t++) {
+      const VectorXd u =
+          u_trj_batch[k].row(t).transpose() +
+          K_list[t] * (x - x_trj_nominal.row(t).transpose());
+      EXPECT_LT((rollouts.u_trj_list[k].row(t).transpose() - u).norm(),
+                1e-10);
+      if (not rollouts.is_valid(k, t)) {
+        break;
+      }
+      x = q_sim.CalcDynamics(x, u, sim_params_);
+      EXPECT_LT((rollouts.x_trj_list[k].row(t + 1).transpose() - x).norm(),
+                1e-10);
+    }
+  }
+}
+
+/*
+ * IlqrSolver decreases the cost monotonically, with both exact and bundled
+ * linearizations.
+ */
+TEST_F(TestBatchQuasistaticSimulator, TestIlqrPlanarHand) {
+  SetUpPlanarHand();
+  auto &q_sim = q_sim_batch_->get_q_sim();
+  const int T = 5;
+  const int n_u = u_batch_.cols();
+  const VectorXd x0 = x_batch_.row(0);
+  const VectorXd u0 = q_sim.GetQaCmdVecFromDict(q_sim.GetQDictFromVec(x0));
+
+  const auto cost = MakePlanarHandGoalCost(x0, T, MatrixXd::Zero(T, n_u));
+  const MatrixXd u_trj0 = u0.transpose().replicate(T, 1);
+
+  IlqrParameters ilqr_params;
+  ilqr_params.max_iterations = 10;
+  for (const bool is_bundled : {false, true}) {
+    if (is_bundled) {
+      ilqr_params.std_u = VectorXd::Constant(n_u, 0.01);
+      ilqr_params.bundle_params.n_samples = 50;
+      ilqr_params.bundle_params.seed = 1;
+    }
+    IlqrSolver solver(*q_sim_batch_, sim_params_, ilqr_params, cost);
+    solver.Solve(x0, u_trj0);
+    const auto &costs = solver.get_cost_history();
+    ASSERT_GT(costs.size(), 1);
+    for (size_t i = 1; i < costs.size(); i++) {
+      EXPECT_LT(costs[i], costs[i - 1]);
+    }
+    EXPECT_LT(costs.back(), 0.5 * costs.front());
+    EXPECT_NEAR(cost.Eval(solver.get_x_trj(), solver.get_u_trj()),
+                costs.back(), 1e-10);
+  }
+}
+
+/*
+ * TrajectoryCache only recomputes the time steps after the first changed
+ * input, and after shifting the horizon, and agrees with recomputing the
+ * whole trajectory.
+ */
+TEST_F(TestBatchQuasistaticSimulator, TestTrajectoryCache) {
+  SetUpPlanarHand();
+  sim_params_.gradient_mode = GradientMode::kBOnly;
+  const int T = 6;
+  const int n_u = u_batch_.cols();
+  const VectorXd std_u = VectorXd::Constant(n_u, 0.1);
+  BundledGradientParameters bundle_params;
+  bundle_params.n_samples = 20;
+  bundle_params.seed = 1;
+
+  TrajectoryCache cache(*q_sim_batch_, sim_params_);
+  auto compare_with_full = [&](const VectorXd &x0, const MatrixXd &u_trj) {
+    const auto rollouts =
+        q_sim_batch_->RolloutParallel(x0.transpose(), {u_trj}, sim_params_);
+    EXPECT_LT((cache.get_x_trj() - rollouts.x_trj_list[0]).norm(), 1e-10);
+
+    auto bundle_params_full = bundle_params;
+    bundle_params_full.time_step_offset = cache.get_time_step_offset();
+    const auto ABc = q_sim_batch_->CalcBundledABcTrj(
+        rollouts.x_trj_list[0].topRows(T), u_trj, std_u, sim_params_,
+        bundle_params_full);
+    const auto &ABc_cached = cache.CalcBundledABcTrj(std_u, bundle_params);
+    ASSERT_EQ(ABc_cached.B_list.size(), T);
+    for (int t = 0; t < T; t++) {
+      EXPECT_LT((ABc_cached.B_list[t] - ABc.B_list[t]).norm(), 1e-10);
+      EXPECT_LT((ABc_cached.c_list[t] - ABc.c_list[t]).norm(), 1e-10);
+    }
+  };
+
+  const VectorXd x0 = x_batch_.row(0);
+  MatrixXd u_trj = u_batch_.topRows(T);
+  cache.Rollout(x0, u_trj);
+  compare_with_full(x0, u_trj);
+  EXPECT_EQ(cache.get_n_steps_simulated(), T);
+  EXPECT_EQ(cache.get_n_steps_linearized(), T);
+
+  // Changing the input of the last two time steps.
+  u_trj.bottomRows(2).array() += 0.01;
+  cache.Rollout(x0, u_trj);
+  compare_with_full(x0, u_trj);
+  EXPECT_EQ(cache.get_n_steps_simulated(), T + 2);
+  EXPECT_EQ(cache.get_n_steps_linearized(), T + 2);
+
+  // Receding horizon: the new last time step repeats the last input.
+  cache.ShiftHorizon();
+  const VectorXd x1 = cache.get_x_trj().row(0);
+  MatrixXd u_trj_shifted = u_trj;
+  ShiftTrajectory(&u_trj_shifted);
+  cache.Rollout(x1, u_trj_shifted);
+  compare_with_full(x1, u_trj_shifted);
+  EXPECT_EQ(cache.get_n_steps_simulated(), T + 3);
+  EXPECT_EQ(cache.get_n_steps_linearized(), T + 3);
+}
+
+/*
+ * With a DynamicsCache, repeated queries are served from the cache and give
+ * the same results as solving the dynamics.
+ */
+TEST_F(TestBatchQuasistaticSimulator, TestDynamicsCache) {
+  SetUpPlanarHand();
+  sim_params_.gradient_mode = GradientMode::kAB;
+  const auto [x_next, A, B, is_valid] =
+      q_sim_batch_->CalcDynamicsParallel(x_batch_, u_batch_, sim_params_);
+  const auto n_valid = std::count(is_valid.begin(), is_valid.end(), true);
+
+  auto cache = std::make_shared<DynamicsCache>(DynamicsCacheParameters{});
+  q_sim_batch_->set_dynamics_cache(cache);
+  q_sim_batch_->CalcDynamicsParallel(x_batch_, u_batch_, sim_params_);
+  EXPECT_EQ(cache->get_n_hits(), 0);
+  EXPECT_EQ(cache->get_n_misses(), n_tasks_);
+  EXPECT_EQ(cache->get_n_entries(), n_valid);
+
+  const auto [x_next2, A2, B2, is_valid2] =
+      q_sim_batch_->CalcDynamicsParallel(x_batch_, u_batch_, sim_params_);
+  EXPECT_EQ(cache->get_n_hits(), n_valid);
+  CompareIsValid(is_valid, is_valid2);
+  for (int i = 0; i < n_tasks_; i++) {
+    if (is_valid[i]) {
+      EXPECT_EQ((x_next.row(i) - x_next2.row(i)).norm(), 0);
+      EXPECT_EQ((A[i] - A2[i]).norm(), 0);
+      EXPECT_EQ((B[i] - B2[i]).norm(), 0);
+    }
+  }
+
+  // Entries with A and B also serve queries without gradients, but not
+  // queries with a different time step.
+  sim_params_.gradient_mode = GradientMode::kNone;
+  q_sim_batch_->CalcDynamicsSerial(x_batch_, u_batch_, sim_params_);
+  EXPECT_EQ(cache->get_n_hits(), 2 * n_valid);
+  sim_params_.h *= 2;
+  q_sim_batch_->CalcDynamicsSerial(x_batch_, u_batch_, sim_params_);
+  EXPECT_EQ(cache->get_n_hits(), 2 * n_valid);
+}
+
+/*
+ * The checkpointed adjoint gradient of a trajectory cost equals the
+ * gradient from chaining the A and B of every time step, for any
+ * checkpoint interval.
+ */
+TEST_F(TestBatchQuasistaticSimulator, TestTrajectoryGradient) {
+  SetUpPlanarHand();
+  const int T = 7;
+  const int n_q = x_batch_.cols();
+  const int n_u = u_batch_.cols();
+  const VectorXd x0 = x_batch_.row(0);
+  const MatrixXd u_trj = u_batch_.topRows(T);
+  const QuadraticTrajectoryCost cost(
+      MatrixXd::Identity(n_q, n_q), 10 * MatrixXd::Identity(n_q, n_q),
+      MatrixXd::Identity(n_u, n_u), x_batch_.topRows(T + 1),
+      u_batch_.bottomRows(T));
+
+  sim_params_.gradient_mode = GradientMode::kAB;
+  const auto rollouts =
+      q_sim_batch_->RolloutParallel(x0.transpose(), {u_trj}, sim_params_);
+  ASSERT_TRUE(rollouts.is_valid.all());
+  const auto &x_trj = rollouts.x_trj_list[0];
+  MatrixXd Dcost_Du_trj(T, n_u);
+  VectorXd lambda = cost.CalcStateGradient(T, x_trj.row(T));
+  for (int t = T - 1; t >= 0; t--) {
+    Dcost_Du_trj.row(t) = (cost.CalcInputGradient(t, u_trj.row(t)) +
+                           rollouts.B_trj_list[0][t].transpose() * lambda)
+                              .transpose();
+    lambda = cost.CalcStateGradient(t, x_trj.row(t)) +
+             rollouts.A_trj_list[0][t].transpose() * lambda;
+  }
+
+  auto &q_sim = q_sim_batch_->get_q_sim();
+  for (const int checkpoint_interval : {0, 1, 2, T, 2 * T}) {
+    const auto gradient = BatchQuasistaticSimulator::CalcTrajectoryGradient(
+        &q_sim, x0, u_trj, cost, sim_params_, checkpoint_interval);
+    ASSERT_TRUE(gradient.is_valid);
+    EXPECT_NEAR(gradient.cost, cost.Eval(x_trj, u_trj), 1e-10);
+    EXPECT_LT((gradient.Dcost_Du_trj - Dcost_Du_trj).norm(), 1e-8);
+    EXPECT_LT((gradient.Dcost_Dx0 - lambda).norm(), 1e-8);
+  }
+
+  const auto gradients = q_sim_batch_->CalcTrajectoryGradientParallel(
+      x0.transpose().replicate(3, 1), {u_trj, u_trj, u_trj}, cost,
+      sim_params_);
+  for (const auto &gradient : gradients) {
+    EXPECT_LT((gradient.Dcost_Du_trj - Dcost_Du_trj).norm(), 1e-8);
+  }
+}
+
+/*
+ * Under kABBroyden, rollouts are the same as under kAB, the gradients are
+ * exact whenever the staleness is 0, and they are recomputed exactly at
+ * least every broyden_max_steps + 1 steps.
+ */
+TEST_F(TestBatchQuasistaticSimulator, TestBroydenGradientsPlanarHand) {
+  SetUpPlanarHand();
+  const int K = 3;
+  const int T = 12;
+  const int n_u = u_batch_.cols();
+  const MatrixXd x0_batch = x_batch_.topRows(K);
+  // Small input increments, which mostly keep the contact mode.
+  std::vector<MatrixXd> u_trj_batch;
+  for (int k = 0; k < K; k++) {
+    MatrixXd u_trj = u_batch_.row(k).replicate(T, 1);
+    for (int t = 0; t < T; t++) {
+      u_trj.row(t).array() += 0.002 * t;
+    }
+    u_trj_batch.push_back(u_trj);
+  }
+
+  sim_params_.gradient_mode = GradientMode::kAB;
+  const auto rollouts_exact =
+      q_sim_batch_->RolloutParallel(x0_batch, u_trj_batch, sim_params_);
+  EXPECT_EQ(rollouts_exact.gradient_staleness.size(), 0);
+
+  sim_params_.gradient_mode = GradientMode::kABBroyden;
+  sim_params_.broyden_max_steps = 4;
+  const auto rollouts =
+      q_sim_batch_->RolloutParallel(x0_batch, u_trj_batch, sim_params_);
+  ASSERT_EQ(rollouts.gradient_staleness.rows(), K);
+  ASSERT_EQ(rollouts.gradient_staleness.cols(), T);
+
+  int n_stale_steps = 0;
+  for (int k = 0; k < K; k++) {
+    const auto &x_trj = rollouts.x_trj_list[k];
+    const auto &u_trj = rollouts.u_trj_list[k];
+    EXPECT_LT((x_trj - rollouts_exact.x_trj_list[k]).norm(), 1e-10);
+    for (int t = 0; t < T; t++) {
+      if (not rollouts.is_valid(k, t)) {
+        break;
+      }
+      const int staleness = rollouts.gradient_staleness(k, t);
+      EXPECT_LE(staleness, sim_params_.broyden_max_steps);
+      if (t == 0) {
+        EXPECT_EQ(staleness, 0);
+      } else {
+        EXPECT_TRUE(staleness == 0 or
+                    staleness == rollouts.gradient_staleness(k, t - 1) + 1);
+      }
+      const auto &A = rollouts.A_trj_list[k][t];
+      const auto &B = rollouts.B_trj_list[k][t];
+      const auto &A_exact = rollouts_exact.A_trj_list[k][t];
+      const auto &B_exact = rollouts_exact.B_trj_list[k][t];
+      EXPECT_EQ(B.cols(), n_u);
+      if (staleness == 0) {
+        EXPECT_LT((A - A_exact).norm(), 1e-10);
+        EXPECT_LT((B - B_exact).norm(), 1e-10);
+        continue;
+      }
+
+      // Secant condition of the Broyden update:
+      // q_next_t - q_next_{t-1} = [A, B] * (z_t - z_{t-1}).
+      n_stale_steps++;
+      const VectorXd dq_next = (x_trj.row(t + 1) - x_trj.row(t)).transpose();
+      const VectorXd dq = (x_trj.row(t) - x_trj.row(t - 1)).transpose();
+      const VectorXd du = (u_trj.row(t) - u_trj.row(t - 1)).transpose();
+      EXPECT_LT((dq_next - A * dq - B * du).norm(),
+                1e-8 * std::max(1., dq_next.norm()));
+
+      // The corrections stay close to the exact gradients.
+      EXPECT_LT((A - A_exact).norm(), 0.5 * A_exact.norm());
+      EXPECT_LT((B - B_exact).norm(), 0.5 * B_exact.norm());
+    }
+  }
+  EXPECT_GT(n_stale_steps, 0);
+
+  // The tasks of a batch are unrelated, and get the exact gradients.
+  const auto [x_next_batch, A_batch, B_batch, is_valid_batch] =
+      q_sim_batch_->CalcDynamicsParallel(x_batch_, u_batch_, sim_params_);
+  sim_params_.gradient_mode = GradientMode::kAB;
+  const auto [x_next_batch_exact, A_batch_exact, B_batch_exact,
+              is_valid_batch_exact] =
+      q_sim_batch_->CalcDynamicsParallel(x_batch_, u_batch_, sim_params_);
+  CompareIsValid(is_valid_batch, is_valid_batch_exact);
+  for (int i = 0; i < n_tasks_; i++) {
+    if (is_valid_batch[i]) {
+      EXPECT_LT((A_batch[i] - A_batch_exact[i]).norm(), 1e-10);
+      EXPECT_LT((B_batch[i] - B_batch_exact[i]).norm(), 1e-10);
+    }
+  }
+  sim_params_.gradient_mode = GradientMode::kABBroyden;
+
+  // kABBroyden is only supported by kQpMp and kSocpMp.
+  sim_params_.forward_mode = ForwardDynamicsMode::kLogPyramidMp;
+  auto &q_sim = q_sim_batch_->get_q_sim();
+  EXPECT_THROW(q_sim.CalcDynamics(x0_batch.row(0), u_trj_batch[0].row(0),
+                                  sim_params_),
+               std::logic_error);
+}
+
+/*
+ * With a collision cache margin, small steps reuse the candidate pairs of
+ * the signed distance query, and the rollout is the same as without the
+ * cache.
+ */
+TEST_F(TestBatchQuasistaticSimulator, TestCollisionPairCache) {
+  SetUpPlanarHand();
+  const int T = 10;
+  const VectorXd x0 = x_batch_.row(0);
+  const MatrixXd u_trj = MakeRampedUTrj(T);
+  const auto x_trj_exact = Rollout(x0, u_trj);
+
+  sim_params_.collision_cache_margin = 0.05;
+  const auto &cache = q_sim_batch_->get_q_sim().get_collision_pair_cache();
+  const int n_full_queries = cache.get_n_full_queries();
+  const int n_cached_queries = cache.get_n_cached_queries();
+  // The contacts can be ordered differently, which changes the solution up
+  // to the solver tolerance.
+  CompareRollouts(Rollout(x0, u_trj), x_trj_exact);
+  EXPECT_EQ(cache.get_n_full_queries() - n_full_queries +
+                cache.get_n_cached_queries() - n_cached_queries,
+            T);
+  EXPECT_GT(cache.get_n_cached_queries(), n_cached_queries);
+}
+
+/*
+ * With the default refinement band, the sphere proxies only cull pairs
+ * which are farther apart than the contact detection tolerance, so the
+ * rollout is the same as with the full signed distance query.
+ */
+TEST_F(TestBatchQuasistaticSimulator, TestSphereProxyBroadphase) {
+  SetUpPlanarHand();
+  const int T = 10;
+  const VectorXd x0 = x_batch_.row(0);
+  const MatrixXd u_trj = MakeRampedUTrj(T);
+  const auto x_trj_exact = Rollout(x0, u_trj);
+
+  auto &q_sim = q_sim_batch_->get_q_sim();
+  sim_params_.use_sphere_proxies = true;
+  const auto &broadphase = q_sim.get_sphere_proxy_broadphase();
+  CompareRollouts(Rollout(x0, u_trj), x_trj_exact);
+  EXPECT_GT(broadphase.get_n_exact_queries(), 0);
+  EXPECT_EQ(broadphase.get_n_approximated_pairs(), 0);
+
+  // With a tolerance halfway between the distances of the nearest and the
+  // farthest collision candidates, the nearest pair has to be kept and the
+  // farthest one culled.
+  q_sim.UpdateMbpPositions(x0);
+  const auto &query_object = q_sim.get_query_object();
+  auto sdps_all = query_object.ComputeSignedDistancePairwiseClosestPoints(
+      std::numeric_limits<double>::infinity());
+  ASSERT_GT(sdps_all.size(), 1);
+  const auto [sdp_min, sdp_max] = std::minmax_element(
+      sdps_all.begin(), sdps_all.end(), [](const auto &a, const auto &b) {
+        return a.distance < b.distance;
+      });
+  ASSERT_LT(sdp_min->distance, sdp_max->distance);
+  const double tol = (sdp_min->distance + sdp_max->distance) / 2;
+
+  auto sorted_pairs = [](const auto &sdps) {
+    std::vector<std::tuple<drake::geometry::GeometryId,
+                           drake::geometry::GeometryId, double>>
+        pairs;
+    for (const auto &sdp : sdps) {
+      pairs.emplace_back(std::min(sdp.id_A, sdp.id_B),
+                         std::max(sdp.id_A, sdp.id_B), sdp.distance);
+    }
+    std::sort(pairs.begin(), pairs.end());
+    return pairs;
+  };
+  const auto pairs_exact = sorted_pairs(
+      query_object.ComputeSignedDistancePairwiseClosestPoints(tol));
+  SphereProxyBroadphase proxies;
+  const auto pairs_proxy =
+      sorted_pairs(proxies.ComputeSignedDistancePairs(
+          query_object, tol, std::numeric_limits<double>::infinity()));
+  ASSERT_EQ(pairs_proxy.size(), pairs_exact.size());
+  for (int i = 0; i < pairs_exact.size(); i++) {
+    EXPECT_EQ(std::get<0>(pairs_proxy[i]), std::get<0>(pairs_exact[i]));
+    EXPECT_EQ(std::get<1>(pairs_proxy[i]), std::get<1>(pairs_exact[i]));
+    EXPECT_NEAR(std::get<2>(pairs_proxy[i]), std::get<2>(pairs_exact[i]),
+                1e-10);
+  }
+  const auto id_min_A = std::min(sdp_min->id_A, sdp_min->id_B);
+  const auto id_min_B = std::max(sdp_min->id_A, sdp_min->id_B);
+  EXPECT_TRUE(std::any_of(
+      pairs_proxy.begin(), pairs_proxy.end(), [&](const auto &pair) {
+        return std::get<0>(pair) == id_min_A and std::get<1>(pair) == id_min_B;
+      }));
+  EXPECT_GT(proxies.get_n_culled_pairs(), 0);
+  EXPECT_GT(proxies.get_n_exact_queries(), 0);
+
+  // Sphere distances are lower bounds of the signed distances, so
+  // approximating every pair keeps at least the contacts of the exact query,
+  // and gives finite gradients through the spheres.
+  sim_params_.gradient_mode = GradientMode::kAB;
+  sim_params_.calc_contact_forces = true;
+  sim_params_.use_sphere_proxies = false;
+  q_sim.CalcDynamics(x0, u_trj.row(0), sim_params_);
+  const int n_c_exact = q_sim.get_contact_results().num_point_pair_contacts();
+
+  sim_params_.use_sphere_proxies = true;
+  sim_params_.sphere_proxy_refinement_band =
+      -std::numeric_limits<double>::infinity();
+  q_sim.CalcDynamics(x0, u_trj.row(0), sim_params_);
+  EXPECT_GE(q_sim.get_contact_results().num_point_pair_contacts(), n_c_exact);
+  EXPECT_GT(broadphase.get_n_approximated_pairs(), 0);
+  EXPECT_TRUE(q_sim.get_Dq_nextDq().allFinite());
+  EXPECT_TRUE(q_sim.get_Dq_nextDqa_cmd().allFinite());
 }
 
 int main(int argc, char **argv) {
@@ -1,8 +1,10 @@
+#include <algorithm>
 #include <iostream>
 
 #include <gtest/gtest.h>
 
 #include "get_model_paths.h"
+#include "ilqr_solver.h"
 #include "quasistatic_parser.h"
 #include "quasistatic_simulator.h"
 
@@ -97,6 +99,124 @@ TEST_F(TestContactForces, TestNormalVsWeight) {
   EXPECT_LT((f_Obj_W + tau_ext_dict[model_o_]).norm(), 1e-8);
 }
 
+/*
+ * The object resting on the ground falls asleep, and is woken up when the
+ * robot comes into contact with it.
+ */
+TEST_F(TestContactForces, TestSleepingObject) {
+  params_.nd_per_contact = 4;
+  params_.forward_mode = ForwardDynamicsMode::kQpMp;
+  params_.use_contact_islands = true;
+  params_.sleep_velocity_threshold = 1e-3;
+  params_.sleep_min_steps = 3;
+
+  VectorXd q = q0_;
+  for (int i = 0; i < params_.sleep_min_steps; i++) {
+    q = QuasistaticSimulator::CalcDynamics(q_sim_.get(), q, u0_, params_);
+    EXPECT_EQ(q_sim_->get_n_sleeping_islands(), 0);
+  }
+  // The robot and the object are in separate islands.
+  EXPECT_EQ(q_sim_->get_n_contact_islands(), 2);
+  const VectorXd q_asleep =
+      QuasistaticSimulator::CalcDynamics(q_sim_.get(), q, u0_, params_);
+  EXPECT_EQ(q_sim_->get_n_sleeping_islands(), 1);
+  EXPECT_EQ(q_sim_->GetQDictFromVec(q_asleep).at(model_o_),
+            q_sim_->GetQDictFromVec(q).at(model_o_));
+
+  // Drive the robot into the object over consecutive steps, so that the
+  // object is woken up by the contact rather than by a discontinuity, and
+  // push it along x.
+  const double r_robot = 0.1;
+  const double r_obj = 0.5;
+  const Vector3d p_start = q_sim_->GetQDictFromVec(q_asleep).at(model_r_);
+  const Vector3d p_goal(-r_obj, 0, r_obj);
+  const Vector3d p_obj = q_sim_->GetQDictFromVec(q_asleep).at(model_o_);
+  const int n_ramp_steps = 30;
+  q = q_asleep;
+  bool is_woken_up = false;
+  for (int i = 1; i <= n_ramp_steps + 10; i++) {
+    auto u_dict = q_sim_->GetQDictFromVec(q);
+    const double s = std::min(1., static_cast<double>(i) / n_ramp_steps);
+    u_dict[model_r_] = p_start + s * (p_goal - p_start);
+    const double gap =
+        (q_sim_->GetQDictFromVec(q).at(model_r_) - p_obj).norm() - r_robot -
+        r_obj;
+    q = QuasistaticSimulator::CalcDynamics(
+        q_sim_.get(), q, q_sim_->GetQaCmdVecFromDict(u_dict), params_);
+    if (gap > params_.contact_detection_tolerance + 1e-3) {
+      // Out of reach of the robot, the object stays asleep.
+      ASSERT_FALSE(is_woken_up);
+      EXPECT_EQ(q_sim_->get_n_contact_islands(), 2);
+      EXPECT_EQ(q_sim_->get_n_sleeping_islands(), 1);
+      EXPECT_EQ(q_sim_->GetQDictFromVec(q).at(model_o_), p_obj);
+    } else if (q_sim_->get_n_contact_islands() == 1) {
+      EXPECT_EQ(q_sim_->get_n_sleeping_islands(), 0);
+      is_woken_up = true;
+    }
+  }
+  EXPECT_TRUE(is_woken_up);
+  EXPECT_GT(q_sim_->GetQDictFromVec(q).at(model_o_)[0], p_obj[0]);
+}
+
+/*
+ * With a velocity threshold which puts the falling object to sleep, the
+ * trajectory gradient and iLQR still simulate the object falling, like
+ * their gradient passes do.
+ */
+TEST_F(TestContactForces, TestNoSleepingInTrajectoryOptimization) {
+  params_.nd_per_contact = 4;
+  params_.forward_mode = ForwardDynamicsMode::kQpMp;
+  params_.use_contact_islands = true;
+  auto params_sleeping = params_;
+  params_sleeping.sleep_velocity_threshold = 1e3;
+  params_sleeping.sleep_min_steps = 1;
+
+  const int T = 5;
+  const int n_q = q0_.size();
+  const int n_u = u0_.size();
+  auto q0_dict = q_sim_->GetQDictFromVec(q0_);
+  q0_dict[model_o_][2] += 1;
+  const VectorXd q0 = q_sim_->GetQVecFromDict(q0_dict);
+  const MatrixXd u_trj = u0_.transpose().replicate(T, 1);
+  const QuadraticTrajectoryCost cost(
+      MatrixXd::Identity(n_q, n_q), MatrixXd::Identity(n_q, n_q),
+      MatrixXd::Identity(n_u, n_u), q0_.transpose().replicate(T + 1, 1),
+      u_trj);
+
+  MatrixXd x_trj(T + 1, n_q);
+  x_trj.row(0) = q0;
+  for (int t = 0; t < T; t++) {
+    x_trj.row(t + 1) = QuasistaticSimulator::CalcDynamics(
+        q_sim_.get(), x_trj.row(t), u_trj.row(t), params_);
+  }
+  // The object falls.
+  ASSERT_LT(x_trj(T, 2), q0[2] - 1e-3);
+
+  const auto gradient = BatchQuasistaticSimulator::CalcTrajectoryGradient(
+      q_sim_.get(), q0, u_trj, cost, params_);
+  const auto gradient_sleeping =
+      BatchQuasistaticSimulator::CalcTrajectoryGradient(
+          q_sim_.get(), q0, u_trj, cost, params_sleeping);
+  EXPECT_NEAR(gradient_sleeping.cost, cost.Eval(x_trj, u_trj), 1e-10);
+  EXPECT_LT((gradient_sleeping.Dcost_Du_trj - gradient.Dcost_Du_trj).norm(),
+            1e-10);
+
+  const auto q_sim_batch =
+      QuasistaticParser(GetQsimModelsPath() / "q_sys" / "two_spheres_xyz.yml")
+          .MakeBatchSimulator();
+  IlqrParameters ilqr_params;
+  ilqr_params.max_iterations = 2;
+  IlqrSolver solver(*q_sim_batch, params_, ilqr_params, cost);
+  solver.Solve(q0, u_trj);
+  IlqrSolver solver_sleeping(*q_sim_batch, params_sleeping, ilqr_params,
+                             cost);
+  solver_sleeping.Solve(q0, u_trj);
+  EXPECT_NEAR(solver_sleeping.get_cost_history().front(),
+              cost.Eval(x_trj, u_trj), 1e-10);
+  EXPECT_LT((solver_sleeping.get_u_trj() - solver.get_u_trj()).norm(),
+            1e-10);
+}
+
 // TODO: test the alignment of sliding direction vs force direction in SOCP.
 
 int main(int argc, char **argv) {
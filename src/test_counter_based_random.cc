@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+
+#include "counter_based_random.h"
+#include "randomized_lattice_rule.h"
+
+using Eigen::VectorXd;
+
+/*
+ * Known-answer tests from the Random123 distribution (kat_vectors).
+ */
+TEST(TestPhilox4x32, KnownAnswers) {
+  using Counter = Philox4x32::Counter;
+  EXPECT_EQ(Philox4x32::Generate({0, 0, 0, 0}, {0, 0}),
+            (Counter{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}));
+  EXPECT_EQ(Philox4x32::Generate({0xffffffff, 0xffffffff, 0xffffffff,
+                                  0xffffffff},
+                                 {0xffffffff, 0xffffffff}),
+            (Counter{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}));
+  EXPECT_EQ(Philox4x32::Generate({0x243f6a88, 0x85a308d3, 0x13198a2e,
+                                  0x03707344},
+                                 {0xa4093822, 0x299f31d0}),
+            (Counter{0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}));
+}
+
+TEST(TestCounterBasedGaussianSampler, Reproducibility) {
+  const CounterBasedGaussianSampler sampler(1);
+  VectorXd z1(7), z2(7), z3(5);
+  sampler.Sample(3, 5, &z1);
+  sampler.Sample(0, 0, &z2);
+  sampler.Sample(3, 5, &z2);
+  EXPECT_EQ(z1, z2);
+
+  // A shorter sample is a prefix of a longer one.
+  sampler.Sample(3, 5, &z3);
+  EXPECT_EQ(z3, z1.head(5));
+
+  // Different indices or seeds give different samples.
+  sampler.Sample(5, 3, &z2);
+  EXPECT_NE(z1, z2);
+  CounterBasedGaussianSampler(2).Sample(3, 5, &z2);
+  EXPECT_NE(z1, z2);
+}
+
+TEST(TestCounterBasedGaussianSampler, Moments) {
+  const CounterBasedGaussianSampler sampler(0);
+  const int n_samples = 100000;
+  VectorXd z(3);
+  double sum = 0;
+  double sum_squared = 0;
+  for (int i = 0; i < n_samples; i++) {
+    sampler.Sample(0, i, &z);
+    sum += z.sum();
+    sum_squared += z.squaredNorm();
+  }
+  const double mean = sum / (3 * n_samples);
+  EXPECT_NEAR(mean, 0, 0.01);
+  EXPECT_NEAR(sum_squared / (3 * n_samples) - mean * mean, 1, 0.01);
+}
+
+TEST(TestRandomizedLattice, InverseNormalCdf) {
+  EXPECT_EQ(InverseNormalCdf(0.5), 0);
+  EXPECT_NEAR(InverseNormalCdf(0.975), 1.959963984540054, 1e-14);
+  EXPECT_NEAR(InverseNormalCdf(0.001), -3.090232306167814, 1e-13);
+  for (const double p : {1e-10, 0.01, 0.3, 0.9, 1 - 1e-6}) {
+    EXPECT_NEAR(0.5 * std::erfc(-InverseNormalCdf(p) / M_SQRT2), p,
+                1e-14 * p + 1e-17);
+  }
+}
+
+TEST(TestRandomizedLattice, KorobovGenerator) {
+  const KorobovLattice lattice(128, 6);
+  const auto &z = lattice.get_generator();
+  ASSERT_EQ(z.size(), 6);
+  EXPECT_EQ(z[0], 1);
+  for (size_t j = 1; j < z.size(); j++) {
+    EXPECT_EQ(z[j], z[j - 1] * z[1] % 128);
+  }
+
+  // Every one-dimensional projection of a lattice with an odd multiplier
+  // hits every multiple of 1 / 128 exactly once.
+  VectorXd x;
+  VectorXd sum = VectorXd::Zero(6);
+  for (int i = 0; i < 128; i++) {
+    lattice.Point(i, &x);
+    sum += x;
+  }
+  EXPECT_LT((sum - VectorXd::Constant(6, 127. / 2)).norm(), 1e-12);
+}
+
+/*
+ * Randomized QMC estimates of a smooth expectation should be more accurate
+ * than Monte Carlo estimates with the same number of samples.
+ */
+TEST(TestRandomizedLattice, ErrorVsMonteCarlo) {
+  const int n_points = 128;
+  const int dim = 6;
+  const int n_steps = 50;
+  const RandomizedLatticeGaussianSampler qmc_sampler(n_points, dim, 1);
+  const CounterBasedGaussianSampler mc_sampler(1);
+  // E[exp(a * z)] = exp(a^2 / 2) for z ~ N(0, 1).
+  const double a = 0.3;
+  const double expected = dim * std::exp(a * a / 2);
+
+  VectorXd z(dim);
+  double qmc_squared_error = 0;
+  double mc_squared_error = 0;
+  for (int t = 0; t < n_steps; t++) {
+    double qmc_sum = 0;
+    double mc_sum = 0;
+    for (int i = 0; i < n_points; i++) {
+      qmc_sampler.Sample(t, i, &z);
+      qmc_sum += (a * z).array().exp().sum();
+      mc_sampler.Sample(t, i, &z);
+      mc_sum += (a * z).array().exp().sum();
+    }
+    qmc_squared_error += std::pow(qmc_sum / n_points - expected, 2);
+    mc_squared_error += std::pow(mc_sum / n_points - expected, 2);
+  }
+  EXPECT_LT(qmc_squared_error, mc_squared_error / 4);
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
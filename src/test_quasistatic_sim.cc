@@ -1,4 +1,10 @@
+#include <cmath>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <set>
+#include <tuple>
 
 #include <gtest/gtest.h>
 
@@ -96,6 +102,335 @@ TEST_F(TestQuasistaticSim, TestDfDu) {
 
 }
 
+/*
+ * The sparse Schur complement solve of the QP KKT system gives the same
+ * gradients as the dense pseudo-inverse.
+ */
+TEST_F(TestQuasistaticSim, TestSparseKkt) {
+  params_.gradient_mode = GradientMode::kAB;
+  params_.forward_mode = ForwardDynamicsMode::kQpMp;
+
+  const string kQModelPath =
+      GetQsimModelsPath() / "q_sys" / "allegro_hand_and_sphere.yml";
+  auto parser = QuasistaticParser(kQModelPath);
+  auto sim_params = parser.get_sim_params();
+  sim_params.sparse_kkt_min_n_v = std::numeric_limits<int>::max();
+  parser.set_sim_params(sim_params);
+  const auto q_sim_dense = parser.MakeSimulator();
+  sim_params.sparse_kkt_min_n_v = 0;
+  parser.set_sim_params(sim_params);
+  const auto q_sim_sparse = parser.MakeSimulator();
+
+  const auto q_next_dense = q_sim_dense->CalcDynamics(q0_, u0_, params_);
+  const auto q_next_sparse = q_sim_sparse->CalcDynamics(q0_, u0_, params_);
+  EXPECT_EQ(q_next_dense, q_next_sparse);
+
+  const auto &A_dense = q_sim_dense->get_Dq_nextDq();
+  const auto &B_dense = q_sim_dense->get_Dq_nextDqa_cmd();
+  EXPECT_LT((A_dense - q_sim_sparse->get_Dq_nextDq()).norm(),
+            1e-8 * (1 + A_dense.norm()));
+  EXPECT_LT((B_dense - q_sim_sparse->get_Dq_nextDqa_cmd()).norm(),
+            1e-8 * (1 + B_dense.norm()));
+}
+
+/*
+ * With linearly dependent active constraints, e.g. two contacts with the
+ * same Jacobian rows, the Schur complement is singular, and the sparse
+ * path falls back to the dense pseudo-inverse instead of throwing.
+ */
+TEST(TestQpDerivatives, TestSparseKktDependentConstraints) {
+  const int n_z = 12;
+  const int n_l = 4;
+  MatrixXd Q = MatrixXd::Zero(n_z, n_z);
+  for (int i = 0; i < n_z; i += 3) {
+    const MatrixXd M = MatrixXd::Random(3, 3);
+    Q.block(i, i, 3, 3) = M * M.transpose() + MatrixXd::Identity(3, 3);
+  }
+  MatrixXd G = MatrixXd::Zero(n_l, n_z);
+  for (int i = 0; i < n_l; i++) {
+    G.block(i, 3 * i, 1, 6) = Eigen::RowVectorXd::Random(6);
+  }
+  G.row(1) = G.row(0);
+  const VectorXd b = VectorXd::Random(n_z);
+  const VectorXd e = VectorXd::Random(n_l);
+  const VectorXd z_star = VectorXd::Random(n_z);
+  const VectorXd lambda_star = VectorXd::Ones(n_l);
+
+  QpDerivativesActive dqp_dense(0.3);
+  QpDerivativesActive dqp_sparse(0.3, 0);
+  dqp_dense.UpdateProblem(Q, b, G, e, z_star, lambda_star, 0.1, true);
+  dqp_sparse.UpdateProblem(Q, b, G, e, z_star, lambda_star, 0.1, true);
+  EXPECT_LT((dqp_dense.get_DzDb() - dqp_sparse.get_DzDb()).norm(), 1e-10);
+  EXPECT_LT((dqp_dense.get_DzDe() - dqp_sparse.get_DzDe()).norm(), 1e-10);
+  EXPECT_LT((dqp_dense.get_DzDvecG_active().first -
+             dqp_sparse.get_DzDvecG_active().first)
+                .norm(),
+            1e-10);
+}
+
+/*
+ * With the default sparse_kkt_min_n_v, QPs with that many variables switch
+ * to the sparse KKT solve, which agrees with the dense one, and smaller QPs
+ * do not.
+ */
+TEST(TestQpDerivatives, TestSparseKktDefaultThreshold) {
+  const int n_z_min = QuasistaticSimParameters().sparse_kkt_min_n_v;
+  for (const int n_z : {n_z_min - 6, n_z_min}) {
+    const int n_l = n_z / 3;
+    MatrixXd Q = MatrixXd::Zero(n_z, n_z);
+    for (int i = 0; i + 6 <= n_z; i += 6) {
+      const MatrixXd M = MatrixXd::Random(6, 6);
+      Q.block(i, i, 6, 6) = M * M.transpose() + MatrixXd::Identity(6, 6);
+    }
+    MatrixXd G = MatrixXd::Zero(n_l, n_z);
+    for (int i = 0; i < n_l; i++) {
+      G.block(i, (3 * i) % (n_z - 5), 1, 6) = Eigen::RowVectorXd::Random(6);
+    }
+    const VectorXd b = VectorXd::Random(n_z);
+    const VectorXd e = VectorXd::Random(n_l);
+    const VectorXd z_star = VectorXd::Random(n_z);
+    const VectorXd lambda_star = VectorXd::Ones(n_l);
+
+    QpDerivativesActive dqp_dense(0.3);
+    QpDerivativesActive dqp_default(0.3, n_z_min);
+    dqp_dense.UpdateProblem(Q, b, G, e, z_star, lambda_star, 0.1, true);
+    dqp_default.UpdateProblem(Q, b, G, e, z_star, lambda_star, 0.1, true);
+    EXPECT_FALSE(dqp_dense.is_kkt_sparse());
+    EXPECT_EQ(dqp_default.is_kkt_sparse(), n_z >= n_z_min);
+    EXPECT_LT((dqp_dense.get_DzDb() - dqp_default.get_DzDb()).norm(), 1e-8);
+    EXPECT_LT((dqp_dense.get_DzDe() - dqp_default.get_DzDe()).norm(), 1e-8);
+  }
+}
+
+/*
+ * Solving the programs of the contact islands separately gives the same
+ * dynamics and gradients as solving one program.
+ */
+TEST_F(TestQuasistaticSim, TestContactIslands) {
+  params_.gradient_mode = GradientMode::kAB;
+  for (const auto fm :
+       {ForwardDynamicsMode::kQpMp, ForwardDynamicsMode::kSocpMp}) {
+    params_.forward_mode = fm;
+    params_.use_contact_islands = false;
+    const VectorXd q_next = q_sim_->CalcDynamics(q0_, u0_, params_);
+    const MatrixXd A = q_sim_->get_Dq_nextDq();
+    const MatrixXd B = q_sim_->get_Dq_nextDqa_cmd();
+    EXPECT_EQ(q_sim_->get_n_contact_islands(), 0);
+
+    params_.use_contact_islands = true;
+    const VectorXd q_next_islands = q_sim_->CalcDynamics(q0_, u0_, params_);
+    EXPECT_GE(q_sim_->get_n_contact_islands(), 1);
+    EXPECT_LT((q_next - q_next_islands).norm(), 1e-6);
+    EXPECT_LT((A - q_sim_->get_Dq_nextDq()).norm(), 1e-4 * (1 + A.norm()));
+    EXPECT_LT((B - q_sim_->get_Dq_nextDqa_cmd()).norm(),
+              1e-4 * (1 + B.norm()));
+  }
+}
+
+/*
+ * Without gradients and contact forces, the SOCP dual solution is not
+ * computed, and steps with contact give the same q_next as steps which do
+ * compute the contact forces.
+ */
+TEST_F(TestQuasistaticSim, TestSocpWithoutDual) {
+  params_.forward_mode = ForwardDynamicsMode::kSocpMp;
+  params_.gradient_mode = GradientMode::kNone;
+  params_.calc_contact_forces = true;
+  const VectorXd q_next = q_sim_->CalcDynamics(q0_, u0_, params_);
+  EXPECT_GT(q_sim_->get_contact_results().num_point_pair_contacts(), 0);
+
+  params_.calc_contact_forces = false;
+  const VectorXd q_next_no_dual = q_sim_->CalcDynamics(q0_, u0_, params_);
+  EXPECT_LT((q_next - q_next_no_dual).norm(), 1e-8);
+}
+
+/*
+ * With one contact per cluster and clusters which accept any normal,
+ * contact reduction keeps one contact per body pair.
+ */
+TEST_F(TestQuasistaticSim, TestContactReduction) {
+  params_.forward_mode = ForwardDynamicsMode::kQpMp;
+  params_.calc_contact_forces = true;
+  q_sim_->CalcDynamics(q0_, u0_, params_);
+  const int n_c = q_sim_->get_contact_results().num_point_pair_contacts();
+  EXPECT_TRUE(q_sim_->get_removed_collision_pairs().empty());
+
+  params_.contact_reduction_max_points = 1;
+  params_.contact_reduction_max_angle = M_PI;
+  q_sim_->CalcDynamics(q0_, u0_, params_);
+  const auto &contact_results = q_sim_->get_contact_results();
+  const int n_c_reduced = contact_results.num_point_pair_contacts();
+  EXPECT_EQ(n_c_reduced + q_sim_->get_removed_collision_pairs().size(), n_c);
+
+  std::set<std::pair<int, int>> body_pairs;
+  for (int i = 0; i < n_c_reduced; i++) {
+    const auto &info = contact_results.point_pair_contact_info(i);
+    const int body_A = info.bodyA_index();
+    const int body_B = info.bodyB_index();
+    body_pairs.emplace(std::min(body_A, body_B), std::max(body_A, body_B));
+  }
+  EXPECT_EQ(body_pairs.size(), n_c_reduced);
+}
+
+/*
+ * A box resting on the ground on a 3x3 grid of contact points, whose
+ * corner points are slightly deeper. Contact reduction to 4 points keeps
+ * the corners of the face.
+ */
+TEST(TestContactReductionBox, TestBoxOnGround) {
+  // The file is named after the test so that concurrent test processes do
+  // not overwrite each other's model.
+  const auto *test_info =
+      ::testing::UnitTest::GetInstance()->current_test_info();
+  const std::filesystem::path sdf_path =
+      std::filesystem::path(::testing::TempDir()) /
+      (string(test_info->test_suite_name()) + "_" + test_info->name() +
+       ".sdf");
+  {
+    std::ofstream sdf(sdf_path);
+    sdf << R"(<?xml version="1.0"?>
+<sdf version="1.7" xmlns:drake="http://drake.mit.edu">
+  <model name="box">
+    <link name="box">
+      <inertial>
+        <mass>1</mass>
+        <inertia>
+          <ixx>0.0067</ixx><iyy>0.0067</iyy><izz>0.0067</izz>
+          <ixy>0</ixy><ixz>0</ixz><iyz>0</iyz>
+        </inertia>
+      </inertial>)";
+    int i_point = 0;
+    for (const double x : {-0.1, 0., 0.1}) {
+      for (const double y : {-0.1, 0., 0.1}) {
+        const bool is_corner = x != 0 and y != 0;
+        sdf << R"(
+      <collision name="point)" << i_point++ << R"(">
+        <pose>)" << x << " " << y << R"( -0.1 0 0 0</pose>
+        <geometry><sphere><radius>)" << (is_corner ? 0.012 : 0.01)
+            << R"(</radius></sphere></geometry>
+        <drake:proximity_properties>
+          <drake:mu_dynamic>0.5</drake:mu_dynamic>
+          <drake:mu_static>0.5</drake:mu_static>
+        </drake:proximity_properties>
+      </collision>)";
+      }
+    }
+    sdf << R"(
+    </link>
+  </model>
+</sdf>
+)";
+  }
+
+  QuasistaticSimParameters sim_params;
+  sim_params.h = 0.1;
+  sim_params.gravity = Vector3d(0, 0, -10);
+  sim_params.nd_per_contact = 4;
+  sim_params.contact_detection_tolerance = 0.005;
+  sim_params.is_quasi_dynamic = true;
+  sim_params.calc_contact_forces = true;
+  sim_params.contact_reduction_max_points = 4;
+
+  const string robot_name("arm");
+  const string object_name("box");
+  QuasistaticSimulator q_sim(
+      GetQsimModelsPath() / "three_link_arm_and_ground.yml",
+      {{robot_name, Vector3d(1000, 1000, 1000)}},
+      {{object_name, sdf_path.string()}}, sim_params);
+  const auto name_to_idx_map = q_sim.GetModelInstanceNameToIndexMap();
+  const auto idx_r = name_to_idx_map.at(robot_name);
+  const auto idx_o = name_to_idx_map.at(object_name);
+
+  // The arm reaches along +y, away from the box.
+  const Vector3d p_WBox(0, -1.7, 0.11);
+  VectorXd q_o(7);
+  q_o << 1, 0, 0, 0, p_WBox;
+  const ModelInstanceIndexToVecMap q_dict = {
+      {idx_o, q_o}, {idx_r, Vector3d(M_PI / 2, -M_PI / 2, -M_PI / 2)}};
+  q_sim.CalcDynamics(q_sim.GetQVecFromDict(q_dict),
+                     q_sim.GetQaCmdVecFromDict(q_dict), sim_params);
+
+  EXPECT_EQ(q_sim.get_removed_collision_pairs().size(), 5);
+  const auto &contact_results = q_sim.get_contact_results();
+  ASSERT_EQ(contact_results.num_point_pair_contacts(), 4);
+  std::set<std::pair<int, int>> corners;
+  for (int i = 0; i < 4; i++) {
+    const Vector3d p_BoxC =
+        contact_results.point_pair_contact_info(i).contact_point() - p_WBox;
+    EXPECT_NEAR(std::abs(p_BoxC[0]), 0.1, 0.01);
+    EXPECT_NEAR(std::abs(p_BoxC[1]), 0.1, 0.01);
+    corners.emplace(p_BoxC[0] > 0, p_BoxC[1] > 0);
+  }
+  EXPECT_EQ(corners.size(), 4);
+}
+
+/*
+ * The automatic collision filter removes the finger-finger pairs from the
+ * collision candidates, like excluding the pairs within the hand, and keeps
+ * the pairs between the hand and the sphere. Allowing the pairs within the
+ * hand brings them back.
+ */
+TEST(TestCollisionFilter, TestAllegroHand) {
+  const string kQModelPath =
+      GetQsimModelsPath() / "q_sys" / "allegro_hand_and_sphere.yml";
+  const string robot_name("allegro_hand_right");
+  auto make_simulator = [&](const CollisionFilterParameters &filter) {
+    auto parser = QuasistaticParser(kQModelPath);
+    parser.set_collision_filter(filter);
+    return parser.MakeSimulator();
+  };
+
+  // Numbers of candidates within the hand, between the hand and other
+  // model instances, and in total.
+  auto count_candidates = [&](const QuasistaticSimulator &q_sim) {
+    const auto &plant = q_sim.get_plant();
+    const auto &inspector = q_sim.get_scene_graph().model_inspector();
+    const auto model_robot = plant.GetModelInstanceByName(robot_name);
+    auto is_robot = [&](drake::geometry::GeometryId id) {
+      return plant.GetBodyFromFrameId(inspector.GetFrameId(id))
+                 ->model_instance() == model_robot;
+    };
+    const auto candidates = inspector.GetCollisionCandidates();
+    int n_robot_robot = 0;
+    int n_robot_other = 0;
+    for (const auto &[id_A, id_B] : candidates) {
+      n_robot_robot += is_robot(id_A) and is_robot(id_B);
+      n_robot_other += is_robot(id_A) != is_robot(id_B);
+    }
+    return std::make_tuple(n_robot_robot, n_robot_other,
+                           static_cast<int>(candidates.size()));
+  };
+
+  CollisionFilterParameters filter_none;
+  filter_none.auto_exclude = false;
+  const auto [n_rr_all, n_ro_all, n_all] =
+      count_candidates(*make_simulator(filter_none));
+  EXPECT_GT(n_rr_all, 0);
+  EXPECT_GT(n_ro_all, 0);
+
+  CollisionFilterParameters filter_excluded;
+  filter_excluded.auto_exclude = false;
+  filter_excluded.excluded_model_pairs.emplace_back(robot_name, robot_name);
+  const auto [n_rr_excluded, n_ro_excluded, n_excluded] =
+      count_candidates(*make_simulator(filter_excluded));
+  EXPECT_EQ(n_rr_excluded, 0);
+  EXPECT_EQ(n_ro_excluded, n_ro_all);
+  EXPECT_EQ(n_excluded, n_all - n_rr_all);
+
+  const auto [n_rr_auto, n_ro_auto, n_auto] =
+      count_candidates(*make_simulator(CollisionFilterParameters()));
+  EXPECT_EQ(n_rr_auto, 0);
+  EXPECT_GT(n_ro_auto, 0);
+  EXPECT_LT(n_auto, n_all);
+
+  CollisionFilterParameters filter_allowed;
+  filter_allowed.allowed_model_pairs.emplace_back(robot_name, robot_name);
+  const auto [n_rr_allowed, n_ro_allowed, n_allowed] =
+      count_candidates(*make_simulator(filter_allowed));
+  EXPECT_EQ(n_rr_allowed, n_rr_all);
+  EXPECT_EQ(n_ro_allowed, n_ro_auto);
+}
+
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
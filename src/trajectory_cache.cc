@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <iterator>
+
+#include "trajectory_cache.h"
+
+using Eigen::MatrixXd;
+using Eigen::VectorXd;
+
+namespace {
+/*
+ * Number of leading rows that are equal in a and b.
+ */
+int CountEqualRows(const Eigen::Ref<const MatrixXd> &a,
+                   const Eigen::Ref<const MatrixXd> &b) {
+  if (a.cols() != b.cols()) {
+    return 0;
+  }
+  const int n = std::min(a.rows(), b.rows());
+  for (int i = 0; i < n; i++) {
+    if (a.row(i) != b.row(i)) {
+      return i;
+    }
+  }
+  return n;
+}
+
+bool IsSameBundle(const BundledGradientParameters &a,
+                  const BundledGradientParameters &b) {
+  return a.n_samples == b.n_samples and a.seed == b.seed and
+         a.use_antithetic_samples == b.use_antithetic_samples and
+         a.use_control_variate == b.use_control_variate and
+         a.sample_sequence == b.sample_sequence and
+         a.use_adaptive_sampling == b.use_adaptive_sampling and
+         a.std_error_tolerance == b.std_error_tolerance and
+         a.n_samples_budget == b.n_samples_budget;
+}
+
+/*
+ * Keeps the first n elements of v, and appends the elements of tail.
+ */
+template <typename T>
+void Splice(const int n, std::vector<T> &&tail, std::vector<T> *v_ptr) {
+  auto &v = *v_ptr;
+  v.resize(std::min<size_t>(n, v.size()));
+  v.insert(v.end(), std::make_move_iterator(tail.begin()),
+           std::make_move_iterator(tail.end()));
+}
+
+template <typename T> void PopFront(std::vector<T> *v_ptr) {
+  if (not v_ptr->empty()) {
+    v_ptr->erase(v_ptr->begin());
+  }
+}
+
+void PopFrontRow(MatrixXd *m_ptr) {
+  if (m_ptr->rows() > 0) {
+    *m_ptr = m_ptr->bottomRows(m_ptr->rows() - 1).eval();
+  }
+}
+} // namespace
+
+TrajectoryCache::TrajectoryCache(const BatchQuasistaticSimulator &q_sim_batch,
+                                 const QuasistaticSimParameters &sim_params)
+    : q_sim_batch_(&q_sim_batch), sim_params_(sim_params) {}
+
+const Eigen::MatrixXd &
+TrajectoryCache::Rollout(const Eigen::Ref<const Eigen::VectorXd> &x0,
+                         const Eigen::Ref<const Eigen::MatrixXd> &u_trj) {
+  const int T = u_trj.rows();
+  const int n_q = x0.size();
+
+  // Time steps [0, t0) are reused.
+  int t0 = 0;
+  if (x_trj_.rows() > 0 and x_trj_.cols() == n_q and
+      x_trj_.row(0) == x0.transpose()) {
+    t0 = CountEqualRows(u_trj_, u_trj);
+    // Failed time steps are simulated again.
+    while (t0 > 0 and not is_valid_[t0 - 1]) {
+      t0--;
+    }
+  }
+
+  MatrixXd x_trj(T + 1, n_q);
+  VectorXb is_valid(T);
+  if (t0 > 0) {
+    x_trj.topRows(t0 + 1) = x_trj_.topRows(t0 + 1);
+  } else {
+    x_trj.row(0) = x0;
+  }
+  is_valid.head(t0) = is_valid_.head(t0);
+  if (t0 < T) {
+    auto sim_params = sim_params_;
+    sim_params.gradient_mode = GradientMode::kNone;
+    const auto rollouts = q_sim_batch_->RolloutParallel(
+        x_trj.row(t0), {u_trj.bottomRows(T - t0)}, sim_params);
+    x_trj.bottomRows(T - t0 + 1) = rollouts.x_trj_list[0];
+    is_valid.tail(T - t0) = rollouts.is_valid.row(0).transpose();
+    n_steps_simulated_ += T - t0;
+  }
+
+  x_trj_ = std::move(x_trj);
+  u_trj_ = u_trj;
+  is_valid_ = std::move(is_valid);
+  return x_trj_;
+}
+
+const BundledABcTrj &TrajectoryCache::CalcBundledABcTrj(
+    const Eigen::Ref<const Eigen::VectorXd> &std_u,
+    const BundledGradientParameters &bundle_params) {
+  const int T = u_trj_.rows();
+  if (not is_valid_.all()) {
+    throw std::runtime_error("Cannot linearize a failed rollout.");
+  }
+
+  // Time steps [0, t0) are reused.
+  int t0 = 0;
+  if (bundle_params_lin_.has_value() and
+      IsSameBundle(bundle_params, bundle_params_lin_.value()) and
+      std_u_lin_.size() == std_u.size() and std_u_lin_ == std_u) {
+    t0 = std::min(CountEqualRows(x_lin_trj_, x_trj_.topRows(T)),
+                  CountEqualRows(u_lin_trj_, u_trj_));
+  }
+
+  if (t0 < T) {
+    auto bundle_params_tail = bundle_params;
+    bundle_params_tail.time_step_offset = time_step_offset_ + t0;
+    auto ABc_tail = q_sim_batch_->CalcBundledABcTrj(
+        x_trj_.middleRows(t0, T - t0), u_trj_.bottomRows(T - t0), std_u,
+        sim_params_, bundle_params_tail);
+    Splice(t0, std::move(ABc_tail.A_list), &ABc_.A_list);
+    Splice(t0, std::move(ABc_tail.B_list), &ABc_.B_list);
+    Splice(t0, std::move(ABc_tail.c_list), &ABc_.c_list);
+    Splice(t0, std::move(ABc_tail.B_std_error_list), &ABc_.B_std_error_list);
+    Splice(t0, std::move(ABc_tail.c_std_error_list), &ABc_.c_std_error_list);
+    Splice(t0, std::move(ABc_tail.n_valid_samples), &ABc_.n_valid_samples);
+    Splice(t0, std::move(ABc_tail.n_samples_drawn), &ABc_.n_samples_drawn);
+    n_steps_linearized_ += T - t0;
+  }
+
+  x_lin_trj_ = x_trj_.topRows(T);
+  u_lin_trj_ = u_trj_;
+  std_u_lin_ = std_u;
+  bundle_params_lin_ = bundle_params;
+  return ABc_;
+}
+
+void TrajectoryCache::ShiftHorizon() {
+  time_step_offset_++;
+  PopFrontRow(&x_trj_);
+  PopFrontRow(&u_trj_);
+  if (is_valid_.size() > 0) {
+    is_valid_ = is_valid_.tail(is_valid_.size() - 1).eval();
+  }
+
+  PopFront(&ABc_.A_list);
+  PopFront(&ABc_.B_list);
+  PopFront(&ABc_.c_list);
+  PopFront(&ABc_.B_std_error_list);
+  PopFront(&ABc_.c_std_error_list);
+  PopFront(&ABc_.n_valid_samples);
+  PopFront(&ABc_.n_samples_drawn);
+  PopFrontRow(&x_lin_trj_);
+  PopFrontRow(&u_lin_trj_);
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "batch_quasistatic_simulator.h"
+
+/*
+ * Caches the rollout of a trajectory and its bundled linearization, so that
+ * repeated evaluations of similar trajectories only recompute what changed:
+ *  - Rollout reuses the states up to the first time step whose input
+ *    differs from the previous call, and simulates the rest.
+ *  - CalcBundledABcTrj reuses the linearization of every time step whose
+ *    state and input are unchanged. As the state of a time step depends on
+ *    all earlier inputs, this is the prefix before the first changed step.
+ *  - ShiftHorizon drops the first time step for receding-horizon control.
+ *    The remaining time steps keep their states and linearizations.
+ *
+ * States and inputs are compared for exact equality.
+ *
+ * The bundled linearization of absolute time step t (counting the shifts)
+ * always draws the samples of time step t, using
+ * BundledGradientParameters::time_step_offset. With a seed, the cached
+ * linearizations therefore agree with recomputing the whole trajectory up
+ * to rounding, unless adaptive sampling is used.
+ */
+class TrajectoryCache {
+public:
+  TrajectoryCache(const BatchQuasistaticSimulator &q_sim_batch,
+                  const QuasistaticSimParameters &sim_params);
+
+  /*
+   * Returns the (T + 1, n_q) states of rolling out the (T, n_u) u_trj from
+   * x0. The states after a failed time step are nan.
+   */
+  const Eigen::MatrixXd &
+  Rollout(const Eigen::Ref<const Eigen::VectorXd> &x0,
+          const Eigen::Ref<const Eigen::MatrixXd> &u_trj);
+
+  /*
+   * Bundled linearization along the trajectory of the last call to Rollout,
+   * as in BatchQuasistaticSimulator::CalcBundledABcTrj, with the
+   * gradient_mode of the sim_params given to the constructor.
+   * bundle_params.time_step_offset is ignored. Changing std_u or
+   * bundle_params invalidates the cache. Throws if the last rollout failed.
+   */
+  const BundledABcTrj &
+  CalcBundledABcTrj(const Eigen::Ref<const Eigen::VectorXd> &std_u,
+                    const BundledGradientParameters &bundle_params);
+
+  /*
+   * Drops the first time step of the cached trajectory and linearization.
+   */
+  void ShiftHorizon();
+
+  const Eigen::MatrixXd &get_x_trj() const { return x_trj_; }
+  const Eigen::MatrixXd &get_u_trj() const { return u_trj_; }
+  // Number of shifts since construction.
+  int get_time_step_offset() const { return time_step_offset_; }
+  // Total numbers of time steps simulated by Rollout and linearized by
+  // CalcBundledABcTrj.
+  int get_n_steps_simulated() const { return n_steps_simulated_; }
+  int get_n_steps_linearized() const { return n_steps_linearized_; }
+
+private:
+  const BatchQuasistaticSimulator *q_sim_batch_;
+  const QuasistaticSimParameters sim_params_;
+
+  Eigen::MatrixXd x_trj_;
+  Eigen::MatrixXd u_trj_;
+  VectorXb is_valid_;
+
+  // The states and inputs at which ABc_ was computed, and the parameters
+  // used.
+  BundledABcTrj ABc_;
+  Eigen::MatrixXd x_lin_trj_;
+  Eigen::MatrixXd u_lin_trj_;
+  Eigen::VectorXd std_u_lin_;
+  std::optional<BundledGradientParameters> bundle_params_lin_;
+
+  int time_step_offset_{0};
+  int n_steps_simulated_{0};
+  int n_steps_linearized_{0};
+};
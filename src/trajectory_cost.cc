@@ -0,0 +1,89 @@
+#include "drake/common/drake_throw.h"
+
+#include "trajectory_cost.h"
+
+using Eigen::MatrixXd;
+using Eigen::VectorXd;
+
+QuadraticTrajectoryCost::QuadraticTrajectoryCost(
+    const Eigen::Ref<const Eigen::MatrixXd> &Q,
+    const Eigen::Ref<const Eigen::MatrixXd> &Qf,
+    const Eigen::Ref<const Eigen::MatrixXd> &R,
+    const Eigen::Ref<const Eigen::MatrixXd> &x_ref_trj,
+    const Eigen::Ref<const Eigen::MatrixXd> &u_ref_trj)
+    : Q_(Q), Qf_(Qf), R_(R) {
+  DRAKE_THROW_UNLESS(Q_.rows() == Q_.cols());
+  DRAKE_THROW_UNLESS(Qf_.rows() == Q_.rows() and Qf_.cols() == Q_.cols());
+  DRAKE_THROW_UNLESS(R_.rows() == R_.cols());
+  set_x_ref_trj(x_ref_trj);
+  set_u_ref_trj(u_ref_trj);
+}
+
+void QuadraticTrajectoryCost::set_x_ref_trj(
+    const Eigen::Ref<const Eigen::MatrixXd> &x_ref_trj) {
+  DRAKE_THROW_UNLESS(x_ref_trj.cols() == Q_.rows());
+  x_ref_trj_ = x_ref_trj;
+}
+
+void QuadraticTrajectoryCost::set_u_ref_trj(
+    const Eigen::Ref<const Eigen::MatrixXd> &u_ref_trj) {
+  DRAKE_THROW_UNLESS(u_ref_trj.cols() == R_.rows());
+  u_ref_trj_ = u_ref_trj;
+}
+
+double QuadraticTrajectoryCost::Eval(const Eigen::MatrixXd &x_trj,
+                                     const Eigen::MatrixXd &u_trj) const {
+  const int T = u_trj.rows();
+  DRAKE_THROW_UNLESS(x_trj.rows() == T + 1);
+  DRAKE_THROW_UNLESS(x_ref_trj_.rows() == T + 1);
+  DRAKE_THROW_UNLESS(u_ref_trj_.rows() == T);
+
+  double cost = 0;
+  for (int t = 0; t < T; t++) {
+    const VectorXd dx = (x_trj.row(t) - x_ref_trj_.row(t)).transpose();
+    const VectorXd du = (u_trj.row(t) - u_ref_trj_.row(t)).transpose();
+    cost += dx.dot(Q_ * dx) + du.dot(R_ * du);
+  }
+  const VectorXd dx = (x_trj.row(T) - x_ref_trj_.row(T)).transpose();
+  cost += dx.dot(Qf_ * dx);
+
+  return cost;
+}
+
+double QuadraticTrajectoryCost::CalcStateCost(
+    const int t, const Eigen::Ref<const Eigen::VectorXd> &x) const {
+  const VectorXd dx = x - x_ref_trj_.row(t).transpose();
+  return dx.dot((t < u_ref_trj_.rows() ? Q_ : Qf_) * dx);
+}
+
+double QuadraticTrajectoryCost::CalcInputCost(
+    const int t, const Eigen::Ref<const Eigen::VectorXd> &u) const {
+  const VectorXd du = u - u_ref_trj_.row(t).transpose();
+  return du.dot(R_ * du);
+}
+
+Eigen::VectorXd QuadraticTrajectoryCost::CalcStateGradient(
+    const int t, const Eigen::Ref<const Eigen::VectorXd> &x) const {
+  return 2 * (t < u_ref_trj_.rows() ? Q_ : Qf_) *
+         (x - x_ref_trj_.row(t).transpose());
+}
+
+Eigen::VectorXd QuadraticTrajectoryCost::CalcInputGradient(
+    const int t, const Eigen::Ref<const Eigen::VectorXd> &u) const {
+  return 2 * R_ * (u - u_ref_trj_.row(t).transpose());
+}
+
+void QuadraticTrajectoryCost::ShiftReferences() {
+  ShiftTrajectory(&x_ref_trj_);
+  ShiftTrajectory(&u_ref_trj_);
+}
+
+void ShiftTrajectory(Eigen::MatrixXd *trj_ptr) {
+  auto &trj = *trj_ptr;
+  const auto n = trj.rows();
+  if (n < 2) {
+    return;
+  }
+  // topRows and bottomRows overlap, which needs an explicit copy.
+  trj.topRows(n - 1) = trj.bottomRows(n - 1).eval();
+}
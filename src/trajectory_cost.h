@@ -0,0 +1,67 @@
+#pragma once
+#include <functional>
+
+#include <Eigen/Dense>
+
+/*
+ * Cost of a trajectory with states x_trj, a (T + 1, n_q) matrix, and inputs
+ * u_trj, a (T, n_u) matrix.
+ */
+using TrajectoryCostFunction = std::function<double(
+    const Eigen::MatrixXd &x_trj, const Eigen::MatrixXd &u_trj)>;
+
+/*
+ * sum_{t < T} (|x_t - x_ref_t|_Q^2 + |u_t - u_ref_t|_R^2)
+ *   + |x_T - x_ref_T|_Qf^2,
+ * where |v|_M^2 := v^T M v, x_ref_trj is a (T + 1, n_q) matrix and
+ * u_ref_trj is a (T, n_u) matrix.
+ */
+class QuadraticTrajectoryCost {
+public:
+  QuadraticTrajectoryCost(const Eigen::Ref<const Eigen::MatrixXd> &Q,
+                          const Eigen::Ref<const Eigen::MatrixXd> &Qf,
+                          const Eigen::Ref<const Eigen::MatrixXd> &R,
+                          const Eigen::Ref<const Eigen::MatrixXd> &x_ref_trj,
+                          const Eigen::Ref<const Eigen::MatrixXd> &u_ref_trj);
+
+  double Eval(const Eigen::MatrixXd &x_trj,
+              const Eigen::MatrixXd &u_trj) const;
+
+  /*
+   * Terms and gradients of the cost at a single time step t, where x is
+   * x_t and u is u_t. With T := u_ref_trj.rows(), the state term of t = T
+   * uses Qf, and t < T uses Q.
+   */
+  double CalcStateCost(int t, const Eigen::Ref<const Eigen::VectorXd> &x) const;
+  double CalcInputCost(int t, const Eigen::Ref<const Eigen::VectorXd> &u) const;
+  Eigen::VectorXd
+  CalcStateGradient(int t, const Eigen::Ref<const Eigen::VectorXd> &x) const;
+  Eigen::VectorXd
+  CalcInputGradient(int t, const Eigen::Ref<const Eigen::VectorXd> &u) const;
+
+  /*
+   * Shifts the references by one time step for receding-horizon control:
+   * row t becomes row t + 1, and the last row is repeated.
+   */
+  void ShiftReferences();
+
+  void set_x_ref_trj(const Eigen::Ref<const Eigen::MatrixXd> &x_ref_trj);
+  void set_u_ref_trj(const Eigen::Ref<const Eigen::MatrixXd> &u_ref_trj);
+  const Eigen::MatrixXd &get_x_ref_trj() const { return x_ref_trj_; }
+  const Eigen::MatrixXd &get_u_ref_trj() const { return u_ref_trj_; }
+  const Eigen::MatrixXd &get_Q() const { return Q_; }
+  const Eigen::MatrixXd &get_Qf() const { return Qf_; }
+  const Eigen::MatrixXd &get_R() const { return R_; }
+
+private:
+  const Eigen::MatrixXd Q_;
+  const Eigen::MatrixXd Qf_;
+  const Eigen::MatrixXd R_;
+  Eigen::MatrixXd x_ref_trj_;
+  Eigen::MatrixXd u_ref_trj_;
+};
+
+/*
+ * Moves row t + 1 of trj to row t, and repeats the last row.
+ */
+void ShiftTrajectory(Eigen::MatrixXd *trj_ptr);